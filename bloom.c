@@ -0,0 +1,303 @@
+/*
+ * bloom.c
+ *
+ * Changed-path Bloom filters, so that path-limited history walks can
+ * skip the tree diff of most commits that do not touch the paths.
+ *
+ * $GIT_DIR/objects/info/bloom-filters holds a header, a table of
+ * (commit, end of its filter) sorted by commit, and the filters.  Each
+ * filter has BLOOM_BITS_PER_ENTRY bits for every changed path and
+ * leading directory, and every name sets BLOOM_NUM_HASHES of them.
+ */
+#include "cache.h"
+#include "commit.h"
+#include "diff.h"
+#include "diffcore.h"
+#include "bloom.h"
+
+#define BLOOM_SIGNATURE 0x424c4d46	/* "BLMF" */
+#define BLOOM_VERSION 1
+
+#define BLOOM_BITS_PER_ENTRY 10
+#define BLOOM_NUM_HASHES 7
+#define BLOOM_MAX_CHANGED 512
+
+struct bloom_header {
+	uint32_t signature;
+	uint32_t version;
+	uint32_t nr;
+};
+
+struct bloom_entry {
+	unsigned char sha1[20];
+	uint32_t end;
+};
+
+static const struct bloom_entry *bloom_table;
+static const unsigned char *bloom_data;
+static uint32_t bloom_nr;
+static int bloom_prepared;
+
+static void prepare_bloom_filters(void)
+{
+	const struct bloom_header *hdr;
+	const char *path;
+	struct stat st;
+	size_t size, table_size;
+	void *map;
+	int fd;
+
+	if (bloom_prepared)
+		return;
+	bloom_prepared = 1;
+
+	path = mkpath("%s/info/bloom-filters", get_object_directory());
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return;
+	if (fstat(fd, &st) || st.st_size < sizeof(*hdr)) {
+		close(fd);
+		return;
+	}
+	size = xsize_t(st.st_size);
+	map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	hdr = map;
+	table_size = sizeof(*hdr) + (size_t)ntohl(hdr->nr) * sizeof(struct bloom_entry);
+	if (ntohl(hdr->signature) != BLOOM_SIGNATURE ||
+	    ntohl(hdr->version) != BLOOM_VERSION ||
+	    size < table_size) {
+		warning("ignoring invalid %s", path);
+		munmap(map, size);
+		return;
+	}
+	bloom_table = (const struct bloom_entry *)(hdr + 1);
+	bloom_nr = ntohl(hdr->nr);
+	bloom_data = (const unsigned char *)map + table_size;
+	if (bloom_nr && size - table_size < ntohl(bloom_table[bloom_nr - 1].end)) {
+		warning("ignoring truncated %s", path);
+		bloom_nr = 0;
+	}
+}
+
+static int find_bloom_entry(const unsigned char *sha1)
+{
+	uint32_t lo = 0, hi = bloom_nr;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(bloom_table[mi].sha1, sha1);
+		if (!cmp)
+			return mi;
+		if (cmp < 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return -1;
+}
+
+/*
+ * Returns 0 and fills "filter" if we have a filter for the commit.
+ */
+int get_bloom_filter(const unsigned char *commit_sha1,
+		     struct bloom_filter *filter)
+{
+	uint32_t begin;
+	int pos;
+
+	prepare_bloom_filters();
+	pos = find_bloom_entry(commit_sha1);
+	if (pos < 0)
+		return -1;
+	begin = pos ? ntohl(bloom_table[pos - 1].end) : 0;
+	filter->data = bloom_data + begin;
+	filter->len = ntohl(bloom_table[pos].end) - begin;
+	return 0;
+}
+
+static uint32_t bloom_hash(uint32_t seed, const char *name, int len)
+{
+	uint32_t hash = seed;
+	int i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= (unsigned char)name[i];
+		hash *= 0x5bd1e995;
+		hash ^= hash >> 15;
+	}
+	hash ^= len;
+	hash *= 0x85ebca6b;
+	hash ^= hash >> 13;
+	return hash;
+}
+
+static void bloom_bits(const char *name, int len, unsigned long nbits,
+		       unsigned long *bit)
+{
+	uint32_t h1 = bloom_hash(0x293ae76f, name, len);
+	uint32_t h2 = bloom_hash(0x7e646e2c, name, len);
+	int i;
+
+	for (i = 0; i < BLOOM_NUM_HASHES; i++)
+		bit[i] = (h1 + (uint32_t)i * h2) % nbits;
+}
+
+/*
+ * Returns 0 if "path" (a file or a leading directory) definitely did
+ * not change.
+ */
+int bloom_filter_may_contain(const struct bloom_filter *filter,
+			     const char *path, int len)
+{
+	unsigned long bit[BLOOM_NUM_HASHES];
+	int i;
+
+	if (!filter->len)
+		return 1;
+	bloom_bits(path, len, filter->len * 8, bit);
+	for (i = 0; i < BLOOM_NUM_HASHES; i++)
+		if (!(filter->data[bit[i] / 8] & (1 << (bit[i] % 8))))
+			return 0;
+	return 1;
+}
+
+static void bloom_add(unsigned char *data, unsigned long len,
+		      const char *name, int namelen)
+{
+	unsigned long bit[BLOOM_NUM_HASHES];
+	int i;
+
+	bloom_bits(name, namelen, len * 8, bit);
+	for (i = 0; i < BLOOM_NUM_HASHES; i++)
+		data[bit[i] / 8] |= 1 << (bit[i] % 8);
+}
+
+/*
+ * Compute the filter of "commit" at the end of "out".  The paths
+ * come out of the tree diff sorted, so a leading directory only needs
+ * to be added when the previous path was not in it already.
+ */
+static void compute_bloom_filter(struct commit *commit, struct strbuf *out)
+{
+	struct diff_options opt;
+	struct diff_queue_struct *q = &diff_queued_diff;
+	const char *prev;
+	unsigned long len, nr = 0;
+	unsigned char *data = NULL;
+	int i, pass;
+
+	diff_setup(&opt);
+	DIFF_OPT_SET(&opt, RECURSIVE);
+	opt.output_format = DIFF_FORMAT_NO_OUTPUT;
+	if (diff_setup_done(&opt) < 0)
+		die("diff setup failed");
+	if (commit->parents) {
+		if (parse_commit(commit->parents->item))
+			die("unable to parse parent of %s",
+			    sha1_to_hex(commit->object.sha1));
+		diff_tree_sha1(commit->parents->item->tree->object.sha1,
+			       commit->tree->object.sha1, "", &opt);
+	} else
+		diff_root_tree_sha1(commit->tree->object.sha1, "", &opt);
+
+	/* count the names first, then set their bits */
+	len = 0;
+	for (pass = 0; pass < 2; pass++) {
+		prev = "";
+		for (i = 0; i < q->nr; i++) {
+			const char *path = q->queue[i]->two->path;
+			const char *slash;
+
+			for (slash = strchr(path, '/'); slash;
+			     slash = strchr(slash + 1, '/')) {
+				int dirlen = slash - path;
+				if (!strncmp(prev, path, dirlen + 1))
+					continue;
+				if (pass)
+					bloom_add(data, len, path, dirlen);
+				else
+					nr++;
+			}
+			if (pass)
+				bloom_add(data, len, path, strlen(path));
+			else
+				nr++;
+			prev = path;
+		}
+		if (pass || nr > BLOOM_MAX_CHANGED)
+			break;
+		len = (nr * BLOOM_BITS_PER_ENTRY + 7) / 8;
+		if (!len)
+			len = 1;
+		strbuf_grow(out, len);
+		data = (unsigned char *)out->buf + out->len;
+		memset(data, 0, len);
+	}
+	strbuf_setlen(out, out->len + len);
+	diff_flush(&opt);
+}
+
+static int commit_sha1_cmp(const void *a_, const void *b_)
+{
+	struct commit *a = *(struct commit **)a_, *b = *(struct commit **)b_;
+	return hashcmp(a->object.sha1, b->object.sha1);
+}
+
+/*
+ * Write the filters of the given (parsed) commits, reusing those we
+ * have already.  Commits with grafted parents are left out, as their
+ * parents may not stay what they are now.
+ */
+int write_bloom_filters(struct commit **commits, int nr)
+{
+	static struct lock_file lock;
+	struct bloom_header hdr;
+	struct bloom_entry *table;
+	struct strbuf data;
+	char *path;
+	int i, j, fd;
+
+	prepare_bloom_filters();
+	qsort(commits, nr, sizeof(*commits), commit_sha1_cmp);
+	table = xmalloc(nr * sizeof(*table));
+	strbuf_init(&data, 0);
+	for (i = j = 0; i < nr; i++) {
+		struct commit *commit = commits[i];
+		struct bloom_filter filter;
+
+		if (i && commits[i - 1] == commit)
+			continue;
+		if (lookup_commit_graft(commit->object.sha1))
+			continue;
+		if (!get_bloom_filter(commit->object.sha1, &filter))
+			strbuf_add(&data, filter.data, filter.len);
+		else
+			compute_bloom_filter(commit, &data);
+		if (data.len != (uint32_t)data.len)
+			die("too many bloom filters");
+		hashcpy(table[j].sha1, commit->object.sha1);
+		table[j].end = htonl(data.len);
+		j++;
+	}
+
+	path = mkpath("%s/info/bloom-filters", get_object_directory());
+	if (safe_create_leading_directories(path))
+		return error("unable to create directory for %s", path);
+	fd = hold_lock_file_for_update(&lock, path, 1);
+	hdr.signature = htonl(BLOOM_SIGNATURE);
+	hdr.version = htonl(BLOOM_VERSION);
+	hdr.nr = htonl(j);
+	if (write_in_full(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+	    write_in_full(fd, table, j * sizeof(*table)) != j * sizeof(*table) ||
+	    write_in_full(fd, data.buf, data.len) != data.len) {
+		rollback_lock_file(&lock);
+		return error("unable to write %s", path);
+	}
+	free(table);
+	strbuf_release(&data);
+	if (commit_lock_file(&lock) < 0)
+		return error("unable to write %s", path);
+	return 0;
+}
@@ -0,0 +1,23 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+struct commit;
+
+/*
+ * The changed-path filter of a commit: which paths (and leading
+ * directories) differ between its tree and that of its first parent
+ * (or the empty tree for a root commit).  An empty filter means that
+ * too many paths changed to bother, i.e. "anything may have changed".
+ */
+struct bloom_filter {
+	const unsigned char *data;
+	unsigned long len;
+};
+
+extern int get_bloom_filter(const unsigned char *commit_sha1,
+			    struct bloom_filter *filter);
+extern int bloom_filter_may_contain(const struct bloom_filter *filter,
+				    const char *path, int len);
+extern int write_bloom_filters(struct commit **commits, int nr);
+
+#endif
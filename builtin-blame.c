@@ -18,9 +18,13 @@
 #include "cache-tree.h"
 #include "path-list.h"
 #include "mailmap.h"
+#ifdef USE_PTHREADS
+#include "thread-utils.h"
+#include <pthread.h>
+#endif
 
 static char blame_usage[] =
-"git-blame [-c] [-b] [-l] [--root] [-t] [-f] [-n] [-s] [-p] [-w] [-L n,m] [-S <revs-file>] [-M] [-C] [-C] [--contents <filename>] [--incremental] [commit] [--] file\n"
+"git-blame [-c] [-b] [-l] [--root] [-t] [-f] [-n] [-s] [-p] [-w] [-L n,m] [-S <revs-file>] [-M] [-C] [-C] [--contents <filename>] [--incremental | --stream] [commit] [--] file\n"
 "  -c                  Use the same output mode as git-annotate (Default: off)\n"
 "  -b                  Show blank SHA-1 for boundary commits (Default: off)\n"
 "  -l                  Show long commit SHA1 (Default: off)\n"
@@ -34,6 +38,7 @@ static char blame_usage[] =
 "  -L n,m              Process only line range n,m, counting from 1\n"
 "  -M, -C              Find line movements within and across files\n"
 "  --incremental       Show blame entries as we find them, incrementally\n"
+"  --stream            Like --incremental, in binary records for programs\n"
 "  --contents file     Use <file>'s contents as the final image\n"
 "  -S revs-file        Use revisions from revs-file instead of calling git-rev-list\n";
 
@@ -45,8 +50,10 @@ static int max_score_digits;
 static int show_root;
 static int blank_boundary;
 static int incremental;
+static int stream_output;
 static int cmd_is_annotate;
 static int xdl_opts = XDF_NEED_MINIMAL;
+static int use_blame_cache;
 static struct path_list mailmap;
 
 #ifndef DEBUG
@@ -75,6 +82,7 @@ static unsigned blame_copy_score;
 /* bits #0..7 in revision.h, #8..11 used for merge_bases() in commit.c */
 #define METAINFO_SHOWN		(1u<<12)
 #define MORE_THAN_ONE_PATH	(1u<<13)
+#define PREFETCH_SEEN		(1u<<14)
 
 /*
  * One blob in a commit that is being suspected
@@ -551,6 +559,337 @@ static struct patch *compare_buffer(mmfile_t *file_p, mmfile_t *file_o,
 	return state.ret;
 }
 
+static void free_patch(struct patch *p)
+{
+	free(p->chunks);
+	free(p);
+}
+
+#ifdef USE_PTHREADS
+/*
+ * Most of the time spent blaming a big file goes into diffing its
+ * versions against their parents, one suspect at a time.  Which pairs
+ * of blobs get_patch() will be asked about can mostly be told in
+ * advance by following the path down the history, so with threads we
+ * keep a few of the next pairs queued, and workers diff them while
+ * assign_blame() is busy with the current suspect.  get_patch() takes
+ * the patch when it gets to a pair, and diffs it itself if nobody did.
+ * A patch only depends on the two blobs, so the output is the same as
+ * without threads; a wrong guess (e.g. across a rename) only costs the
+ * diff nobody asks for.
+ *
+ * The object store is not thread safe.  The main thread holds
+ * read_mutex while it is not waiting for or running a diff, and the
+ * workers take it to read their blobs.
+ */
+#define BLAME_MIN_PREFETCH_LINES 1000
+#define BLAME_PREFETCH_PER_THREAD 16
+#define BLAME_MAX_THREADS 16
+
+enum diff_job_state {
+	DIFF_JOB_QUEUED,
+	DIFF_JOB_RUNNING,
+	DIFF_JOB_DONE
+};
+
+struct diff_job {
+	struct diff_job *next;
+	unsigned char one[20];		/* parent */
+	unsigned char two[20];		/* target */
+	enum diff_job_state state;
+	struct patch *patch;
+};
+
+/* the commits to follow the path from, newest first */
+struct prefetch_point {
+	struct prefetch_point *next;
+	struct commit *commit;
+	unsigned char blob_sha1[20];
+	char path[FLEX_ARRAY];
+};
+
+static struct prefetch {
+	struct prefetch_point *points;
+
+	/* the commits we marked PREFETCH_SEEN */
+	struct commit **seen;
+	int seen_nr, seen_alloc;
+
+	/* the pairs nobody has taken yet, in the order we queued them */
+	struct diff_job *jobs;
+	int nr_jobs, max_jobs;
+	int stop;
+
+	int nr_threads;
+	pthread_t threads[BLAME_MAX_THREADS];
+	int started[BLAME_MAX_THREADS];
+} prefetch;
+
+static pthread_mutex_t read_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define read_lock()		pthread_mutex_lock(&read_mutex)
+#define read_unlock()		pthread_mutex_unlock(&read_mutex)
+
+static pthread_mutex_t job_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t job_done = PTHREAD_COND_INITIALIZER;
+
+static void *run_diff_jobs(void *unused)
+{
+	pthread_mutex_lock(&job_mutex);
+	for (;;) {
+		struct diff_job *job;
+		enum object_type type;
+		mmfile_t file_p, file_o;
+		struct patch *patch = NULL;
+
+		for (job = prefetch.jobs; job; job = job->next)
+			if (job->state == DIFF_JOB_QUEUED)
+				break;
+		if (!job) {
+			if (prefetch.stop)
+				break;
+			pthread_cond_wait(&job_queued, &job_mutex);
+			continue;
+		}
+		job->state = DIFF_JOB_RUNNING;
+		pthread_mutex_unlock(&job_mutex);
+
+		read_lock();
+		file_p.ptr = read_sha1_file(job->one, &type,
+					    (unsigned long *)&file_p.size);
+		file_o.ptr = read_sha1_file(job->two, &type,
+					    (unsigned long *)&file_o.size);
+		read_unlock();
+		if (file_p.ptr && file_o.ptr)
+			patch = compare_buffer(&file_p, &file_o, 0);
+		free(file_p.ptr);
+		free(file_o.ptr);
+
+		pthread_mutex_lock(&job_mutex);
+		job->patch = patch;
+		job->state = DIFF_JOB_DONE;
+		pthread_cond_broadcast(&job_done);
+	}
+	pthread_mutex_unlock(&job_mutex);
+	return NULL;
+}
+
+static void add_prefetch_point(struct commit *commit,
+			       const unsigned char *blob_sha1,
+			       const char *path)
+{
+	struct prefetch_point *pt, **pp;
+
+	commit->object.flags |= PREFETCH_SEEN;
+	ALLOC_GROW(prefetch.seen, prefetch.seen_nr + 1, prefetch.seen_alloc);
+	prefetch.seen[prefetch.seen_nr++] = commit;
+	pt = xmalloc(sizeof(*pt) + strlen(path) + 1);
+	pt->commit = commit;
+	hashcpy(pt->blob_sha1, blob_sha1);
+	strcpy(pt->path, path);
+	for (pp = &prefetch.points; *pp; pp = &(*pp)->next)
+		if ((*pp)->commit->date < commit->date)
+			break;
+	pt->next = *pp;
+	*pp = pt;
+}
+
+static void add_diff_job(const unsigned char *one, const unsigned char *two)
+{
+	struct diff_job *job, **tail;
+
+	job = xcalloc(1, sizeof(*job));
+	hashcpy(job->one, one);
+	hashcpy(job->two, two);
+	for (tail = &prefetch.jobs; *tail; tail = &(*tail)->next)
+		;
+	*tail = job;
+	prefetch.nr_jobs++;
+}
+
+/*
+ * Follow the path down from the newest commit we have not looked at,
+ * like pass_blame() would, and queue the pairs it would diff, until
+ * we are far enough ahead.  Called by the main thread, with job_mutex
+ * and read_mutex held.
+ */
+static void queue_diff_jobs(void)
+{
+	while (prefetch.points && prefetch.nr_jobs < prefetch.max_jobs) {
+		struct prefetch_point *pt = prefetch.points;
+		struct commit_list *parent;
+		unsigned char sha1[20];
+		unsigned mode;
+		int queued = 0;
+
+		prefetch.points = pt->next;
+
+		/* the whole blame goes to a parent with the same blob */
+		for (parent = pt->commit->parents; parent; parent = parent->next) {
+			struct commit *p = parent->item;
+			if (parse_commit(p) || (p->object.flags & UNINTERESTING) ||
+			    get_tree_entry(p->tree->object.sha1, pt->path,
+					   sha1, &mode))
+				continue;
+			if (!hashcmp(sha1, pt->blob_sha1))
+				break;
+		}
+		if (parent) {
+			if (!(parent->item->object.flags & PREFETCH_SEEN))
+				add_prefetch_point(parent->item, sha1, pt->path);
+			free(pt);
+			continue;
+		}
+
+		for (parent = pt->commit->parents; parent; parent = parent->next) {
+			struct commit *p = parent->item;
+			if ((p->object.flags & UNINTERESTING) || !p->tree ||
+			    get_tree_entry(p->tree->object.sha1, pt->path,
+					   sha1, &mode))
+				continue;
+			add_diff_job(sha1, pt->blob_sha1);
+			queued = 1;
+			if (!(p->object.flags & PREFETCH_SEEN))
+				add_prefetch_point(p, sha1, pt->path);
+		}
+		free(pt);
+		if (queued)
+			pthread_cond_broadcast(&job_queued);
+	}
+}
+
+static void free_prefetch_points(void)
+{
+	while (prefetch.points) {
+		struct prefetch_point *pt = prefetch.points;
+		prefetch.points = pt->next;
+		free(pt);
+	}
+}
+
+/*
+ * Forget what we guessed, except for the pairs a worker is busy with,
+ * and what commits we have seen.  With job_mutex held.
+ */
+static void drop_diff_jobs(void)
+{
+	struct diff_job *job, **pp = &prefetch.jobs;
+
+	while ((job = *pp) != NULL) {
+		if (job->state == DIFF_JOB_RUNNING) {
+			pp = &job->next;
+			continue;
+		}
+		*pp = job->next;
+		prefetch.nr_jobs--;
+		if (job->patch)
+			free_patch(job->patch);
+		free(job);
+	}
+	free_prefetch_points();
+	while (prefetch.seen_nr)
+		prefetch.seen[--prefetch.seen_nr]->object.flags &= ~PREFETCH_SEEN;
+}
+
+static void start_prefetch(struct scoreboard *sb)
+{
+	struct origin *o = sb->ent->suspect;
+	int i;
+
+	prefetch.nr_threads = online_cpus();
+	if (prefetch.nr_threads > BLAME_MAX_THREADS)
+		prefetch.nr_threads = BLAME_MAX_THREADS;
+	if (prefetch.nr_threads < 2 || sb->num_lines < BLAME_MIN_PREFETCH_LINES ||
+	    is_null_sha1(o->blob_sha1)) {
+		prefetch.nr_threads = 0;
+		return;
+	}
+
+	prefetch.max_jobs = prefetch.nr_threads * BLAME_PREFETCH_PER_THREAD;
+	read_lock();
+	add_prefetch_point(o->commit, o->blob_sha1, o->path);
+	queue_diff_jobs();
+	for (i = 0; i < prefetch.nr_threads; i++)
+		prefetch.started[i] = !pthread_create(&prefetch.threads[i], NULL,
+						       run_diff_jobs, NULL);
+}
+
+static void stop_prefetch(void)
+{
+	int i;
+
+	if (!prefetch.nr_threads)
+		return;
+	pthread_mutex_lock(&job_mutex);
+	prefetch.stop = 1;
+	pthread_cond_broadcast(&job_queued);
+	pthread_mutex_unlock(&job_mutex);
+	read_unlock();
+	for (i = 0; i < prefetch.nr_threads; i++)
+		if (prefetch.started[i])
+			pthread_join(prefetch.threads[i], NULL);
+	drop_diff_jobs();
+	free(prefetch.seen);
+	prefetch.seen = NULL;
+	prefetch.seen_alloc = 0;
+	prefetch.nr_threads = 0;
+}
+
+/*
+ * Take the patch between the two blobs if it was (or is being)
+ * computed in advance.  A pair no worker has started on is taken off
+ * the queue so that the caller can diff it.
+ *
+ * If we did not see the pair coming (e.g. the path was renamed), go
+ * on from the parent.  assign_blame() does not go down the branches
+ * of a merge in date order either, so if the queue is full of pairs
+ * nobody asked for while we are asked for others, they were wrong
+ * guesses and we start over from here.
+ */
+static struct patch *get_prefetched_patch(struct origin *parent,
+					  struct origin *origin)
+{
+	const unsigned char *one = parent->blob_sha1, *two = origin->blob_sha1;
+	struct diff_job *job, **pp;
+	struct patch *patch = NULL;
+
+	pthread_mutex_lock(&job_mutex);
+	for (pp = &prefetch.jobs; (job = *pp) != NULL; pp = &job->next)
+		if (!hashcmp(job->one, one) && !hashcmp(job->two, two))
+			break;
+	if (job) {
+		if (job->state == DIFF_JOB_RUNNING) {
+			/* only we unlink jobs, so pp stays valid */
+			read_unlock();
+			while (job->state != DIFF_JOB_DONE)
+				pthread_cond_wait(&job_done, &job_mutex);
+			/*
+			 * queue_diff_jobs() reads objects.  No worker
+			 * waits for job_mutex with read_mutex held, so
+			 * taking it back here cannot deadlock.
+			 */
+			read_lock();
+		}
+		*pp = job->next;
+		prefetch.nr_jobs--;
+		patch = job->patch;
+		free(job);
+	} else {
+		if (prefetch.nr_jobs >= prefetch.max_jobs)
+			drop_diff_jobs();
+		if (!(parent->commit->object.flags & PREFETCH_SEEN))
+			add_prefetch_point(parent->commit, parent->blob_sha1,
+					   parent->path);
+	}
+	queue_diff_jobs();
+	pthread_mutex_unlock(&job_mutex);
+	return patch;
+}
+#else
+#define start_prefetch(sb)	(void)0
+#define stop_prefetch()		(void)0
+#endif
+
 /*
  * Run diff between two origins and grab the patch output, so that
  * we can pass blame for lines origin is currently suspected for
@@ -561,21 +900,32 @@ static struct patch *get_patch(struct origin *parent, struct origin *origin)
 	mmfile_t file_p, file_o;
 	struct patch *patch;
 
+#ifdef USE_PTHREADS
+	if (prefetch.nr_threads &&
+	    !is_null_sha1(parent->blob_sha1) && !is_null_sha1(origin->blob_sha1)) {
+		patch = get_prefetched_patch(parent, origin);
+		if (patch) {
+			num_get_patch++;
+			return patch;
+		}
+	}
+#endif
 	fill_origin_blob(parent, &file_p);
 	fill_origin_blob(origin, &file_o);
 	if (!file_p.ptr || !file_o.ptr)
 		return NULL;
+#ifdef USE_PTHREADS
+	if (prefetch.nr_threads) {
+		read_unlock();
+		patch = compare_buffer(&file_p, &file_o, 0);
+		read_lock();
+	} else
+#endif
 	patch = compare_buffer(&file_p, &file_o, 0);
 	num_get_patch++;
 	return patch;
 }
 
-static void free_patch(struct patch *p)
-{
-	free(p->chunks);
-	free(p);
-}
-
 /*
  * Link in a new blame entry to the scoreboard.  Entries that cover the
  * same line range have been removed from the scoreboard previously.
@@ -1033,8 +1383,211 @@ static int find_move_in_parent(struct scoreboard *sb,
 struct blame_list {
 	struct blame_entry *ent;
 	struct blame_entry split[3];
+
+	/* the copy sources that may give a good enough split */
+	int *cand;
+	int cand_nr, cand_pos;
+};
+
+static void free_blame_list(struct blame_list *blame_list, int num_ents)
+{
+	int i;
+
+	for (i = 0; i < num_ents; i++)
+		free(blame_list[i].cand);
+	free(blame_list);
+}
+
+/*
+ * Most of the files find_copy_in_parent() looks at share no lines
+ * with an entry, or only a few trivial ones, so comparing the entry
+ * with them cannot give a split that is good enough to pass the blame.
+ * To avoid running the diff for such pairs, we index the lines of all
+ * the candidate blobs by their hash, and for each entry add up the
+ * alnum characters (see ent_score()) of the runs of its lines that a
+ * candidate has.  Lines without alnum characters are not indexed and
+ * do not break a run.  If no run of a candidate scores above
+ * blame_copy_score, no split from it can, as the diff only matches
+ * lines that are the same, so the candidate is skipped for that entry.
+ */
+struct copy_index_entry {
+	uint32_t hash;
+	int cand;
 };
 
+struct copy_index {
+	struct copy_index_entry *entry;
+	int nr, alloc;
+
+	/* per candidate state while looking up an entry */
+	int num_cands;
+	int *seen;
+	int *last;
+	unsigned *run;
+	unsigned *best;
+};
+
+/*
+ * Hash one line, ignoring whitespace if we are told to, and count its
+ * alnum characters.  Returns the beginning of the next line.
+ */
+static const char *hash_copy_line(const char *cp, const char *end,
+				  uint32_t *hash_p, unsigned *alnum_p)
+{
+	uint32_t hash = 5381;
+	unsigned alnum = 0;
+
+	for (; cp < end && *cp != '\n'; cp++) {
+		unsigned ch = *((unsigned char *)cp);
+		if ((xdl_opts & XDF_IGNORE_WHITESPACE) && isspace(ch))
+			continue;
+		if (isalnum(ch))
+			alnum++;
+		hash = hash * 33 + ch;
+	}
+	*hash_p = hash;
+	*alnum_p = alnum;
+	return cp < end ? cp + 1 : cp;
+}
+
+static int copy_index_entry_cmp(const void *a_, const void *b_)
+{
+	const struct copy_index_entry *a = a_, *b = b_;
+
+	if (a->hash != b->hash)
+		return a->hash < b->hash ? -1 : 1;
+	return a->cand - b->cand;
+}
+
+static void add_copy_candidate(struct copy_index *index, int cand,
+			       const unsigned char *sha1)
+{
+	enum object_type type;
+	unsigned long size;
+	const char *cp, *end;
+	char *buf;
+
+	buf = read_sha1_file(sha1, &type, &size);
+	if (!buf)
+		return;
+	num_read_blob++;
+	for (cp = buf, end = buf + size; cp < end; ) {
+		uint32_t hash;
+		unsigned alnum;
+
+		cp = hash_copy_line(cp, end, &hash, &alnum);
+		if (!alnum)
+			continue;
+		ALLOC_GROW(index->entry, index->nr + 1, index->alloc);
+		index->entry[index->nr].hash = hash;
+		index->entry[index->nr].cand = cand;
+		index->nr++;
+	}
+	free(buf);
+}
+
+static void finish_copy_index(struct copy_index *index, int num_cands)
+{
+	int i, nr;
+
+	qsort(index->entry, index->nr, sizeof(*index->entry),
+	      copy_index_entry_cmp);
+	for (i = nr = 0; i < index->nr; i++)
+		if (!nr || copy_index_entry_cmp(&index->entry[nr - 1],
+						&index->entry[i]))
+			index->entry[nr++] = index->entry[i];
+	index->nr = nr;
+
+	index->num_cands = num_cands;
+	index->seen = xcalloc(num_cands, sizeof(int));
+	index->last = xcalloc(num_cands, sizeof(int));
+	index->run = xcalloc(num_cands, sizeof(unsigned));
+	index->best = xcalloc(num_cands, sizeof(unsigned));
+}
+
+static void free_copy_index(struct copy_index *index)
+{
+	free(index->entry);
+	free(index->seen);
+	free(index->last);
+	free(index->run);
+	free(index->best);
+}
+
+static int find_copy_index_entry(struct copy_index *index, uint32_t hash)
+{
+	int lo = 0, hi = index->nr;
+
+	while (lo < hi) {
+		int mi = lo + (hi - lo) / 2;
+		if (index->entry[mi].hash < hash)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return lo;
+}
+
+static int int_cmp(const void *a_, const void *b_)
+{
+	return *(const int *)a_ - *(const int *)b_;
+}
+
+/*
+ * Fill the list of candidates that may be good enough copy sources
+ * for the entry.
+ */
+static void find_copy_candidates(struct scoreboard *sb,
+				 struct copy_index *index,
+				 struct blame_list *bl, int stamp)
+{
+	struct blame_entry *ent = bl->ent;
+	const char *cp = nth_line(sb, ent->lno);
+	const char *end = nth_line(sb, ent->lno + ent->num_lines);
+	int *touched = NULL;
+	int touched_nr = 0, touched_alloc = 0;
+	int i, k, prev = -1;
+
+	for (k = 0; cp < end; k++) {
+		uint32_t hash;
+		unsigned alnum;
+
+		cp = hash_copy_line(cp, end, &hash, &alnum);
+		if (!alnum)
+			continue;
+		for (i = find_copy_index_entry(index, hash);
+		     i < index->nr && index->entry[i].hash == hash;
+		     i++) {
+			int c = index->entry[i].cand;
+
+			if (index->seen[c] != stamp) {
+				index->seen[c] = stamp;
+				index->last[c] = -1;
+				index->best[c] = 0;
+				ALLOC_GROW(touched, touched_nr + 1, touched_alloc);
+				touched[touched_nr++] = c;
+			}
+			if (prev >= 0 && index->last[c] == prev)
+				index->run[c] += alnum;
+			else
+				index->run[c] = alnum;
+			index->last[c] = k;
+			if (index->best[c] < index->run[c])
+				index->best[c] = index->run[c];
+		}
+		prev = k;
+	}
+
+	bl->cand_nr = 0;
+	for (i = 0; i < touched_nr; i++) {
+		int c = touched[i];
+		if (blame_copy_score < index->best[c] + 1)
+			touched[bl->cand_nr++] = c;
+	}
+	qsort(touched, bl->cand_nr, sizeof(int), int_cmp);
+	bl->cand = touched;
+}
+
 /*
  * Count the number of entries the target is suspected for,
  * and prepare a list of entry and the best split.
@@ -1076,7 +1629,8 @@ static int find_copy_in_parent(struct scoreboard *sb,
 	int i, j;
 	int retval;
 	struct blame_list *blame_list;
-	int num_ents;
+	int num_ents, stamp = 0;
+	struct copy_index index;
 
 	blame_list = setup_blame_list(sb, target, &num_ents);
 	if (!blame_list)
@@ -1113,33 +1667,46 @@ static int find_copy_in_parent(struct scoreboard *sb,
 	if (!DIFF_OPT_TST(&diff_opts, FIND_COPIES_HARDER))
 		diffcore_std(&diff_opts);
 
+	memset(&index, 0, sizeof(index));
+	for (i = 0; i < diff_queued_diff.nr; i++) {
+		struct diff_filepair *p = diff_queued_diff.queue[i];
+
+		if (!DIFF_FILE_VALID(p->one))
+			continue; /* does not exist in parent */
+		if (porigin && !strcmp(p->one->path, porigin->path))
+			/* find_move already dealt with this path */
+			continue;
+		add_copy_candidate(&index, i, p->one->sha1);
+	}
+	finish_copy_index(&index, diff_queued_diff.nr);
+
 	retval = 0;
 	while (1) {
 		int made_progress = 0;
 
+		for (j = 0; j < num_ents; j++)
+			find_copy_candidates(sb, &index, &blame_list[j], ++stamp);
+
 		for (i = 0; i < diff_queued_diff.nr; i++) {
 			struct diff_filepair *p = diff_queued_diff.queue[i];
-			struct origin *norigin;
+			struct origin *norigin = NULL;
 			mmfile_t file_p;
 			struct blame_entry this[3];
 
-			if (!DIFF_FILE_VALID(p->one))
-				continue; /* does not exist in parent */
-			if (porigin && !strcmp(p->one->path, porigin->path))
-				/* find_move already dealt with this path */
-				continue;
-
-			norigin = get_origin(sb, parent, p->one->path);
-			hashcpy(norigin->blob_sha1, p->one->sha1);
-			fill_origin_blob(norigin, &file_p);
-			if (!file_p.ptr)
-				continue;
-
 			for (j = 0; j < num_ents; j++) {
-				find_copy_in_blob(sb, blame_list[j].ent,
-						  norigin, this, &file_p);
-				copy_split_if_better(sb, blame_list[j].split,
-						     this);
+				struct blame_list *bl = &blame_list[j];
+
+				if (bl->cand_pos == bl->cand_nr ||
+				    bl->cand[bl->cand_pos] != i)
+					continue;
+				bl->cand_pos++;
+				if (!norigin) {
+					norigin = get_origin(sb, parent, p->one->path);
+					hashcpy(norigin->blob_sha1, p->one->sha1);
+					fill_origin_blob(norigin, &file_p);
+				}
+				find_copy_in_blob(sb, bl->ent, norigin, this, &file_p);
+				copy_split_if_better(sb, bl->split, this);
 				decref_split(this);
 			}
 			origin_decref(norigin);
@@ -1154,7 +1721,7 @@ static int find_copy_in_parent(struct scoreboard *sb,
 			}
 			decref_split(split);
 		}
-		free(blame_list);
+		free_blame_list(blame_list, num_ents);
 
 		if (!made_progress)
 			break;
@@ -1164,6 +1731,7 @@ static int find_copy_in_parent(struct scoreboard *sb,
 			break;
 		}
 	}
+	free_copy_index(&index);
 	diff_flush(&diff_opts);
 	diff_tree_release_paths(&diff_opts);
 	return retval;
@@ -1446,6 +2014,100 @@ static void write_filename_info(const char *path)
 	write_name_quoted(path, stdout, '\n');
 }
 
+/*
+ * With --stream, each record is a type byte and the length of the
+ * payload (4 bytes, network order) followed by the payload, so that
+ * readers can skip the types they do not know:
+ *
+ *	'c' <sha1> <author-time> <committer-time> <flags> <strings>
+ *	    The first time a commit shows up: its 20-byte object name,
+ *	    3 numbers, and the author, author-mail, author-tz, committer,
+ *	    committer-mail, committer-tz and summary, each terminated by
+ *	    a NUL.  Bit 0 of the flags is set for a boundary commit.
+ *	'p' <id> <path>
+ *	    The first time a path shows up: a number to refer to it by,
+ *	    and the path itself (the rest of the payload).
+ *	'l' <sha1> <id> <sourceline> <resultline> <num_lines>
+ *	    A blame entry, like the first line of --incremental output,
+ *	    with the path given by its id.
+ *
+ * All numbers are 4 bytes in network order.  The records are kept in
+ * a buffer and written out after each suspect we are done with.
+ */
+static struct strbuf stream_buf = STRBUF_INIT;
+static struct path_list stream_paths = { NULL, 0, 0, 1 };
+
+static void stream_add_u32(struct strbuf *sb, uint32_t v)
+{
+	v = htonl(v);
+	strbuf_add(sb, &v, 4);
+}
+
+static void stream_add_str(struct strbuf *sb, const char *str)
+{
+	strbuf_add(sb, str, strlen(str) + 1);
+}
+
+static void stream_add_record(int type, struct strbuf *payload)
+{
+	strbuf_addch(&stream_buf, type);
+	stream_add_u32(&stream_buf, payload->len);
+	strbuf_addbuf(&stream_buf, payload);
+	strbuf_reset(payload);
+}
+
+static void flush_stream(void)
+{
+	if (!stream_buf.len)
+		return;
+	write_or_die(1, stream_buf.buf, stream_buf.len);
+	strbuf_reset(&stream_buf);
+}
+
+static void write_stream_entry(struct blame_entry *ent)
+{
+	struct origin *suspect = ent->suspect;
+	struct commit *commit = suspect->commit;
+	struct path_list_item *item;
+	struct strbuf rec;
+
+	strbuf_init(&rec, 0);
+	if (!(commit->object.flags & METAINFO_SHOWN)) {
+		struct commit_info ci;
+		commit->object.flags |= METAINFO_SHOWN;
+		get_commit_info(commit, &ci, 1);
+		strbuf_add(&rec, commit->object.sha1, 20);
+		stream_add_u32(&rec, ci.author_time);
+		stream_add_u32(&rec, ci.committer_time);
+		stream_add_u32(&rec, !!(commit->object.flags & UNINTERESTING));
+		stream_add_str(&rec, ci.author);
+		stream_add_str(&rec, ci.author_mail);
+		stream_add_str(&rec, ci.author_tz);
+		stream_add_str(&rec, ci.committer);
+		stream_add_str(&rec, ci.committer_mail);
+		stream_add_str(&rec, ci.committer_tz);
+		stream_add_str(&rec, ci.summary);
+		stream_add_record('c', &rec);
+	}
+
+	item = path_list_lookup(suspect->path, &stream_paths);
+	if (!item) {
+		item = path_list_insert(suspect->path, &stream_paths);
+		item->util = (void *)(intptr_t)(stream_paths.nr - 1);
+		stream_add_u32(&rec, stream_paths.nr - 1);
+		strbuf_addstr(&rec, suspect->path);
+		stream_add_record('p', &rec);
+	}
+
+	strbuf_add(&rec, commit->object.sha1, 20);
+	stream_add_u32(&rec, (intptr_t)item->util);
+	stream_add_u32(&rec, ent->s_lno + 1);
+	stream_add_u32(&rec, ent->lno + 1);
+	stream_add_u32(&rec, ent->num_lines);
+	stream_add_record('l', &rec);
+	strbuf_release(&rec);
+}
+
 /*
  * The blame_entry is found to be guilty for the range.  Mark it
  * as such, and show it in incremental output.
@@ -1455,7 +2117,9 @@ static void found_guilty_entry(struct blame_entry *ent)
 	if (ent->guilty)
 		return;
 	ent->guilty = 1;
-	if (incremental) {
+	if (stream_output)
+		write_stream_entry(ent);
+	else if (incremental) {
 		struct origin *suspect = ent->suspect;
 
 		printf("%s %d %d %d\n",
@@ -1482,6 +2146,230 @@ static void found_guilty_entry(struct blame_entry *ent)
 	}
 }
 
+/*
+ * The blame cache remembers, for a <commit, path> pair that was blamed
+ * in full, which <commit, path> and line every range of its lines
+ * came from.  When digging from a descendant reaches such a pair, the
+ * lines can be assigned from the cache instead of walking further.
+ *
+ * Each $GIT_DIR/blame-cache/<hash> file has one line per range:
+ *
+ *	<lno> <num_lines> <commit> <s_lno> <path>
+ *
+ * with the ranges in order, covering the whole blob.  Without -M and
+ * -C the result for a line only depends on the diffs between the blob
+ * and its parents, so it is the same whichever descendant we started
+ * from; we do not use the cache for blames that are cut short by
+ * revision ranges, age limits or -S.  Nor do we when there are grafts
+ * or a shallow boundary, as the cache does not say through which ones
+ * it saw the history.
+ */
+struct cached_blame {
+	int lno;
+	int num_lines;
+	int s_lno;
+	struct commit *commit;
+	char *path;
+};
+
+static const char *blame_cache_path(struct commit *commit, const char *path)
+{
+	SHA_CTX ctx;
+	unsigned char sha1[20];
+
+	SHA1_Init(&ctx);
+	SHA1_Update(&ctx, commit->object.sha1, 20);
+	SHA1_Update(&ctx, path, strlen(path) + 1);
+	SHA1_Update(&ctx, &xdl_opts, sizeof(xdl_opts));
+	SHA1_Final(sha1, &ctx);
+	return git_path("blame-cache/%s", sha1_to_hex(sha1));
+}
+
+static void free_cached_blame(struct cached_blame *c, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++)
+		free(c[i].path);
+	free(c);
+}
+
+/*
+ * Read the cached blame of the origin; returns the number of ranges,
+ * or 0 if there is no (usable) cache entry.
+ */
+static int read_cached_blame(struct origin *o, struct cached_blame **cp)
+{
+	struct cached_blame *c = NULL;
+	int nr = 0, alloc = 0, next_lno = 0;
+	char line[PATH_MAX + 100];
+	char *path = xstrdup(blame_cache_path(o->commit, o->path));
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		free(path);
+		return 0;
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		unsigned char sha1[20];
+		struct cached_blame *e;
+		char *sp, *end;
+		int len = strlen(line);
+
+		if (!len || line[len - 1] != '\n')
+			goto bad;
+		line[len - 1] = '\0';
+		ALLOC_GROW(c, nr + 1, alloc);
+		e = &c[nr];
+		e->lno = strtol(line, &sp, 10);
+		if (*sp != ' ' || e->lno != next_lno)
+			goto bad;
+		e->num_lines = strtol(sp + 1, &sp, 10);
+		if (*sp != ' ' || e->num_lines < 1 ||
+		    get_sha1_hex(sp + 1, sha1) || sp[41] != ' ')
+			goto bad;
+		e->s_lno = strtol(sp + 42, &end, 10);
+		if (*end != ' ' || !end[1] || e->s_lno < 0)
+			goto bad;
+		e->commit = lookup_commit(sha1);
+		if (!e->commit || parse_commit(e->commit))
+			goto bad;
+		e->path = xstrdup(end + 1);
+		nr++;
+		next_lno = e->lno + e->num_lines;
+	}
+	fclose(fp);
+	/* "git gc" expires the entries that are not used */
+	utime(path, NULL);
+	free(path);
+	*cp = c;
+	return nr;
+
+ bad:
+	fclose(fp);
+	free(path);
+	free_cached_blame(c, nr);
+	return 0;
+}
+
+static void write_cached_blame(struct scoreboard *sb)
+{
+	static struct lock_file lock;
+	struct blame_entry *ent, *next;
+	struct strbuf buf;
+	char *path = xstrdup(blame_cache_path(sb->final, sb->path));
+	int fd;
+
+	strbuf_init(&buf, 0);
+	for (ent = sb->ent; ent; ent = next) {
+		struct origin *suspect = ent->suspect;
+		int num_lines = ent->num_lines;
+
+		if (strchr(suspect->path, '\n'))
+			goto out;
+		for (next = ent->next;
+		     next && same_suspect(next->suspect, suspect) &&
+		     ent->s_lno + num_lines == next->s_lno;
+		     next = next->next)
+			num_lines += next->num_lines;
+		strbuf_addf(&buf, "%d %d %s %d %s\n",
+			    ent->lno, num_lines,
+			    sha1_to_hex(suspect->commit->object.sha1),
+			    ent->s_lno, suspect->path);
+	}
+
+	/* the cache is only an optimization; do not complain */
+	if (safe_create_leading_directories(path))
+		goto out;
+	fd = hold_lock_file_for_update(&lock, path, 0);
+	if (fd < 0)
+		goto out;
+	if (write_in_full(fd, buf.buf, buf.len) != buf.len)
+		rollback_lock_file(&lock);
+	else
+		commit_lock_file(&lock);
+ out:
+	strbuf_release(&buf);
+	free(path);
+}
+
+static int find_cached_range(struct cached_blame *c, int nr, int lno)
+{
+	int lo = 0, hi = nr;
+
+	while (lo < hi) {
+		int mi = lo + (hi - lo) / 2;
+		if (lno < c[mi].lno)
+			hi = mi;
+		else if (c[mi].lno + c[mi].num_lines <= lno)
+			lo = mi + 1;
+		else
+			return mi;
+	}
+	return -1;
+}
+
+/*
+ * If the blame of the origin is in the cache, split the entries it is
+ * suspected for along the cached ranges and assign them to the cached
+ * origins.  Returns 1 if it did.
+ */
+static int reuse_cached_blame(struct scoreboard *sb, struct origin *origin)
+{
+	struct cached_blame *c;
+	struct blame_entry *e;
+	int nr, end;
+
+	nr = read_cached_blame(origin, &c);
+	if (!nr)
+		return 0;
+	end = c[nr - 1].lno + c[nr - 1].num_lines;
+	for (e = sb->ent; e; e = e->next)
+		if (!e->guilty && same_suspect(e->suspect, origin) &&
+		    end < e->s_lno + e->num_lines) {
+			free_cached_blame(c, nr);
+			return 0;
+		}
+
+	for (e = sb->ent; e; e = e->next) {
+		struct cached_blame *r;
+		struct origin *porigin;
+		int len;
+
+		if (e->guilty || !same_suspect(e->suspect, origin))
+			continue;
+		r = &c[find_cached_range(c, nr, e->s_lno)];
+		len = r->lno + r->num_lines - e->s_lno;
+		if (len < e->num_lines) {
+			/* the rest is taken care of in the next iteration */
+			struct blame_entry *rest = xcalloc(1, sizeof(*rest));
+			rest->lno = e->lno + len;
+			rest->num_lines = e->num_lines - len;
+			rest->s_lno = e->s_lno + len;
+			rest->suspect = origin_incref(e->suspect);
+			rest->prev = e;
+			rest->next = e->next;
+			if (rest->next)
+				rest->next->prev = rest;
+			e->next = rest;
+			e->num_lines = len;
+		}
+		porigin = get_origin(sb, r->commit, r->path);
+		origin_decref(e->suspect);
+		e->suspect = porigin;
+		e->s_lno = r->s_lno + (e->s_lno - r->lno);
+		e->score = 0;
+
+		/* treat root commit as boundary, as assign_blame() would */
+		if (!r->commit->parents && !show_root)
+			r->commit->object.flags |= UNINTERESTING;
+		found_guilty_entry(e);
+	}
+	free_cached_blame(c, nr);
+	return 1;
+}
+
 /*
  * The main loop -- while the scoreboard has lines whose true origin
  * is still unknown, pick one blame_entry, and allow its current
@@ -1489,6 +2377,7 @@ static void found_guilty_entry(struct blame_entry *ent)
  */
 static void assign_blame(struct scoreboard *sb, struct rev_info *revs, int opt)
 {
+	start_prefetch(sb);
 	while (1) {
 		struct blame_entry *ent;
 		struct commit *commit;
@@ -1499,7 +2388,7 @@ static void assign_blame(struct scoreboard *sb, struct rev_info *revs, int opt)
 			if (!ent->guilty)
 				suspect = ent->suspect;
 		if (!suspect)
-			return; /* all done */
+			break; /* all done */
 
 		/*
 		 * We will use this suspect later in the loop,
@@ -1510,8 +2399,10 @@ static void assign_blame(struct scoreboard *sb, struct rev_info *revs, int opt)
 		if (!commit->object.parsed)
 			parse_commit(commit);
 		if (!(commit->object.flags & UNINTERESTING) &&
-		    !(revs->max_age != -1 && commit->date < revs->max_age))
-			pass_blame(sb, suspect, opt);
+		    !(revs->max_age != -1 && commit->date < revs->max_age)) {
+			if (!use_blame_cache || !reuse_cached_blame(sb, suspect))
+				pass_blame(sb, suspect, opt);
+		}
 		else {
 			commit->object.flags |= UNINTERESTING;
 			if (commit->object.parsed)
@@ -1526,10 +2417,13 @@ static void assign_blame(struct scoreboard *sb, struct rev_info *revs, int opt)
 			if (same_suspect(ent->suspect, suspect))
 				found_guilty_entry(ent);
 		origin_decref(suspect);
+		if (stream_output)
+			flush_stream();
 
 		if (DEBUG) /* sanity */
 			sanity_check_refcnt(sb);
 	}
+	stop_prefetch();
 }
 
 static const char *format_time(unsigned long time, const char *tz_str,
@@ -2003,6 +2897,10 @@ static int git_blame_config(const char *var, const char *value)
 		blank_boundary = git_config_bool(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "blame.cache")) {
+		use_blame_cache = git_config_bool(var, value);
+		return 0;
+	}
 	return git_default_config(var, value);
 }
 
@@ -2206,6 +3104,8 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 		}
 		else if (!strcmp("--incremental", arg))
 			incremental = 1;
+		else if (!strcmp("--stream", arg))
+			incremental = stream_output = 1;
 		else if (!strcmp("--score-debug", arg))
 			output_option |= OUTPUT_SHOW_SCORE;
 		else if (!strcmp("-f", arg) ||
@@ -2333,8 +3233,10 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 	 */
 	for (i = 0; i < revs.pending.nr; i++) {
 		struct object *obj = revs.pending.objects[i].item;
-		if (obj->flags & UNINTERESTING)
+		if (obj->flags & UNINTERESTING) {
+			use_blame_cache = 0;
 			continue;
+		}
 		while (obj->type == OBJ_TAG)
 			obj = deref_tag(obj, NULL, 0);
 		if (obj->type != OBJ_COMMIT)
@@ -2419,6 +3321,8 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 	if (revs_file && read_ancestry(revs_file))
 		die("reading graft file %s failed: %s",
 		    revs_file, strerror(errno));
+	if (opt || revs_file || revs.max_age != -1 || has_commit_grafts())
+		use_blame_cache = 0;
 
 	read_mailmap(&mailmap, ".mailmap", NULL);
 
@@ -2427,6 +3331,10 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 
 	assign_blame(&sb, &revs, opt);
 
+	if (use_blame_cache && !bottom && top == lno &&
+	    !is_null_sha1(sb.final->object.sha1))
+		write_cached_blame(&sb);
+
 	if (incremental)
 		return 0;
 
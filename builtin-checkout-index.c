@@ -252,6 +252,8 @@ int cmd_checkout_index(int argc, const char **argv, const char *prefix)
 		state.refresh_cache = 0;
 	}
 
+	dir_cache_begin();
+
 	/* Check out named files first */
 	for ( ; i < argc; i++) {
 		const char *arg = argv[i];
@@ -294,6 +296,7 @@ int cmd_checkout_index(int argc, const char **argv, const char *prefix)
 
 	if (all)
 		checkout_all(prefix, prefix_length);
+	dir_cache_end();
 
 	if (0 <= newfd &&
 	    (write_cache(newfd, active_cache, active_nr) ||
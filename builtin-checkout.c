@@ -109,12 +109,14 @@ static int checkout_paths(struct tree *source_tree, const char **pathspec)
 	memset(&state, 0, sizeof(state));
 	state.force = 1;
 	state.refresh_cache = 1;
+	dir_cache_begin();
 	for (pos = 0; pos < active_nr; pos++) {
 		struct cache_entry *ce = active_cache[pos];
 		if (pathspec_match(pathspec, NULL, ce->name, 0)) {
 			checkout_entry(ce, &state, NULL);
 		}
 	}
+	dir_cache_end();
 
 	if (write_cache(newfd, active_cache, active_nr) ||
 	    commit_locked_index(lock_file))
@@ -214,6 +214,20 @@ static void create_base_index(void)
 		exit(128); /* We've already reported the error, finish dying */
 }
 
+/*
+ * Bring the cache tree up to date before writing out the real index,
+ * so that the trees written for this commit are remembered there and
+ * the next command does not have to recompute them.
+ */
+static void update_main_cache_tree(void)
+{
+	if (unmerged_cache())
+		return;
+	if (!active_cache_tree)
+		active_cache_tree = cache_tree();
+	cache_tree_update(active_cache_tree, active_cache, active_nr, 0, 0);
+}
+
 static char *prepare_index(int argc, const char **argv, const char *prefix)
 {
 	int fd;
@@ -248,6 +262,7 @@ static char *prepare_index(int argc, const char **argv, const char *prefix)
 		int fd = hold_locked_index(&index_lock, 1);
 		add_files_to_cache(0, also ? prefix : NULL, pathspec);
 		refresh_cache(REFRESH_QUIET);
+		update_main_cache_tree();
 		if (write_cache(fd, active_cache, active_nr) ||
 		    close_lock_file(&index_lock))
 			die("unable to write new_index file");
@@ -267,6 +282,7 @@ static char *prepare_index(int argc, const char **argv, const char *prefix)
 	if (!pathspec || !*pathspec) {
 		fd = hold_locked_index(&index_lock, 1);
 		refresh_cache(REFRESH_QUIET);
+		update_main_cache_tree();
 		if (write_cache(fd, active_cache, active_nr) ||
 		    commit_locked_index(&index_lock))
 			die("unable to write new_index file");
@@ -310,6 +326,7 @@ static char *prepare_index(int argc, const char **argv, const char *prefix)
 	fd = hold_locked_index(&index_lock, 1);
 	add_remove_files(&partial);
 	refresh_cache(REFRESH_QUIET);
+	update_main_cache_tree();
 	if (write_cache(fd, active_cache, active_nr) ||
 	    close_lock_file(&index_lock))
 		die("unable to write new_index file");
@@ -27,6 +27,7 @@ static int aggressive_window = -1;
 static int gc_auto_threshold = 6700;
 static int gc_auto_pack_limit = 50;
 static char *prune_expire = "2.weeks.ago";
+static char *blame_cache_expire = "30.days.ago";
 
 #define MAX_ADD 10
 static const char *argv_pack_refs[] = {"pack-refs", "--all", "--prune", NULL};
@@ -34,6 +35,8 @@ static const char *argv_reflog[] = {"reflog", "expire", "--all", NULL};
 static const char *argv_repack[MAX_ADD] = {"repack", "-d", "-l", NULL};
 static const char *argv_prune[] = {"prune", "--expire", NULL, NULL};
 static const char *argv_rerere[] = {"rerere", "gc", NULL};
+static const char *argv_bloom[] = {"update-bloom-filters", NULL};
+static const char *argv_trigram[] = {"update-trigram-index", NULL};
 
 static int gc_config(const char *var, const char *value)
 {
@@ -67,6 +70,12 @@ static int gc_config(const char *var, const char *value)
 		prune_expire = xstrdup(value);
 		return 0;
 	}
+	if (!strcmp(var, "gc.blamecacheexpire")) {
+		if (!value)
+			return config_error_nonbool(var);
+		blame_cache_expire = xstrdup(value);
+		return 0;
+	}
 	return git_default_config(var, value);
 }
 
@@ -145,7 +154,7 @@ static int too_many_packs(void)
 			continue; /* oops, give up */
 		memcpy(path, p->pack_name, len-5);
 		memcpy(path + len - 5, ".keep", 6);
-		keep = access(p->pack_name, F_OK) && (errno == ENOENT);
+		keep = !access(path, F_OK);
 		if (keep)
 			continue;
 		/*
@@ -157,6 +166,35 @@ static int too_many_packs(void)
 	return gc_auto_pack_limit <= cnt;
 }
 
+/*
+ * Remove the blame cache entries that have not been used since
+ * gc.blameCacheExpire.  git-blame touches the entries it reuses, and
+ * an entry whose commits are gone is never used again, so this also
+ * gets rid of the entries for history that was pruned.
+ */
+static void prune_blame_cache(void)
+{
+	unsigned long expire = approxidate(blame_cache_expire);
+	DIR *dir;
+	struct dirent *ent;
+
+	dir = opendir(git_path("blame-cache"));
+	if (!dir)
+		return;
+	while ((ent = readdir(dir)) != NULL) {
+		const char *path;
+		struct stat st;
+
+		if (strspn(ent->d_name, "0123456789abcdef") != 40 ||
+		    ent->d_name[40] != '\0')
+			continue;
+		path = git_path("blame-cache/%s", ent->d_name);
+		if (!stat(path, &st) && st.st_mtime < expire)
+			unlink(path);
+	}
+	closedir(dir);
+}
+
 static int run_hook(void)
 {
 	const char *argv[2];
@@ -197,12 +235,14 @@ static int need_to_gc(void)
 	/*
 	 * If there are too many loose objects, but not too many
 	 * packs, we run "repack -d -l".  If there are too many packs,
-	 * we run "repack -A -d -l".  Otherwise we tell the caller
-	 * there is no need.
+	 * we run "repack -A -d -l --geometric=2", which only rolls up
+	 * the smaller packs.  Otherwise we tell the caller there is no
+	 * need.
 	 */
-	if (too_many_packs())
+	if (too_many_packs()) {
 		append_option(argv_repack, "-A", MAX_ADD);
-	else if (!too_many_loose_objects())
+		append_option(argv_repack, "--geometric=2", MAX_ADD);
+	} else if (!too_many_loose_objects())
 		return 0;
 
 	if (run_hook())
@@ -284,6 +324,18 @@ int cmd_gc(int argc, const char **argv, const char *prefix)
 	if (run_command_v_opt(argv_rerere, RUN_GIT_CMD))
 		return error(FAILED_RUN, argv_rerere[0]);
 
+	prune_blame_cache();
+
+	/* Keep the changed-path filters up to date, if there are any */
+	if (!access(mkpath("%s/info/bloom-filters", get_object_directory()), F_OK) &&
+	    run_command_v_opt(argv_bloom, RUN_GIT_CMD))
+		return error(FAILED_RUN, argv_bloom[0]);
+
+	/* Likewise the trigram index */
+	if (!access(mkpath("%s/info/trigram-index", get_object_directory()), F_OK) &&
+	    run_command_v_opt(argv_trigram, RUN_GIT_CMD))
+		return error(FAILED_RUN, argv_trigram[0]);
+
 	if (auto_gc && too_many_loose_objects())
 		warning("There are too many unreachable loose objects; "
 			"run 'git prune' to remove them.");
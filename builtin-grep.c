@@ -11,6 +11,10 @@
 #include "tree-walk.h"
 #include "builtin.h"
 #include "grep.h"
+#ifdef USE_PTHREADS
+#include "thread-utils.h"
+#include <pthread.h>
+#endif
 
 #ifndef NO_EXTERNAL_GREP
 #ifdef __unix__
@@ -88,19 +92,337 @@ static int pathspec_matches(const char **paths, const char *name)
 	return 0;
 }
 
-static int grep_sha1(struct grep_opt *opt, const unsigned char *sha1, const char *name, int tree_name_len)
+/*
+ * The blobs of the trees we grep are not read as we come across them,
+ * but in batches sorted by where they are in the packs, so that the
+ * pack is read front to back and a delta base we have just used is
+ * still in the delta base cache for the next blob of its chain.  The
+ * output of each blob is kept until the whole batch is done and then
+ * written out in path order.
+ */
+#define GREP_BLOB_BATCH 4096
+
+struct grep_blob {
+	char *name;
+	unsigned char sha1[20];
+	int pack_nr;		/* in the packed_git list, or INT_MAX if loose */
+	off_t offset;
+	struct strbuf out;
+};
+
+static struct grep_blob grep_blobs[GREP_BLOB_BATCH];
+static int nr_grep_blobs;
+static int collect_blobs;
+
+/* --threads=<n>; 0 means one per CPU */
+static int grep_threads;
+
+static void strbuf_output(struct grep_opt *opt, const void *data, size_t size)
+{
+	strbuf_add(opt->output_priv, data, size);
+}
+
+#ifdef USE_PTHREADS
+/*
+ * With threads, the main thread only walks the index or the trees and
+ * queues the files and blobs to look at; the workers read and grep
+ * them, each into the output buffer of its item.  Whoever finishes the
+ * oldest item writes out the run of items that are done from there, so
+ * the output comes out in the same order as without threads.
+ */
+#define GREP_MAX_THREADS 8
+#define GREP_TODO_SIZE 128
+
+struct work_item {
+	char *name;		/* as shown */
+	char *filename;		/* in the work tree, or NULL for a blob */
+	unsigned char sha1[20];
+	struct grep_blob *blob;	/* whose output this is, if any */
+	int done;
+	struct strbuf out;
+};
+
+static struct work_item todo[GREP_TODO_SIZE];
+static int todo_start, todo_end, todo_done;
+static int all_work_added;
+
+static int nr_threads;
+static pthread_t threads[GREP_MAX_THREADS];
+static struct grep_opt thread_opt[GREP_MAX_THREADS];
+static int thread_hit[GREP_MAX_THREADS];
+
+/* protects the todo ring and the output */
+static pthread_mutex_t grep_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* an item was added, or there will be no more */
+static pthread_cond_t cond_add = PTHREAD_COND_INITIALIZER;
+/* an item was written out and its slot is free */
+static pthread_cond_t cond_write = PTHREAD_COND_INITIALIZER;
+
+static pthread_mutex_t read_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define read_lock()		pthread_mutex_lock(&read_mutex)
+#define read_unlock()		pthread_mutex_unlock(&read_mutex)
+#else
+#define read_lock()		(void)0
+#define read_unlock()		(void)0
+#endif
+
+static int grep_file_buffer(struct grep_opt *opt, const char *filename,
+			    const char *name);
+
+static int grep_blob_buffer(struct grep_opt *opt, const unsigned char *sha1,
+			    const char *name)
 {
 	unsigned long size;
 	char *data;
 	enum object_type type;
-	char *to_free = NULL;
 	int hit;
 
+	read_lock();
 	data = read_sha1_file(sha1, &type, &size);
+	read_unlock();
 	if (!data) {
 		error("'%s': unable to read %s", name, sha1_to_hex(sha1));
 		return 0;
 	}
+	hit = grep_buffer(opt, name, data, size);
+	free(data);
+	return hit;
+}
+
+#ifdef USE_PTHREADS
+static void add_work(const char *name, const char *filename,
+		     const unsigned char *sha1, struct grep_blob *blob)
+{
+	struct work_item *w;
+
+	pthread_mutex_lock(&grep_mutex);
+	while ((todo_end + 1) % GREP_TODO_SIZE == todo_done)
+		pthread_cond_wait(&cond_write, &grep_mutex);
+	w = &todo[todo_end];
+	w->name = xstrdup(name);
+	w->filename = filename ? xstrdup(filename) : NULL;
+	if (sha1)
+		hashcpy(w->sha1, sha1);
+	w->blob = blob;
+	w->done = 0;
+	strbuf_reset(&w->out);
+	todo_end = (todo_end + 1) % GREP_TODO_SIZE;
+	pthread_cond_signal(&cond_add);
+	pthread_mutex_unlock(&grep_mutex);
+}
+
+static struct work_item *get_work(void)
+{
+	struct work_item *w = NULL;
+
+	pthread_mutex_lock(&grep_mutex);
+	while (todo_start == todo_end && !all_work_added)
+		pthread_cond_wait(&cond_add, &grep_mutex);
+	if (todo_start != todo_end) {
+		w = &todo[todo_start];
+		todo_start = (todo_start + 1) % GREP_TODO_SIZE;
+	}
+	pthread_mutex_unlock(&grep_mutex);
+	return w;
+}
+
+static void work_done(struct work_item *w)
+{
+	pthread_mutex_lock(&grep_mutex);
+	w->done = 1;
+	while (todo_done != todo_start && todo[todo_done].done) {
+		w = &todo[todo_done];
+		fwrite(w->out.buf, w->out.len, 1, stdout);
+		free(w->name);
+		free(w->filename);
+		todo_done = (todo_done + 1) % GREP_TODO_SIZE;
+	}
+	pthread_cond_broadcast(&cond_write);
+	pthread_mutex_unlock(&grep_mutex);
+}
+
+/* Wait until every item added so far has been written out. */
+static void wait_for_work(void)
+{
+	pthread_mutex_lock(&grep_mutex);
+	while (todo_done != todo_end)
+		pthread_cond_wait(&cond_write, &grep_mutex);
+	pthread_mutex_unlock(&grep_mutex);
+}
+
+static void *run(void *arg)
+{
+	struct grep_opt *opt = arg;
+	int *hit = &thread_hit[opt - thread_opt];
+	struct work_item *w;
+
+	while ((w = get_work()) != NULL) {
+		opt->output_priv = w->blob ? &w->blob->out : &w->out;
+		if (w->filename)
+			*hit |= grep_file_buffer(opt, w->filename, w->name);
+		else
+			*hit |= grep_blob_buffer(opt, w->sha1, w->name);
+		work_done(w);
+	}
+	return NULL;
+}
+
+/*
+ * Each thread gets its own copy of the patterns, as matching with
+ * --all-match marks the expression as it goes.
+ */
+static void start_threads(struct grep_opt *opt)
+{
+	int i;
+
+	nr_threads = grep_threads ? grep_threads : online_cpus();
+	if (nr_threads > GREP_MAX_THREADS)
+		nr_threads = GREP_MAX_THREADS;
+	if (nr_threads < 2 || opt->status_only) {
+		nr_threads = 0;
+		return;
+	}
+
+	for (i = 0; i < GREP_TODO_SIZE; i++)
+		strbuf_init(&todo[i].out, 0);
+	for (i = 0; i < nr_threads; i++) {
+		struct grep_opt *o = &thread_opt[i];
+		struct grep_pat *p;
+
+		*o = *opt;
+		o->pattern_list = NULL;
+		o->pattern_tail = &o->pattern_list;
+		o->pattern_expression = NULL;
+		for (p = opt->pattern_list; p; p = p->next)
+			append_grep_pattern(o, p->pattern, p->origin, p->no,
+					    p->token);
+		compile_grep_patterns(o);
+		o->output = strbuf_output;
+		if (pthread_create(&threads[i], NULL, run, o))
+			die("grep: unable to create thread: %s",
+			    strerror(errno));
+	}
+}
+
+static int wait_all(void)
+{
+	int i, hit = 0;
+
+	if (!nr_threads)
+		return 0;
+	pthread_mutex_lock(&grep_mutex);
+	all_work_added = 1;
+	pthread_cond_broadcast(&cond_add);
+	pthread_mutex_unlock(&grep_mutex);
+
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(threads[i], NULL);
+		free_grep_patterns(&thread_opt[i]);
+		hit |= thread_hit[i];
+	}
+	for (i = 0; i < GREP_TODO_SIZE; i++)
+		strbuf_release(&todo[i].out);
+	nr_threads = 0;
+	return hit;
+}
+#else
+#define nr_threads 0
+#define start_threads(opt)	(void)0
+#define wait_for_work()		(void)0
+#define wait_all()		0
+#endif
+
+static int grep_blob_cmp(const void *a_, const void *b_)
+{
+	const struct grep_blob *a = *(const struct grep_blob **)a_;
+	const struct grep_blob *b = *(const struct grep_blob **)b_;
+
+	if (a->pack_nr != b->pack_nr)
+		return a->pack_nr < b->pack_nr ? -1 : 1;
+	if (a->offset != b->offset)
+		return a->offset < b->offset ? -1 : 1;
+	return a < b ? -1 : a > b;
+}
+
+static int flush_grep_blobs(struct grep_opt *opt)
+{
+	static struct grep_blob *sorted[GREP_BLOB_BATCH];
+	int i, hit = 0;
+
+	if (!nr_grep_blobs)
+		return 0;
+	/*
+	 * The threads may still be reading the blobs we were given
+	 * before, which can open pack indices or rescan the packs.
+	 */
+	read_lock();
+	prepare_packed_git();
+	for (i = 0; i < nr_grep_blobs; i++) {
+		struct grep_blob *b = &grep_blobs[i];
+		struct packed_git *p;
+		int pack_nr = 0;
+
+		b->pack_nr = INT_MAX;
+		b->offset = 0;
+		for (p = packed_git; p; p = p->next, pack_nr++) {
+			off_t offset = find_pack_entry_one(b->sha1, p);
+			if (offset) {
+				b->pack_nr = pack_nr;
+				b->offset = offset;
+				break;
+			}
+		}
+		sorted[i] = b;
+	}
+	read_unlock();
+	qsort(sorted, nr_grep_blobs, sizeof(*sorted), grep_blob_cmp);
+
+	for (i = 0; i < nr_grep_blobs; i++) {
+		struct grep_blob *b = sorted[i];
+#ifdef USE_PTHREADS
+		if (nr_threads) {
+			add_work(b->name, NULL, b->sha1, b);
+			continue;
+		}
+#endif
+		opt->output = strbuf_output;
+		opt->output_priv = &b->out;
+		hit |= grep_blob_buffer(opt, b->sha1, b->name);
+	}
+	opt->output = NULL;
+	opt->output_priv = NULL;
+	wait_for_work();
+
+	for (i = 0; i < nr_grep_blobs; i++) {
+		struct grep_blob *b = &grep_blobs[i];
+		fwrite(b->out.buf, b->out.len, 1, stdout);
+		strbuf_release(&b->out);
+		free(b->name);
+	}
+	nr_grep_blobs = 0;
+	return hit;
+}
+
+static int add_grep_blob(struct grep_opt *opt, const unsigned char *sha1,
+			 const char *name)
+{
+	struct grep_blob *b = &grep_blobs[nr_grep_blobs++];
+
+	b->name = xstrdup(name);
+	hashcpy(b->sha1, sha1);
+	strbuf_init(&b->out, 0);
+	if (nr_grep_blobs < GREP_BLOB_BATCH)
+		return 0;
+	return flush_grep_blobs(opt);
+}
+
+static int grep_sha1(struct grep_opt *opt, const unsigned char *sha1, const char *name, int tree_name_len)
+{
+	char *to_free = NULL;
+	int hit = 0;
+
+	if (!grep_blob_may_match(opt, sha1))
+		return 0;
 	if (opt->relative && opt->prefix_length) {
 		static char name_buf[PATH_MAX];
 		char *cp;
@@ -119,13 +441,20 @@ static int grep_sha1(struct grep_opt *opt, const unsigned char *sha1, const char
 			name = cp;
 		}
 	}
-	hit = grep_buffer(opt, name, data, size);
-	free(data);
+	if (collect_blobs)
+		hit = add_grep_blob(opt, sha1, name);
+#ifdef USE_PTHREADS
+	else if (nr_threads)
+		add_work(name, NULL, sha1, NULL);
+#endif
+	else
+		hit = grep_blob_buffer(opt, sha1, name);
 	free(to_free);
 	return hit;
 }
 
-static int grep_file(struct grep_opt *opt, const char *filename)
+static int grep_file_buffer(struct grep_opt *opt, const char *filename,
+			    const char *name)
 {
 	struct stat st;
 	int i;
@@ -138,8 +467,6 @@ static int grep_file(struct grep_opt *opt, const char *filename)
 			error("'%s': %s", filename, strerror(errno));
 		return 0;
 	}
-	if (!st.st_size)
-		return 0; /* empty file -- no grep hit */
 	if (!S_ISREG(st.st_mode))
 		return 0;
 	sz = xsize_t(st.st_size);
@@ -154,13 +481,26 @@ static int grep_file(struct grep_opt *opt, const char *filename)
 		return 0;
 	}
 	close(i);
-	if (opt->relative && opt->prefix_length)
-		filename += opt->prefix_length;
-	i = grep_buffer(opt, filename, data, sz);
+	i = grep_buffer(opt, name, data, sz);
 	free(data);
 	return i;
 }
 
+static int grep_file(struct grep_opt *opt, const char *filename)
+{
+	const char *name = filename;
+
+	if (opt->relative && opt->prefix_length)
+		name += opt->prefix_length;
+#ifdef USE_PTHREADS
+	if (nr_threads) {
+		add_work(name, filename, NULL, NULL);
+		return 0;
+	}
+#endif
+	return grep_file_buffer(opt, filename, name);
+}
+
 #if !NO_EXTERNAL_GREP
 static int exec_grep(int argc, const char **argv)
 {
@@ -380,13 +720,14 @@ static int grep_cache(struct grep_opt *opt, const char **paths, int cached)
 	int nr;
 	read_cache();
 
+	start_threads(opt);
 #if !NO_EXTERNAL_GREP
 	/*
 	 * Use the external "grep" command for the case where
 	 * we grep through the checked-out files. It tends to
-	 * be a lot more optimized
+	 * be a lot more optimized, unless we can use threads.
 	 */
-	if (!cached) {
+	if (!cached && !nr_threads) {
 		hit = external_grep(opt, paths, cached);
 		if (hit >= 0)
 			return hit;
@@ -414,6 +755,7 @@ static int grep_cache(struct grep_opt *opt, const char **paths, int cached)
 			nr--; /* compensate for loop control */
 		}
 	}
+	hit |= wait_all();
 	free_grep_patterns(opt);
 	return hit;
 }
@@ -460,7 +802,9 @@ static int grep_tree(struct grep_opt *opt, const char **paths,
 			void *data;
 			unsigned long size;
 
+			read_lock();
 			data = read_sha1_file(entry.sha1, &type, &size);
+			read_unlock();
 			if (!data)
 				die("unable to read tree (%s)",
 				    sha1_to_hex(entry.sha1));
@@ -482,12 +826,17 @@ static int grep_object(struct grep_opt *opt, const char **paths,
 		void *data;
 		unsigned long size;
 		int hit;
+		read_lock();
 		data = read_object_with_reference(obj->sha1, tree_type,
 						  &size, NULL);
+		read_unlock();
 		if (!data)
 			die("unable to read tree (%s)", sha1_to_hex(obj->sha1));
 		init_tree_desc(&tree, data, size);
+		collect_blobs = 1;
 		hit = grep_tree(opt, paths, &tree, name, "");
+		hit |= flush_grep_blobs(opt);
+		collect_blobs = 0;
 		free(data);
 		return hit;
 	}
@@ -704,6 +1053,17 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 			}
 			die(emsg_missing_argument, arg);
 		}
+		if (!prefixcmp(arg, "--threads=")) {
+			char *end;
+			grep_threads = strtoul(arg + 10, &end, 0);
+			if (!arg[10] || *end || grep_threads < 0)
+				usage(builtin_grep_usage);
+#ifndef USE_PTHREADS
+			if (grep_threads != 1)
+				warning("no threads support, ignoring %s", arg);
+#endif
+			continue;
+		}
 		if (!strcmp("--full-name", arg)) {
 			opt.relative = 0;
 			continue;
@@ -786,12 +1146,17 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 	if (cached)
 		die("both --cached and trees are given.");
 
+	start_threads(&opt);
 	for (i = 0; i < list.nr; i++) {
 		struct object *real_obj;
+		read_lock();
 		real_obj = deref_tag(list.objects[i].item, NULL, 0);
+		read_unlock();
 		if (grep_object(&opt, paths, real_obj, list.objects[i].name))
 			hit = 1;
 	}
+	if (wait_all())
+		hit = 1;
 	free_grep_patterns(&opt);
 	return !hit;
 }
@@ -94,6 +94,8 @@ static int call_depth = 0;
 static int verbosity = 2;
 static int diff_rename_limit = -1;
 static int merge_rename_limit = -1;
+static int rename_prefilter;
+static int rename_cache;
 static int buffer_output = 1;
 static struct strbuf obuf = STRBUF_INIT;
 
@@ -222,7 +224,6 @@ static int git_merge_trees(int index_only,
 	init_tree_desc_from_tree(t+2, merge);
 
 	rc = unpack_trees(3, t, &opts);
-	cache_tree_free(&active_cache_tree);
 	return rc;
 }
 
@@ -366,6 +367,10 @@ static struct path_list *get_renames(struct tree *tree,
 			    diff_rename_limit >= 0 ? diff_rename_limit :
 			    500;
 	opts.warn_on_too_large_rename = 1;
+	if (rename_prefilter)
+		DIFF_OPT_SET(&opts, RENAME_PREFILTER);
+	if (rename_cache)
+		DIFF_OPT_SET(&opts, RENAME_CACHE);
 	opts.output_format = DIFF_FORMAT_NO_OUTPUT;
 	if (diff_setup_done(&opts) < 0)
 		die("diff setup failed");
@@ -1354,6 +1359,14 @@ static int merge_config(const char *var, const char *value)
 		merge_rename_limit = git_config_int(var, value);
 		return 0;
 	}
+	if (!strcasecmp(var, "diff.renameprefilter")) {
+		rename_prefilter = git_config_bool(var, value);
+		return 0;
+	}
+	if (!strcasecmp(var, "diff.renamecache")) {
+		rename_cache = git_config_bool(var, value);
+		return 0;
+	}
 	return git_default_config(var, value);
 }
 
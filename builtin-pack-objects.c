@@ -27,6 +27,7 @@ git-pack-objects [{ -q | --progress | --all-progress }] \n\
 	[--max-pack-size=N] [--local] [--incremental] \n\
 	[--window=N] [--window-memory=N] [--depth=N] \n\
 	[--no-reuse-delta] [--no-reuse-object] [--delta-base-offset] \n\
+	[--[no-]delta-hints] \n\
 	[--threads=N] [--non-empty] [--revs [--unpacked | --all]*] [--reflog] \n\
 	[--stdout | base-name] [--include-tag] [--keep-unreachable] \n\
 	[<ref-list | <object-list]";
@@ -68,6 +69,8 @@ static int non_empty;
 static int no_reuse_delta, no_reuse_object, keep_unreachable, include_tag;
 static int local;
 static int incremental;
+static const char **rolled_packs;
+static int nr_rolled_packs, rolled_packs_alloc;
 static int allow_ofs_delta;
 static const char *base_name;
 static int progress = 1;
@@ -80,6 +83,7 @@ static int num_preferred_base;
 static struct progress *progress_state;
 static int pack_compression_level = Z_DEFAULT_COMPRESSION;
 static int pack_compression_seen;
+static int use_delta_hints;
 
 static unsigned long delta_cache_size = 0;
 static unsigned long max_delta_cache_size = 0;
@@ -101,14 +105,41 @@ static int object_ix_hashsz;
 static uint32_t written, written_delta;
 static uint32_t reused, reused_delta;
 
+#ifdef THREADED_DELTA_SEARCH
+
+static pthread_mutex_t read_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define read_lock()		pthread_mutex_lock(&read_mutex)
+#define read_unlock()		pthread_mutex_unlock(&read_mutex)
+
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define cache_lock()		pthread_mutex_lock(&cache_mutex)
+#define cache_unlock()		pthread_mutex_unlock(&cache_mutex)
+
+static pthread_mutex_t progress_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define progress_lock()		pthread_mutex_lock(&progress_mutex)
+#define progress_unlock()	pthread_mutex_unlock(&progress_mutex)
+
+#else
+
+#define read_lock()		(void)0
+#define read_unlock()		(void)0
+#define cache_lock()		(void)0
+#define cache_unlock()		(void)0
+#define progress_lock()		(void)0
+#define progress_unlock()	(void)0
+
+#endif
+
 
 static void *delta_against(void *buf, unsigned long size, struct object_entry *entry)
 {
 	unsigned long othersize, delta_size;
 	enum object_type type;
-	void *otherbuf = read_sha1_file(entry->delta->idx.sha1, &type, &othersize);
-	void *delta_buf;
+	void *otherbuf, *delta_buf;
 
+	read_lock();
+	otherbuf = read_sha1_file(entry->delta->idx.sha1, &type, &othersize);
+	read_unlock();
 	if (!otherbuf)
 		die("unable to read %s", sha1_to_hex(entry->delta->idx.sha1));
         delta_buf = diff_delta(otherbuf, othersize,
@@ -218,91 +249,278 @@ static void copy_pack_data(struct sha1file *f,
 	}
 }
 
+static int usable_delta(struct object_entry *entry)
+{
+	/* no if no delta */
+	if (!entry->delta)
+		return 0;
+	/* yes if unlimited packfile */
+	if (!pack_size_limit)
+		return 1;
+	/* no if base written to previous pack */
+	if (entry->delta->idx.offset == (off_t)-1)
+		return 0;
+	/* otherwise double-check written to this pack, like we do below */
+	return entry->delta->idx.offset ? 1 : 0;
+}
+
+static int reuse_object(struct object_entry *entry, int usable_delta)
+{
+	enum object_type obj_type = entry->type;
+
+	if (no_reuse_object)
+		return 0;	/* explicit */
+	if (!entry->in_pack)
+		return 0;	/* can't reuse what we don't have */
+	if (obj_type == OBJ_REF_DELTA || obj_type == OBJ_OFS_DELTA)
+				/* check_object() decided it for us ... */
+		return usable_delta;
+				/* ... but pack split may override that */
+	if (obj_type != entry->in_pack_type)
+		return 0;	/* pack has delta which is unusable */
+	if (entry->delta)
+		return 0;	/* we want to pack afresh */
+	return 1;		/* we have it in-pack undeltified,
+				 * and we do not need to deltify it.
+				 */
+}
+
+/*
+ * Read the object, or make its delta, and compress it.  Returns the
+ * compressed data; "type" is the type of the object when it is not
+ * written as a delta.
+ */
+static void *deflate_object(struct object_entry *entry, int usable_delta,
+			    enum object_type *type, unsigned long *size,
+			    unsigned long *datalen)
+{
+	z_stream stream;
+	unsigned long maxsize;
+	void *buf, *out;
+
+	if (!usable_delta) {
+		read_lock();
+		buf = read_sha1_file(entry->idx.sha1, type, size);
+		read_unlock();
+		if (!buf)
+			die("unable to read %s", sha1_to_hex(entry->idx.sha1));
+	} else if (entry->delta_data) {
+		*size = entry->delta_size;
+		buf = entry->delta_data;
+		entry->delta_data = NULL;
+	} else {
+		read_lock();
+		buf = read_sha1_file(entry->idx.sha1, type, size);
+		read_unlock();
+		if (!buf)
+			die("unable to read %s", sha1_to_hex(entry->idx.sha1));
+		buf = delta_against(buf, *size, entry);
+		*size = entry->delta_size;
+	}
+	/* compress the data to store and put compressed length in datalen */
+	memset(&stream, 0, sizeof(stream));
+	deflateInit(&stream, pack_compression_level);
+	maxsize = deflateBound(&stream, *size);
+	out = xmalloc(maxsize);
+	/* Compress it */
+	stream.next_in = buf;
+	stream.avail_in = *size;
+	stream.next_out = out;
+	stream.avail_out = maxsize;
+	while (deflate(&stream, Z_FINISH) == Z_OK)
+		/* nothing */;
+	deflateEnd(&stream);
+	*datalen = stream.total_out;
+	free(buf);
+	return out;
+}
+
+#ifdef THREADED_DELTA_SEARCH
+
+/*
+ * When the pack is not split, what we write for an object does not
+ * depend on where it ends up, except for its header.  So the threads
+ * compress the objects we cannot reuse ahead of the main thread, in
+ * the order write_one() will want them, and the main thread only
+ * writes them out.  At most DEFLATE_AHEAD objects, and not much more
+ * than DEFLATE_AHEAD_SIZE bytes of them, are in flight at a time.
+ */
+#define DEFLATE_AHEAD 64
+#define DEFLATE_AHEAD_SIZE (64 * 1024 * 1024)
+
+struct deflated {
+	void *out;
+	enum object_type type;
+	unsigned long size;
+	unsigned long datalen;
+	int done;
+};
+
+static struct object_entry **deflate_list;
+static struct deflated *deflated;
+static unsigned deflate_nr, deflate_next, deflate_used;
+static unsigned long deflate_ahead_size;
+static pthread_t *deflate_threads;
+static int nr_deflate_threads;
+
+static pthread_mutex_t deflate_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* an object was taken by the main thread */
+static pthread_cond_t deflate_taken = PTHREAD_COND_INITIALIZER;
+/* an object was compressed */
+static pthread_cond_t deflate_done = PTHREAD_COND_INITIALIZER;
+
+static void *threaded_deflate(void *arg)
+{
+	pthread_mutex_lock(&deflate_mutex);
+	for (;;) {
+		struct object_entry *entry;
+		struct deflated *d;
+		unsigned i;
+
+		while (deflate_next < deflate_nr &&
+		       deflate_next != deflate_used &&
+		       (deflate_next - deflate_used >= DEFLATE_AHEAD ||
+			deflate_ahead_size >= DEFLATE_AHEAD_SIZE))
+			pthread_cond_wait(&deflate_taken, &deflate_mutex);
+		if (deflate_next >= deflate_nr)
+			break;
+		i = deflate_next++;
+		entry = deflate_list[i];
+		d = &deflated[i];
+		deflate_ahead_size += entry->size;
+		pthread_mutex_unlock(&deflate_mutex);
+
+		d->type = entry->type;
+		d->out = deflate_object(entry, usable_delta(entry),
+					&d->type, &d->size, &d->datalen);
+
+		pthread_mutex_lock(&deflate_mutex);
+		d->done = 1;
+		pthread_cond_broadcast(&deflate_done);
+	}
+	pthread_mutex_unlock(&deflate_mutex);
+	return NULL;
+}
+
+static void *get_deflated(struct object_entry *entry, enum object_type *type,
+			  unsigned long *size, unsigned long *datalen)
+{
+	struct deflated *d;
+
+	if (deflate_used >= deflate_nr || deflate_list[deflate_used] != entry)
+		return NULL;
+	d = &deflated[deflate_used];
+	pthread_mutex_lock(&deflate_mutex);
+	while (!d->done)
+		pthread_cond_wait(&deflate_done, &deflate_mutex);
+	deflate_used++;
+	deflate_ahead_size -= entry->size;
+	pthread_cond_broadcast(&deflate_taken);
+	pthread_mutex_unlock(&deflate_mutex);
+
+	*type = d->type;
+	*size = d->size;
+	*datalen = d->datalen;
+	return d->out;
+}
+
+/* Queue the objects to compress in the order write_one() visits them. */
+static void queue_deflate(struct object_entry *e, unsigned char *seen)
+{
+	if (seen[e - objects] || e->preferred_base)
+		return;
+	seen[e - objects] = 1;
+	if (e->delta)
+		queue_deflate(e->delta, seen);
+	if (!reuse_object(e, usable_delta(e)))
+		deflate_list[deflate_nr++] = e;
+}
+
+static void start_deflate_threads(void)
+{
+	unsigned char *seen;
+	uint32_t i;
+	int t, ret;
+
+	if (delta_search_threads <= 1 || pack_size_limit)
+		return;
+	seen = xcalloc(nr_objects, 1);
+	deflate_list = xmalloc(nr_objects * sizeof(*deflate_list));
+	for (i = 0; i < nr_objects; i++)
+		queue_deflate(objects + i, seen);
+	free(seen);
+	if (deflate_nr < 2) {
+		free(deflate_list);
+		deflate_list = NULL;
+		deflate_nr = 0;
+		return;
+	}
+	deflated = xcalloc(deflate_nr, sizeof(*deflated));
+
+	nr_deflate_threads = delta_search_threads;
+	deflate_threads = xmalloc(nr_deflate_threads * sizeof(*deflate_threads));
+	for (t = 0; t < nr_deflate_threads; t++) {
+		ret = pthread_create(&deflate_threads[t], NULL,
+				     threaded_deflate, NULL);
+		if (ret)
+			die("unable to create thread: %s", strerror(ret));
+	}
+}
+
+static void stop_deflate_threads(void)
+{
+	int i;
+
+	for (i = 0; i < nr_deflate_threads; i++)
+		pthread_join(deflate_threads[i], NULL);
+	free(deflate_threads);
+	free(deflate_list);
+	free(deflated);
+	nr_deflate_threads = 0;
+}
+
+#else
+
+#define get_deflated(entry, type, size, datalen)	NULL
+#define start_deflate_threads()	(void)0
+#define stop_deflate_threads()	(void)0
+
+#endif
+
 static unsigned long write_object(struct sha1file *f,
 				  struct object_entry *entry,
 				  off_t write_offset)
 {
 	unsigned long size;
-	enum object_type type;
-	void *buf;
 	unsigned char header[10];
 	unsigned char dheader[10];
 	unsigned hdrlen;
 	off_t datalen;
 	enum object_type obj_type;
-	int to_reuse = 0;
+	int to_reuse;
 	/* write limit if limited packsize and not first object */
 	unsigned long limit = pack_size_limit && nr_written ?
 				pack_size_limit - write_offset : 0;
-				/* no if no delta */
-	int usable_delta =	!entry->delta ? 0 :
-				/* yes if unlimited packfile */
-				!pack_size_limit ? 1 :
-				/* no if base written to previous pack */
-				entry->delta->idx.offset == (off_t)-1 ? 0 :
-				/* otherwise double-check written to this
-				 * pack,  like we do below
-				 */
-				entry->delta->idx.offset ? 1 : 0;
+	int use_delta = usable_delta(entry);
 
 	if (!pack_to_stdout)
 		crc32_begin(f);
 
 	obj_type = entry->type;
-	if (no_reuse_object)
-		to_reuse = 0;	/* explicit */
-	else if (!entry->in_pack)
-		to_reuse = 0;	/* can't reuse what we don't have */
-	else if (obj_type == OBJ_REF_DELTA || obj_type == OBJ_OFS_DELTA)
-				/* check_object() decided it for us ... */
-		to_reuse = usable_delta;
-				/* ... but pack split may override that */
-	else if (obj_type != entry->in_pack_type)
-		to_reuse = 0;	/* pack has delta which is unusable */
-	else if (entry->delta)
-		to_reuse = 0;	/* we want to pack afresh */
-	else
-		to_reuse = 1;	/* we have it in-pack undeltified,
-				 * and we do not need to deltify it.
-				 */
+	to_reuse = reuse_object(entry, use_delta);
 
 	if (!to_reuse) {
-		z_stream stream;
-		unsigned long maxsize;
+		unsigned long outlen;
 		void *out;
-		if (!usable_delta) {
-			buf = read_sha1_file(entry->idx.sha1, &obj_type, &size);
-			if (!buf)
-				die("unable to read %s", sha1_to_hex(entry->idx.sha1));
-		} else if (entry->delta_data) {
-			size = entry->delta_size;
-			buf = entry->delta_data;
-			entry->delta_data = NULL;
-			obj_type = (allow_ofs_delta && entry->delta->idx.offset) ?
-				OBJ_OFS_DELTA : OBJ_REF_DELTA;
-		} else {
-			buf = read_sha1_file(entry->idx.sha1, &type, &size);
-			if (!buf)
-				die("unable to read %s", sha1_to_hex(entry->idx.sha1));
-			buf = delta_against(buf, size, entry);
-			size = entry->delta_size;
+
+		out = get_deflated(entry, &obj_type, &size, &outlen);
+		if (!out)
+			out = deflate_object(entry, use_delta,
+					     &obj_type, &size, &outlen);
+		datalen = outlen;
+		if (use_delta)
 			obj_type = (allow_ofs_delta && entry->delta->idx.offset) ?
 				OBJ_OFS_DELTA : OBJ_REF_DELTA;
-		}
-		/* compress the data to store and put compressed length in datalen */
-		memset(&stream, 0, sizeof(stream));
-		deflateInit(&stream, pack_compression_level);
-		maxsize = deflateBound(&stream, size);
-		out = xmalloc(maxsize);
-		/* Compress it */
-		stream.next_in = buf;
-		stream.avail_in = size;
-		stream.next_out = out;
-		stream.avail_out = maxsize;
-		while (deflate(&stream, Z_FINISH) == Z_OK)
-			/* nothing */;
-		deflateEnd(&stream);
-		datalen = stream.total_out;
 
 		/*
 		 * The object header is a byte of 'type' followed by zero or
@@ -323,7 +541,6 @@ static unsigned long write_object(struct sha1file *f,
 				dheader[--pos] = 128 | (--ofs & 127);
 			if (limit && hdrlen + sizeof(dheader) - pos + datalen + 20 >= limit) {
 				free(out);
-				free(buf);
 				return 0;
 			}
 			sha1write(f, header, hdrlen);
@@ -336,7 +553,6 @@ static unsigned long write_object(struct sha1file *f,
 			 */
 			if (limit && hdrlen + 20 + datalen + 20 >= limit) {
 				free(out);
-				free(buf);
 				return 0;
 			}
 			sha1write(f, header, hdrlen);
@@ -345,14 +561,12 @@ static unsigned long write_object(struct sha1file *f,
 		} else {
 			if (limit && hdrlen + datalen + 20 >= limit) {
 				free(out);
-				free(buf);
 				return 0;
 			}
 			sha1write(f, header, hdrlen);
 		}
 		sha1write(f, out, datalen);
 		free(out);
-		free(buf);
 	}
 	else {
 		struct packed_git *p = entry->in_pack;
@@ -360,6 +574,8 @@ static unsigned long write_object(struct sha1file *f,
 		struct revindex_entry *revidx;
 		off_t offset;
 
+		/* the pack windows are shared with the deflating threads */
+		read_lock();
 		if (entry->delta) {
 			obj_type = (allow_ofs_delta && entry->delta->idx.offset) ?
 				OBJ_OFS_DELTA : OBJ_REF_DELTA;
@@ -380,20 +596,26 @@ static unsigned long write_object(struct sha1file *f,
 			dheader[pos] = ofs & 127;
 			while (ofs >>= 7)
 				dheader[--pos] = 128 | (--ofs & 127);
-			if (limit && hdrlen + sizeof(dheader) - pos + datalen + 20 >= limit)
+			if (limit && hdrlen + sizeof(dheader) - pos + datalen + 20 >= limit) {
+				read_unlock();
 				return 0;
+			}
 			sha1write(f, header, hdrlen);
 			sha1write(f, dheader + pos, sizeof(dheader) - pos);
 			hdrlen += sizeof(dheader) - pos;
 		} else if (obj_type == OBJ_REF_DELTA) {
-			if (limit && hdrlen + 20 + datalen + 20 >= limit)
+			if (limit && hdrlen + 20 + datalen + 20 >= limit) {
+				read_unlock();
 				return 0;
+			}
 			sha1write(f, header, hdrlen);
 			sha1write(f, entry->delta->idx.sha1, 20);
 			hdrlen += 20;
 		} else {
-			if (limit && hdrlen + datalen + 20 >= limit)
+			if (limit && hdrlen + datalen + 20 >= limit) {
+				read_unlock();
 				return 0;
+			}
 			sha1write(f, header, hdrlen);
 		}
 
@@ -402,9 +624,10 @@ static unsigned long write_object(struct sha1file *f,
 			die("corrupt packed object for %s", sha1_to_hex(entry->idx.sha1));
 		copy_pack_data(f, p, &w_curs, offset, datalen);
 		unuse_pack(&w_curs);
+		read_unlock();
 		reused++;
 	}
-	if (usable_delta)
+	if (use_delta)
 		written_delta++;
 	written++;
 	if (!pack_to_stdout)
@@ -443,9 +666,82 @@ static off_t write_one(struct sha1file *f,
 	return offset + size;
 }
 
+/*
+ * Next to each pack we write with delta hints, a .hints file records
+ * the delta pairs we chose for it: a header, then (target, base,
+ * delta size) records sorted by target.  The next pack-objects run
+ * tries those pairs first, see seed_delta_hints().
+ */
+#define DELTA_HINTS_SIGNATURE 0x44484e54	/* "DHNT" */
+#define DELTA_HINTS_VERSION 1
+
+struct delta_hints_header {
+	uint32_t signature;
+	uint32_t version;
+	uint32_t nr;
+};
+
+struct delta_hint {
+	unsigned char target[20];
+	unsigned char base[20];
+	uint32_t delta_size;
+};
+
+static int delta_hint_cmp(const void *a, const void *b)
+{
+	return hashcmp(((const struct delta_hint *)a)->target,
+		       ((const struct delta_hint *)b)->target);
+}
+
 /* forward declaration for write_pack_file */
 static int adjust_perm(const char *path, mode_t mode);
 
+static void write_delta_hints(const unsigned char *sha1, mode_t mode)
+{
+	struct delta_hints_header hdr;
+	struct delta_hint *hints;
+	char tmpname[PATH_MAX];
+	uint32_t i, nr = 0;
+	int fd;
+
+	hints = xmalloc(nr_written * sizeof(*hints));
+	for (i = 0; i < nr_written; i++) {
+		/* idx is the first member of object_entry */
+		struct object_entry *e = (struct object_entry *)written_list[i];
+		unsigned long size;
+
+		if (!e->delta)
+			continue;
+		if (e->type == OBJ_REF_DELTA || e->type == OBJ_OFS_DELTA)
+			size = e->size;	/* reused as is */
+		else
+			size = e->delta_size;
+		hashcpy(hints[nr].target, e->idx.sha1);
+		hashcpy(hints[nr].base, e->delta->idx.sha1);
+		hints[nr].delta_size = htonl(size);
+		nr++;
+	}
+	qsort(hints, nr, sizeof(*hints), delta_hint_cmp);
+
+	snprintf(tmpname, sizeof(tmpname),
+		 "%s/tmp_hints_XXXXXX", get_object_directory());
+	fd = xmkstemp(tmpname);
+	hdr.signature = htonl(DELTA_HINTS_SIGNATURE);
+	hdr.version = htonl(DELTA_HINTS_VERSION);
+	hdr.nr = htonl(nr);
+	if (write_in_full(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+	    write_in_full(fd, hints, nr * sizeof(*hints)) != nr * sizeof(*hints) ||
+	    close(fd))
+		die("unable to write delta hints: %s", strerror(errno));
+	free(hints);
+	if (adjust_perm(tmpname, mode))
+		die("unable to make temporary hints file readable: %s",
+		    strerror(errno));
+	if (rename(tmpname, mkpath("%s-%s.hints", base_name, sha1_to_hex(sha1))))
+		die("unable to rename temporary hints file: %s",
+		    strerror(errno));
+}
+
 static void write_pack_file(void)
 {
 	uint32_t i = 0, j;
@@ -459,6 +755,7 @@ static void write_pack_file(void)
 	if (do_progress)
 		progress_state = start_progress("Writing objects", nr_result);
 	written_list = xmalloc(nr_objects * sizeof(*written_list));
+	start_deflate_threads();
 
 	do {
 		unsigned char sha1[20];
@@ -553,6 +850,9 @@ static void write_pack_file(void)
 				die("unable to rename temporary index file: %s",
 				    strerror(errno));
 
+			if (use_delta_hints)
+				write_delta_hints(sha1, mode);
+
 			free(idx_tmp_name);
 			free(pack_tmp_name);
 			puts(sha1_to_hex(sha1));
@@ -565,6 +865,7 @@ static void write_pack_file(void)
 		nr_remaining -= nr_written;
 	} while (nr_remaining && i < nr_objects);
 
+	stop_deflate_threads();
 	free(written_list);
 	stop_progress(&progress_state);
 	if (written != nr_result)
@@ -673,12 +974,65 @@ static int no_try_delta(const char *path)
 	return 0;
 }
 
-static int add_object_entry(const unsigned char *sha1, enum object_type type,
-			    const char *name, int exclude)
+struct object_location {
+	struct packed_git *pack;
+	off_t offset;
+	int skip;	/* in a pack we are told not to repack */
+};
+
+/*
+ * The packs named with --unpacked=<pack> are about to go away, so
+ * --incremental does not count what is in them as packed already.
+ */
+static int is_rolled_pack(struct packed_git *p)
+{
+	int i;
+
+	for (i = 0; i < nr_rolled_packs; i++)
+		if (matches_pack_name(p, rolled_packs[i]))
+			return 1;
+	return 0;
+}
+
+/*
+ * Find the first pack that has the object.  This only reads the pack
+ * indices, so the threads may do it once they are all open.
+ */
+static void locate_object(const unsigned char *sha1, int exclude,
+			  struct object_location *loc)
+{
+	struct packed_git *p;
+
+	loc->pack = NULL;
+	loc->offset = 0;
+	loc->skip = 0;
+	for (p = packed_git; p; p = p->next) {
+		off_t offset = find_pack_entry_one(sha1, p);
+		if (offset) {
+			if (!loc->pack) {
+				loc->offset = offset;
+				loc->pack = p;
+			}
+			if (exclude)
+				break;
+			if ((incremental && !is_rolled_pack(p)) ||
+			    (local && !p->pack_local)) {
+				loc->skip = 1;
+				return;
+			}
+		}
+	}
+}
+
+static int add_located_object_entry(const unsigned char *sha1,
+				    enum object_type type,
+				    const char *name, int exclude,
+				    const struct object_location *loc)
 {
 	struct object_entry *entry;
-	struct packed_git *p, *found_pack = NULL;
-	off_t found_offset = 0;
+	struct object_location here;
+	struct packed_git *found_pack;
+	off_t found_offset;
 	int ix;
 	unsigned hash = name_hash(name);
 
@@ -693,21 +1047,14 @@ static int add_object_entry(const unsigned char *sha1, enum object_type type,
 		return 0;
 	}
 
-	for (p = packed_git; p; p = p->next) {
-		off_t offset = find_pack_entry_one(sha1, p);
-		if (offset) {
-			if (!found_pack) {
-				found_offset = offset;
-				found_pack = p;
-			}
-			if (exclude)
-				break;
-			if (incremental)
-				return 0;
-			if (local && !p->pack_local)
-				return 0;
-		}
+	if (!loc) {
+		locate_object(sha1, exclude, &here);
+		loc = &here;
 	}
+	if (loc->skip)
+		return 0;
+	found_pack = loc->pack;
+	found_offset = loc->offset;
 
 	if (nr_objects >= nr_alloc) {
 		nr_alloc = (nr_alloc  + 1024) * 3 / 2;
@@ -742,6 +1089,12 @@ static int add_object_entry(const unsigned char *sha1, enum object_type type,
 	return 1;
 }
 
+static int add_object_entry(const unsigned char *sha1, enum object_type type,
+			    const char *name, int exclude)
+{
+	return add_located_object_entry(sha1, type, name, exclude, NULL);
+}
+
 struct pbase_tree_cache {
 	unsigned char sha1[20];
 	int ref;
@@ -1190,31 +1543,6 @@ static int delta_cacheable(unsigned long src_size, unsigned long trg_size,
 	return 0;
 }
 
-#ifdef THREADED_DELTA_SEARCH
-
-static pthread_mutex_t read_mutex = PTHREAD_MUTEX_INITIALIZER;
-#define read_lock()		pthread_mutex_lock(&read_mutex)
-#define read_unlock()		pthread_mutex_unlock(&read_mutex)
-
-static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
-#define cache_lock()		pthread_mutex_lock(&cache_mutex)
-#define cache_unlock()		pthread_mutex_unlock(&cache_mutex)
-
-static pthread_mutex_t progress_mutex = PTHREAD_MUTEX_INITIALIZER;
-#define progress_lock()		pthread_mutex_lock(&progress_mutex)
-#define progress_unlock()	pthread_mutex_unlock(&progress_mutex)
-
-#else
-
-#define read_lock()		(void)0
-#define read_unlock()		(void)0
-#define cache_lock()		(void)0
-#define cache_unlock()		(void)0
-#define progress_lock()		(void)0
-#define progress_unlock()	(void)0
-
-#endif
-
 static int try_delta(struct unpacked *trg, struct unpacked *src,
 		     unsigned max_depth, unsigned long *mem_usage)
 {
@@ -1670,6 +1998,199 @@ static int add_ref_tag(const char *path, const unsigned char *sha1, int flag, vo
 	return 0;
 }
 
+struct delta_hints_file {
+	const struct delta_hint *table;
+	uint32_t nr;
+};
+
+static struct delta_hints_file *delta_hints_files;
+static int nr_delta_hints_files;
+
+static void load_delta_hints(void)
+{
+	struct packed_git *p;
+	int alloc = 0;
+
+	for (p = packed_git; p; p = p->next) {
+		const struct delta_hints_header *hdr;
+		struct delta_hints_file *hf;
+		char path[PATH_MAX];
+		struct stat st;
+		size_t size;
+		void *map;
+		int len = strlen(p->pack_name), fd;
+
+		if (len < 5 || len + 1 > sizeof(path))
+			continue;
+		memcpy(path, p->pack_name, len - 5);
+		strcpy(path + len - 5, ".hints");
+		fd = open(path, O_RDONLY);
+		if (fd < 0)
+			continue;
+		if (fstat(fd, &st) || st.st_size < sizeof(*hdr)) {
+			close(fd);
+			continue;
+		}
+		size = xsize_t(st.st_size);
+		map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		hdr = map;
+		if (ntohl(hdr->signature) != DELTA_HINTS_SIGNATURE ||
+		    ntohl(hdr->version) != DELTA_HINTS_VERSION ||
+		    (size - sizeof(*hdr)) / sizeof(struct delta_hint) < ntohl(hdr->nr)) {
+			warning("ignoring invalid %s", path);
+			munmap(map, size);
+			continue;
+		}
+		ALLOC_GROW(delta_hints_files, nr_delta_hints_files + 1, alloc);
+		hf = &delta_hints_files[nr_delta_hints_files++];
+		hf->table = (const struct delta_hint *)(hdr + 1);
+		hf->nr = ntohl(hdr->nr);
+	}
+}
+
+static const struct delta_hint *find_delta_hint(const unsigned char *sha1)
+{
+	int i;
+
+	for (i = 0; i < nr_delta_hints_files; i++) {
+		const struct delta_hints_file *hf = &delta_hints_files[i];
+		uint32_t lo = 0, hi = hf->nr;
+
+		while (lo < hi) {
+			uint32_t mi = lo + (hi - lo) / 2;
+			int cmp = hashcmp(hf->table[mi].target, sha1);
+			if (!cmp)
+				return &hf->table[mi];
+			if (cmp < 0)
+				lo = mi + 1;
+			else
+				hi = mi;
+		}
+	}
+	return NULL;
+}
+
+static int delta_base_sort(const void *_a, const void *_b)
+{
+	const struct object_entry *a = *(struct object_entry **)_a;
+	const struct object_entry *b = *(struct object_entry **)_b;
+
+	if (a->delta != b->delta)
+		return a->delta < b->delta ? -1 : 1;
+	return a < b ? -1 : a > b;
+}
+
+/*
+ * Deltify the objects the previous runs left hints for against the
+ * same bases again, instead of searching the window for them.  Like
+ * reused deltas, they are then left out of the search, and only the
+ * objects without a usable hint are searched.  The hinted pairs are
+ * dropped when the base is not in this pack, when the chain would get
+ * deeper than "depth", or when the delta is no longer small enough.
+ */
+static void seed_delta_hints(int depth)
+{
+	struct object_entry **list, *base = NULL;
+	void *base_data = NULL;
+	struct delta_index *index = NULL;
+	uint32_t i, n = 0, seeded;
+
+	load_delta_hints();
+	if (!nr_delta_hints_files)
+		return;
+
+	list = xmalloc(nr_objects * sizeof(*list));
+	for (i = 0; i < nr_objects; i++) {
+		struct object_entry *entry = objects + i;
+		const struct delta_hint *hint;
+		struct object_entry *hint_base;
+
+		if (entry->delta || entry->preferred_base ||
+		    entry->no_try_delta || entry->size < 50)
+			continue;
+		hint = find_delta_hint(entry->idx.sha1);
+		if (!hint || ntohl(hint->delta_size) >= entry->size / 2 - 20)
+			continue;
+		hint_base = locate_object_entry(hint->base);
+		if (!hint_base || hint_base == entry)
+			continue;
+		if (hint_base->type != entry->type &&
+		    hint_base->type != OBJ_REF_DELTA &&
+		    hint_base->type != OBJ_OFS_DELTA)
+			continue;
+		entry->delta = hint_base;
+		list[n++] = entry;
+	}
+
+	/* this also breaks the cycles hints from different packs may form */
+	for (i = 0; i < n; i++) {
+		struct object_entry *e = list[i];
+		int d = 0;
+
+		while (e->delta && d <= depth) {
+			e = e->delta;
+			d++;
+		}
+		if (d > depth)
+			list[i]->delta = NULL;
+	}
+	for (i = seeded = 0; i < n; i++)
+		if (list[i]->delta)
+			list[seeded++] = list[i];
+	n = seeded;
+	qsort(list, n, sizeof(*list), delta_base_sort);
+
+	if (progress)
+		progress_state = start_progress("Applying delta hints", n);
+	for (i = 0; i < n; i++) {
+		struct object_entry *entry = list[i];
+		unsigned long size, delta_size;
+		enum object_type type;
+		void *data, *delta_buf;
+
+		if (entry->delta != base) {
+			free_delta_index(index);
+			free(base_data);
+			index = NULL;
+			base = entry->delta;
+			base_data = read_sha1_file(base->idx.sha1, &type, &size);
+			if (!base_data)
+				die("object %s cannot be read",
+				    sha1_to_hex(base->idx.sha1));
+			index = create_delta_index(base_data, size);
+		}
+		display_progress(progress_state, i + 1);
+		if (!index) {
+			entry->delta = NULL;
+			continue;
+		}
+		data = read_sha1_file(entry->idx.sha1, &type, &size);
+		if (!data)
+			die("object %s cannot be read",
+			    sha1_to_hex(entry->idx.sha1));
+		delta_buf = create_delta(index, data, size, &delta_size,
+					 size / 2 - 20);
+		free(data);
+		if (!delta_buf) {
+			entry->delta = NULL;
+			continue;
+		}
+		entry->delta_size = delta_size;
+		if (delta_cacheable(base->size, size, delta_size)) {
+			delta_cache_size += delta_size;
+			entry->delta_data = xrealloc(delta_buf, delta_size);
+		} else
+			free(delta_buf);
+		entry->delta_sibling = base->delta_child;
+		base->delta_child = entry;
+	}
+	stop_progress(&progress_state);
+	free_delta_index(index);
+	free(base_data);
+	free(list);
+}
+
 static void prepare_pack(int window, int depth)
 {
 	struct object_entry **delta_list;
@@ -1677,7 +2198,11 @@ static void prepare_pack(int window, int depth)
 
 	get_object_details();
 
-	if (!nr_objects || !window || !depth)
+	if (!nr_objects || !depth)
+		return;
+	if (use_delta_hints)
+		seed_delta_hints(depth);
+	if (!window)
 		return;
 
 	delta_list = xmalloc(nr_objects * sizeof(*delta_list));
@@ -1771,6 +2296,10 @@ static int git_pack_config(const char *k, const char *v)
 		pack_size_limit_cfg = git_config_ulong(k, v);
 		return 0;
 	}
+	if (!strcmp(k, "pack.deltahints")) {
+		use_delta_hints = git_config_bool(k, v);
+		return 0;
+	}
 	return git_default_config(k, v);
 }
 
@@ -1807,16 +2336,131 @@ static void read_object_list_from_stdin(void)
 
 #define OBJECT_ADDED (1u<<20)
 
+#ifdef THREADED_DELTA_SEARCH
+
+/*
+ * With more than one thread, the objects the revision walk shows us
+ * are only noted down.  Once the walk is over, the threads look them
+ * up in the packs, which is what adding an object mostly costs when
+ * there are many packs, and then they are added in the order they
+ * were shown, so that the result is the same as without threads.
+ */
+struct shown_object {
+	struct object *object;
+	const char *name;
+	struct object_location loc;
+};
+
+static struct shown_object *shown_objects;
+static uint32_t nr_shown, alloc_shown;
+static int defer_add;
+
+struct locate_params {
+	pthread_t thread;
+	struct shown_object *list;
+	uint32_t nr;
+};
+
+static void *threaded_locate(void *arg)
+{
+	struct locate_params *me = arg;
+	uint32_t i;
+
+	for (i = 0; i < me->nr; i++)
+		locate_object(me->list[i].object->sha1, 0, &me->list[i].loc);
+	return NULL;
+}
+
+static void start_deferred_add(void)
+{
+	struct packed_git *p;
+
+	if (delta_search_threads <= 1)
+		return;
+	for (p = packed_git; p; p = p->next)
+		if (open_pack_index(p))
+			return;
+	defer_add = 1;
+}
+
+static void note_shown_object(struct object *object, const char *name)
+{
+	struct shown_object *s;
+
+	ALLOC_GROW(shown_objects, nr_shown + 1, alloc_shown);
+	s = &shown_objects[nr_shown++];
+	s->object = object;
+	s->name = name;
+	display_progress(progress_state, nr_shown);
+}
+
+static void add_shown_objects(void)
+{
+	struct locate_params p[delta_search_threads];
+	uint32_t i, start;
+	int t, ret;
+
+	if (!defer_add)
+		return;
+	defer_add = 0;
+	if (!nr_shown)
+		return;
+
+	/* the first lookup sets up the debugging knobs of the lookup */
+	locate_object(shown_objects[0].object->sha1, 0, &shown_objects[0].loc);
+	start = 1;
+	for (t = 0; t < delta_search_threads; t++) {
+		uint32_t nr = (nr_shown - start) / (delta_search_threads - t);
+
+		p[t].list = shown_objects + start;
+		p[t].nr = nr;
+		start += nr;
+		ret = pthread_create(&p[t].thread, NULL, threaded_locate, &p[t]);
+		if (ret)
+			die("unable to create thread: %s", strerror(ret));
+	}
+	for (t = 0; t < delta_search_threads; t++)
+		pthread_join(p[t].thread, NULL);
+
+	for (i = 0; i < nr_shown; i++) {
+		struct shown_object *s = &shown_objects[i];
+
+		if (s->object->type != OBJ_COMMIT)
+			add_preferred_base_object(s->name);
+		add_located_object_entry(s->object->sha1, s->object->type,
+					 s->name, 0, &s->loc);
+	}
+	free(shown_objects);
+	shown_objects = NULL;
+	nr_shown = alloc_shown = 0;
+}
+
+#else
+
+#define defer_add 0
+#define start_deferred_add()	(void)0
+#define note_shown_object(object, name)	(void)0
+#define add_shown_objects()	(void)0
+
+#endif
+
 static void show_commit(struct commit *commit)
 {
-	add_object_entry(commit->object.sha1, OBJ_COMMIT, NULL, 0);
+	if (defer_add)
+		note_shown_object(&commit->object, NULL);
+	else
+		add_object_entry(commit->object.sha1, OBJ_COMMIT, NULL, 0);
 	commit->object.flags |= OBJECT_ADDED;
 }
 
 static void show_object(struct object_array_entry *p)
 {
-	add_preferred_base_object(p->name);
-	add_object_entry(p->item->sha1, p->item->type, p->name, 0);
+	if (defer_add)
+		note_shown_object(p->item, p->name);
+	else {
+		add_preferred_base_object(p->name);
+		add_object_entry(p->item->sha1, p->item->type, p->name, 0);
+	}
 	p->item->flags |= OBJECT_ADDED;
 }
 
@@ -1935,7 +2579,9 @@ static void get_object_list(int ac, const char **av)
 	if (prepare_revision_walk(&revs))
 		die("revision walk setup failed");
 	mark_edges_uninteresting(revs.commits, &revs, show_edge);
+	start_deferred_add();
 	traverse_commit_list(&revs, show_commit, show_object);
+	add_shown_objects();
 
 	if (keep_unreachable)
 		add_objects_in_unpacked_packs(&revs);
@@ -2061,6 +2707,14 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 			allow_ofs_delta = 1;
 			continue;
 		}
+		if (!strcmp("--delta-hints", arg)) {
+			use_delta_hints = 1;
+			continue;
+		}
+		if (!strcmp("--no-delta-hints", arg)) {
+			use_delta_hints = 0;
+			continue;
+		}
 		if (!strcmp("--stdout", arg)) {
 			pack_to_stdout = 1;
 			continue;
@@ -2088,6 +2742,11 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 						 rp_ac_alloc * sizeof(*rp_av));
 			}
 			rp_av[rp_ac++] = arg;
+			if (!prefixcmp(arg, "--unpacked=")) {
+				ALLOC_GROW(rolled_packs, nr_rolled_packs + 1,
+					   rolled_packs_alloc);
+				rolled_packs[nr_rolled_packs++] = arg + 11;
+			}
 			continue;
 		}
 		if (!strcmp("--thin", arg)) {
@@ -5,6 +5,7 @@
 #include "builtin.h"
 #include "reachable.h"
 #include "parse-options.h"
+#include "rename-cache.h"
 
 static const char * const prune_usage[] = {
 	"git-prune [-n] [--expire <time>] [--] [<head>...]",
@@ -77,6 +78,11 @@ static int prune_dir(int i, char *path)
 	return 0;
 }
 
+static int is_reachable(const unsigned char *sha1)
+{
+	return !!lookup_object(sha1);
+}
+
 static void prune_object_dir(const char *path)
 {
 	int i;
@@ -155,6 +161,8 @@ int cmd_prune(int argc, const char **argv, const char *prefix)
 	}
 	mark_reachable_objects(&revs, 1);
 	prune_object_dir(get_object_directory());
+	if (!show_only)
+		prune_rename_cache(is_reachable);
 
 	sync();
 	prune_packed_objects(show_only);
@@ -0,0 +1,360 @@
+/*
+ * Builtin "git repack"
+ *
+ * Based on git-repack.sh, which is
+ *
+ * Copyright (c) 2005 Linus Torvalds
+ */
+#include "builtin.h"
+#include "cache.h"
+#include "parse-options.h"
+#include "run-command.h"
+
+static const char * const builtin_repack_usage[] = {
+	"git-repack [options]",
+	NULL
+};
+
+static int delta_base_offset;
+static char *packdir, *packtmp;
+
+static int repack_config(const char *var, const char *value)
+{
+	if (!strcmp(var, "repack.usedeltabaseoffset")) {
+		delta_base_offset = git_config_bool(var, value);
+		return 0;
+	}
+	return git_default_config(var, value);
+}
+
+/*
+ * Remove what a pack-objects that did not finish left behind, i.e.
+ * everything under the object directory starting with "packtmp-".
+ */
+static void remove_temporary_files(void)
+{
+	const char *dir = get_object_directory();
+	const char *prefix = packtmp + strlen(dir) + 1;
+	int prefix_len = strlen(prefix);
+	struct dirent *e;
+	DIR *d;
+
+	d = opendir(dir);
+	if (!d)
+		return;
+	while ((e = readdir(d)) != NULL) {
+		if (strncmp(e->d_name, prefix, prefix_len) ||
+		    e->d_name[prefix_len] != '-')
+			continue;
+		unlink(mkpath("%s/%s", dir, e->d_name));
+	}
+	closedir(d);
+}
+
+static void remove_pack_on_signal(int signo)
+{
+	remove_temporary_files();
+	signal(signo, SIG_DFL);
+	raise(signo);
+}
+
+struct existing_pack {
+	char *name;		/* "pack-<sha1>", without the .pack */
+	uint32_t nr_objects;
+};
+
+static int pack_size_cmp(const void *a_, const void *b_)
+{
+	const struct existing_pack *a = a_, *b = b_;
+
+	if (a->nr_objects != b->nr_objects)
+		return a->nr_objects < b->nr_objects ? -1 : 1;
+	return strcmp(a->name, b->name);
+}
+
+/*
+ * Collect the local packs without a .keep file, those we may roll up,
+ * sorted by the number of objects in them.
+ */
+static int get_existing_packs(struct existing_pack **packs)
+{
+	struct packed_git *p;
+	int nr = 0, alloc = 0;
+
+	prepare_packed_git();
+	for (p = packed_git; p; p = p->next) {
+		const char *name;
+		int len;
+
+		if (!p->pack_local)
+			continue;
+		name = strrchr(p->pack_name, '/');
+		name = name ? name + 1 : p->pack_name;
+		len = strlen(name);
+		if (len < 5 || strcmp(name + len - 5, ".pack"))
+			continue;
+		if (!access(mkpath("%s/%.*s.keep", packdir, len - 5, name), F_OK))
+			continue;
+		if (open_pack_index(p))
+			continue;
+		ALLOC_GROW(*packs, nr + 1, alloc);
+		(*packs)[nr].name = xstrndup(name, len - 5);
+		(*packs)[nr].nr_objects = p->num_objects;
+		nr++;
+	}
+	qsort(*packs, nr, sizeof(**packs), pack_size_cmp);
+	return nr;
+}
+
+/*
+ * With a geometric factor, only roll up the smallest packs, so that
+ * the packs we leave alone and the new one have each at least
+ * "factor" times as many objects as the next smaller one.  Returns how
+ * many of the (sorted) packs go into the new pack.
+ */
+static int geometric_split(struct existing_pack *packs, int nr, int factor)
+{
+	uint64_t total = 0;
+	int i, split;
+
+	/* find where the largest packs stop forming a progression */
+	for (i = nr - 1; i > 0; i--)
+		if (packs[i].nr_objects < (uint64_t)factor * packs[i - 1].nr_objects)
+			break;
+	split = i ? i + 1 : 0;
+
+	/* the new pack may then be too large for the next one up */
+	for (i = 0; i < split; i++)
+		total += packs[i].nr_objects;
+	for (; split < nr; split++) {
+		if (packs[split].nr_objects >= (uint64_t)factor * total)
+			break;
+		total += packs[split].nr_objects;
+	}
+	return split;
+}
+
+static void remove_redundant_pack(const char *name)
+{
+	/* a pack someone decided to keep meanwhile stays */
+	if (!access(mkpath("%s/%s.keep", packdir, name), F_OK))
+		return;
+	/* without its .idx the pack is not used any more */
+	unlink(mkpath("%s/%s.idx", packdir, name));
+	unlink(mkpath("%s/%s.pack", packdir, name));
+	unlink(mkpath("%s/%s.hints", packdir, name));
+}
+
+/*
+ * Move the new pack (and its index, and hints if any) in place of a
+ * pack of the same name, if there is one.
+ */
+static void install_pack(const char *name)
+{
+	static const char *exts[] = { "pack", "idx" };
+	char src[PATH_MAX], dst[PATH_MAX], old[PATH_MAX];
+	int i;
+
+	if (safe_create_leading_directories(mkpath("%s/pack-%s.pack", packdir, name)))
+		die("unable to create %s", packdir);
+	for (i = 0; i < ARRAY_SIZE(exts); i++) {
+		snprintf(dst, sizeof(dst), "%s/pack-%s.%s", packdir, name, exts[i]);
+		snprintf(old, sizeof(old), "%s/old-pack-%s.%s", packdir, name, exts[i]);
+		if (!access(dst, F_OK) && rename(dst, old))
+			die("unable to rename %s: %s", dst, strerror(errno));
+	}
+	for (i = 0; i < ARRAY_SIZE(exts); i++) {
+		snprintf(src, sizeof(src), "%s-%s.%s", packtmp, name, exts[i]);
+		snprintf(dst, sizeof(dst), "%s/pack-%s.%s", packdir, name, exts[i]);
+		if (rename(src, dst))
+			die("Couldn't replace the existing pack with updated one.\n"
+			    "The original set of packs have been saved as\n"
+			    "old-pack-%s.{pack,idx} in %s.", name, packdir);
+	}
+	snprintf(src, sizeof(src), "%s-%s.hints", packtmp, name);
+	snprintf(dst, sizeof(dst), "%s/pack-%s.hints", packdir, name);
+	if (!access(src, F_OK) && rename(src, dst))
+		die("unable to rename %s: %s", src, strerror(errno));
+	for (i = 0; i < ARRAY_SIZE(exts); i++)
+		unlink(mkpath("%s/old-pack-%s.%s", packdir, name, exts[i]));
+}
+
+static void push_arg(const char ***argv, int *nr, int *alloc, const char *arg)
+{
+	ALLOC_GROW(*argv, *nr + 1, *alloc);
+	(*argv)[(*nr)++] = arg;
+}
+
+int cmd_repack(int argc, const char **argv, const char *prefix)
+{
+	int all_into_one = 0, keep_unreachable = 0, remove_redundant = 0;
+	int no_reuse = 0, no_update_info = 0, quiet = 0, local = 0;
+	int geometric = 0;
+	const char *window = NULL, *window_memory = NULL, *depth = NULL;
+	const char *max_pack_size = NULL;
+	struct existing_pack *packs = NULL;
+	int nr_packs = 0, nr_existing = 0, i;
+	const char **cmd_argv = NULL;
+	int cmd_nr = 0, cmd_alloc = 0;
+	char **names = NULL;
+	int nr_names = 0, alloc_names = 0;
+	struct child_process cmd;
+	char line[1024];
+	FILE *out;
+
+	struct option builtin_repack_options[] = {
+		OPT_BOOLEAN('a', NULL, &all_into_one,
+			    "pack everything in a single pack"),
+		OPT_BOOLEAN('A', NULL, &keep_unreachable,
+			    "same as -a, and keep unreachable objects too"),
+		OPT_BOOLEAN('d', NULL, &remove_redundant,
+			    "remove redundant packs, and run git-prune-packed"),
+		OPT_BOOLEAN('f', NULL, &no_reuse,
+			    "pass --no-reuse-object to git-pack-objects"),
+		OPT_BOOLEAN('n', NULL, &no_update_info,
+			    "do not run git-update-server-info"),
+		OPT__QUIET(&quiet),
+		OPT_BOOLEAN('l', NULL, &local,
+			    "pass --local to git-pack-objects"),
+		OPT_INTEGER(0, "geometric", &geometric,
+			    "only roll up packs so that each is <n> times larger than the next"),
+		OPT_GROUP("Packing constraints"),
+		OPT_STRING(0, "window", &window, "n",
+			   "size of the window used for delta compression"),
+		OPT_STRING(0, "window-memory", &window_memory, "bytes",
+			   "same as the above, but limit memory size instead of entries count"),
+		OPT_STRING(0, "depth", &depth, "n",
+			   "limits the maximum delta depth"),
+		OPT_STRING(0, "max-pack-size", &max_pack_size, "n",
+			   "maximum size of each packfile"),
+		OPT_END()
+	};
+
+	git_config(repack_config);
+
+	argc = parse_options(argc, argv, builtin_repack_options,
+			     builtin_repack_usage, 0);
+	if (argc > 0)
+		usage_with_options(builtin_repack_usage, builtin_repack_options);
+	if (keep_unreachable)
+		all_into_one = 1;
+	if (geometric) {
+		if (geometric < 2)
+			die("--geometric needs a factor of at least 2");
+		if (all_into_one && !keep_unreachable)
+			die("--geometric and -a cannot be used together");
+		all_into_one = 0;
+	}
+
+	packdir = xstrdup(mkpath("%s/pack", get_object_directory()));
+	packtmp = xstrdup(mkpath("%s/.tmp-%d-pack", get_object_directory(),
+				 (int)getpid()));
+	remove_temporary_files();
+	atexit(remove_temporary_files);
+	signal(SIGINT, remove_pack_on_signal);
+	signal(SIGHUP, remove_pack_on_signal);
+	signal(SIGTERM, remove_pack_on_signal);
+	signal(SIGQUIT, remove_pack_on_signal);
+
+	push_arg(&cmd_argv, &cmd_nr, &cmd_alloc, "pack-objects");
+	push_arg(&cmd_argv, &cmd_nr, &cmd_alloc, "--non-empty");
+	push_arg(&cmd_argv, &cmd_nr, &cmd_alloc, "--all");
+	push_arg(&cmd_argv, &cmd_nr, &cmd_alloc, "--reflog");
+
+	if (all_into_one || geometric) {
+		nr_packs = get_existing_packs(&packs);
+		nr_existing = geometric ?
+			geometric_split(packs, nr_packs, geometric) : nr_packs;
+	}
+	for (i = 0; i < nr_existing; i++)
+		push_arg(&cmd_argv, &cmd_nr, &cmd_alloc,
+			 xstrdup(mkpath("--unpacked=%s.pack", packs[i].name)));
+	if (!nr_existing) {
+		push_arg(&cmd_argv, &cmd_nr, &cmd_alloc, "--unpacked");
+		push_arg(&cmd_argv, &cmd_nr, &cmd_alloc, "--incremental");
+	} else {
+		/* what is in the packs we leave alone stays there */
+		if (nr_existing < nr_packs)
+			push_arg(&cmd_argv, &cmd_nr, &cmd_alloc, "--incremental");
+		if (keep_unreachable)
+			push_arg(&cmd_argv, &cmd_nr, &cmd_alloc,
+				 "--keep-unreachable");
+	}
+
+	if (local)
+		push_arg(&cmd_argv, &cmd_nr, &cmd_alloc, "--local");
+	if (quiet)
+		push_arg(&cmd_argv, &cmd_nr, &cmd_alloc, "-q");
+	if (no_reuse)
+		push_arg(&cmd_argv, &cmd_nr, &cmd_alloc, "--no-reuse-object");
+	if (window)
+		push_arg(&cmd_argv, &cmd_nr, &cmd_alloc,
+			 xstrdup(mkpath("--window=%s", window)));
+	if (window_memory)
+		push_arg(&cmd_argv, &cmd_nr, &cmd_alloc,
+			 xstrdup(mkpath("--window-memory=%s", window_memory)));
+	if (depth)
+		push_arg(&cmd_argv, &cmd_nr, &cmd_alloc,
+			 xstrdup(mkpath("--depth=%s", depth)));
+	if (max_pack_size)
+		push_arg(&cmd_argv, &cmd_nr, &cmd_alloc,
+			 xstrdup(mkpath("--max-pack-size=%s", max_pack_size)));
+	if (delta_base_offset)
+		push_arg(&cmd_argv, &cmd_nr, &cmd_alloc, "--delta-base-offset");
+	push_arg(&cmd_argv, &cmd_nr, &cmd_alloc, packtmp);
+	push_arg(&cmd_argv, &cmd_nr, &cmd_alloc, NULL);
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.argv = cmd_argv;
+	cmd.git_cmd = 1;
+	cmd.no_stdin = 1;
+	cmd.out = -1;
+	if (start_command(&cmd))
+		exit(1);
+	out = xfdopen(cmd.out, "r");
+	while (fgets(line, sizeof(line), out)) {
+		int len = strlen(line);
+		if (len && line[len - 1] == '\n')
+			line[--len] = 0;
+		if (len != 40)
+			die("repack: expecting 40 character sha, got: %s", line);
+		ALLOC_GROW(names, nr_names + 1, alloc_names);
+		names[nr_names++] = xstrdup(line);
+	}
+	fclose(out);
+	if (finish_command(&cmd))
+		exit(1);
+
+	if (!nr_names && !quiet)
+		printf("Nothing new to pack.\n");
+	for (i = 0; i < nr_names; i++)
+		install_pack(names[i]);
+
+	if (remove_redundant) {
+		/* We know the packs we rolled up are all redundant. */
+		if (nr_existing)
+			sync();
+		for (i = 0; i < nr_existing; i++) {
+			int j;
+
+			for (j = 0; j < nr_names; j++)
+				if (!strcmp(packs[i].name + 5, names[j]))
+					break;
+			if (j == nr_names)
+				remove_redundant_pack(packs[i].name);
+		}
+		cmd_argv[0] = "prune-packed";
+		cmd_argv[1] = quiet ? "-q" : NULL;
+		cmd_argv[2] = NULL;
+		if (run_command_v_opt(cmd_argv, RUN_GIT_CMD))
+			return 1;
+	}
+
+	if (!no_update_info) {
+		cmd_argv[0] = "update-server-info";
+		cmd_argv[1] = NULL;
+		if (run_command_v_opt(cmd_argv, RUN_GIT_CMD))
+			return 1;
+	}
+	return 0;
+}
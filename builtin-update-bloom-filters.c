@@ -0,0 +1,46 @@
+/*
+ * Builtin "git update-bloom-filters".
+ *
+ * Computes the changed-path filters of the commits reachable from
+ * the given revisions (all refs by default), see bloom.c.
+ */
+#include "cache.h"
+#include "builtin.h"
+#include "commit.h"
+#include "diff.h"
+#include "revision.h"
+#include "bloom.h"
+
+static const char update_bloom_filters_usage[] =
+"git-update-bloom-filters [<rev>...]";
+
+int cmd_update_bloom_filters(int argc, const char **argv, const char *prefix)
+{
+	struct rev_info revs;
+	struct commit **commits = NULL;
+	struct commit *commit;
+	int i, nr = 0, alloc = 0;
+
+	git_config(git_default_config);
+	for (i = 1; i < argc; i++)
+		if (argv[i][0] == '-' && strcmp(argv[i], "--all"))
+			usage(update_bloom_filters_usage);
+
+	init_revisions(&revs, prefix);
+	if (argc == 1) {
+		const char *all[] = { "update-bloom-filters", "--all", NULL };
+		setup_revisions(2, all, &revs, NULL);
+	} else if (setup_revisions(argc, argv, &revs, NULL) != 1)
+		usage(update_bloom_filters_usage);
+
+	save_commit_buffer = 0;
+	prepare_revision_walk(&revs);
+	while ((commit = get_revision(&revs)) != NULL) {
+		ALLOC_GROW(commits, nr + 1, alloc);
+		commits[nr++] = commit;
+	}
+	if (write_bloom_filters(commits, nr))
+		return 1;
+	free(commits);
+	return 0;
+}
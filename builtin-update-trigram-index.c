@@ -0,0 +1,59 @@
+/*
+ * Builtin "git update-trigram-index".
+ *
+ * Computes the trigram filters of the blobs reachable from the given
+ * revisions (all refs by default), see trigram.c.
+ */
+#include "cache.h"
+#include "builtin.h"
+#include "commit.h"
+#include "diff.h"
+#include "revision.h"
+#include "list-objects.h"
+#include "trigram.h"
+
+static const char update_trigram_index_usage[] =
+"git-update-trigram-index [<rev>...]";
+
+static struct object **blobs;
+static int nr_blobs, alloc_blobs;
+
+static void show_commit(struct commit *commit)
+{
+}
+
+static void show_object(struct object_array_entry *p)
+{
+	if (p->item->type != OBJ_BLOB)
+		return;
+	ALLOC_GROW(blobs, nr_blobs + 1, alloc_blobs);
+	blobs[nr_blobs++] = p->item;
+}
+
+int cmd_update_trigram_index(int argc, const char **argv, const char *prefix)
+{
+	struct rev_info revs;
+	int i;
+
+	git_config(git_default_config);
+	for (i = 1; i < argc; i++)
+		if (argv[i][0] == '-' && strcmp(argv[i], "--all"))
+			usage(update_trigram_index_usage);
+
+	init_revisions(&revs, prefix);
+	if (argc == 1) {
+		const char *all[] = { "update-trigram-index", "--all", NULL };
+		setup_revisions(2, all, &revs, NULL);
+	} else if (setup_revisions(argc, argv, &revs, NULL) != 1)
+		usage(update_trigram_index_usage);
+	revs.tree_objects = 1;
+	revs.blob_objects = 1;
+
+	save_commit_buffer = 0;
+	prepare_revision_walk(&revs);
+	traverse_commit_list(&revs, show_commit, show_object);
+	if (write_trigram_index(blobs, nr_blobs))
+		return 1;
+	free(blobs);
+	return 0;
+}
@@ -1,5 +1,6 @@
 #include "cache.h"
 #include "tree.h"
+#include "tree-walk.h"
 #include "cache-tree.h"
 
 #ifndef DEBUG
@@ -587,3 +588,187 @@ int write_cache_as_tree(unsigned char *sha1, int missing_ok, const char *prefix)
 
 	return 0;
 }
+
+/*
+ * Find the range of index entries that are inside the directory
+ * "path" (which is empty for the top level, or ends with a slash).
+ */
+static int dir_range(struct index_state *istate, struct strbuf *path, int *end)
+{
+	int start;
+
+	if (!path->len) {
+		*end = istate->cache_nr;
+		return 0;
+	}
+	start = index_name_pos(istate, path->buf, path->len);
+	if (start < 0)
+		start = -start - 1;
+	/* '0' sorts right after '/' */
+	path->buf[path->len - 1] = '0';
+	*end = index_name_pos(istate, path->buf, path->len);
+	path->buf[path->len - 1] = '/';
+	if (*end < 0)
+		*end = -*end - 1;
+	return start;
+}
+
+static int same_entries(struct cache_entry **a, struct cache_entry **b, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		struct cache_entry *ca = a[i], *cb = b[i];
+		if (ca == cb)
+			continue;
+		if (ce_stage(ca) || ce_stage(cb) ||
+		    ca->ce_mode != cb->ce_mode ||
+		    hashcmp(ca->sha1, cb->sha1) ||
+		    ce_namelen(ca) != ce_namelen(cb) ||
+		    memcmp(ca->name, cb->name, ce_namelen(ca)))
+			return 0;
+	}
+	return 1;
+}
+
+static void carry_over(struct cache_tree *it, struct index_state *from,
+		       struct index_state *to, struct strbuf *path)
+{
+	int i, len = path->len;
+
+	if (0 <= it->entry_count) {
+		int from_pos, to_pos, from_end, to_end;
+
+		from_pos = dir_range(from, path, &from_end);
+		to_pos = dir_range(to, path, &to_end);
+		if (from_end - from_pos == it->entry_count &&
+		    to_end - to_pos == it->entry_count &&
+		    same_entries(from->cache + from_pos, to->cache + to_pos,
+				 it->entry_count))
+			return;
+		it->entry_count = -1;
+	}
+	for (i = 0; i < it->subtree_nr; i++) {
+		struct cache_tree_sub *sub = it->down[i];
+		if (!sub->cache_tree)
+			continue;
+		strbuf_add(path, sub->name, sub->namelen);
+		strbuf_addch(path, '/');
+		carry_over(sub->cache_tree, from, to, path);
+		strbuf_setlen(path, len);
+	}
+}
+
+/*
+ * Give "to" the cache tree of "from", keeping only the parts that
+ * describe directories whose entries are the same in both indexes;
+ * the rest is invalidated.  This lets a command that builds a new
+ * index out of an old one (e.g. unpack_trees()) keep the trees it
+ * did not touch, without having to invalidate every path it did.
+ */
+void cache_tree_move(struct index_state *to, struct index_state *from)
+{
+	struct cache_tree *it = from->cache_tree;
+	struct strbuf path;
+
+	from->cache_tree = NULL;
+	cache_tree_free(&to->cache_tree);
+	if (!it)
+		return;
+	strbuf_init(&path, PATH_MAX);
+	carry_over(it, from, to, &path);
+	strbuf_release(&path);
+	to->cache_tree = it;
+}
+
+static int fill_one(struct cache_tree *it, const unsigned char *sha1,
+		    struct index_state *istate, struct strbuf *path,
+		    int *start_p, int *end_p)
+{
+	struct tree_desc desc;
+	struct name_entry entry;
+	enum object_type type;
+	unsigned long size;
+	void *buf;
+	int i, pos, end, match, len = path->len;
+
+	pos = *start_p = dir_range(istate, path, end_p);
+	end = *end_p;
+	if (0 <= it->entry_count)
+		return !hashcmp(it->sha1, sha1);
+
+	buf = read_sha1_file(sha1, &type, &size);
+	if (!buf)
+		return 0;
+	if (type != OBJ_TREE) {
+		free(buf);
+		return 0;
+	}
+
+	for (i = 0; i < it->subtree_nr; i++)
+		it->down[i]->used = 0;
+
+	match = 1;
+	init_tree_desc(&desc, buf, size);
+	while (tree_entry(&desc, &entry)) {
+		int namelen = tree_entry_len(entry.path, entry.sha1);
+		struct cache_entry *ce;
+
+		if (S_ISDIR(entry.mode)) {
+			struct cache_tree_sub *sub;
+			int sub_start, sub_end;
+
+			sub = find_subtree(it, entry.path, namelen, 1);
+			if (!sub->cache_tree)
+				sub->cache_tree = cache_tree();
+			sub->used = 1;
+			strbuf_add(path, entry.path, namelen);
+			strbuf_addch(path, '/');
+			if (fill_one(sub->cache_tree, entry.sha1, istate, path,
+				     &sub_start, &sub_end) && sub_start == pos)
+				pos = sub_end;
+			else
+				match = 0;
+			strbuf_setlen(path, len);
+			continue;
+		}
+		if (!match)
+			continue; /* just salvaging the subtrees */
+		if (pos >= end) {
+			match = 0;
+			continue;
+		}
+		ce = istate->cache[pos++];
+		if (ce_stage(ce) || ce->ce_mode != create_ce_mode(entry.mode) ||
+		    hashcmp(ce->sha1, entry.sha1) ||
+		    ce_namelen(ce) != len + namelen ||
+		    memcmp(ce->name + len, entry.path, namelen))
+			match = 0;
+	}
+	free(buf);
+
+	if (!match || pos != end)
+		return 0;
+	discard_unused_subtrees(it);
+	it->entry_count = end - *start_p;
+	hashcpy(it->sha1, sha1);
+	return 1;
+}
+
+/*
+ * Validate the invalid parts of the cache tree of "istate" from the
+ * tree object "sha1", wherever the index entries are exactly what
+ * that tree records.  Only the trees for invalid directories are
+ * read, so this is cheap after a command that changed few paths.
+ */
+void cache_tree_fill_from_tree(struct index_state *istate, const unsigned char *sha1)
+{
+	struct strbuf path;
+	int start, end;
+
+	if (!istate->cache_tree)
+		istate->cache_tree = cache_tree();
+	strbuf_init(&path, PATH_MAX);
+	fill_one(istate->cache_tree, sha1, istate, &path, &start, &end);
+	strbuf_release(&path);
+}
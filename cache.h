@@ -224,6 +224,7 @@ struct index_state {
 	void *alloc;
 	unsigned name_hash_initialized : 1;
 	struct hash_table name_hash;
+	struct hash_table dir_hash;
 };
 
 extern struct index_state the_index;
@@ -239,10 +240,8 @@ extern void add_name_hash(struct index_state *istate, struct cache_entry *ce);
  * hash bucket empty (common). So it's much better to just mark
  * it.
  */
-static inline void remove_name_hash(struct cache_entry *ce)
-{
-	ce->ce_flags |= CE_UNHASHED;
-}
+extern void remove_name_hash(struct index_state *istate, struct cache_entry *ce);
+extern void free_name_hash(struct index_state *istate);
 
 
 #ifndef NO_THE_INDEX_COMPATIBILITY_MACROS
@@ -357,6 +356,8 @@ extern int discard_index(struct index_state *);
 extern int unmerged_index(const struct index_state *);
 extern int verify_path(const char *path);
 extern struct cache_entry *index_name_exists(struct index_state *istate, const char *name, int namelen, int igncase);
+/* Only with core.ignorecase: is anything in that directory (named without trailing slash)? */
+extern int index_dir_exists(struct index_state *istate, const char *name, int namelen);
 extern int index_name_pos(const struct index_state *, const char *name, int namelen);
 #define ADD_CACHE_OK_TO_ADD 1		/* Ok to add */
 #define ADD_CACHE_OK_TO_REPLACE 2	/* Ok to replace file/directory */
@@ -608,6 +609,15 @@ struct checkout {
 extern int checkout_entry(struct cache_entry *ce, const struct checkout *state, char *topath);
 extern int has_symlink_leading_path(int len, const char *name);
 
+/* symlinks.c: per-operation cache of leading directories known to exist */
+#define DIR_CACHE_LSTAT	01	/* a real directory, not a symlink */
+#define DIR_CACHE_STAT	02	/* a directory, possibly via a symlink */
+extern void dir_cache_begin(void);
+extern void dir_cache_end(void);
+extern void dir_cache_invalidate(void);
+extern int dir_cache_has(const char *name, int len, unsigned flags);
+extern void dir_cache_add(const char *name, int len, unsigned flags);
+
 extern struct alternate_object_database {
 	struct alternate_object_database *next;
 	char *name;
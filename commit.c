@@ -203,6 +203,13 @@ struct commit_graft *lookup_commit_graft(const unsigned char *sha1)
 	return commit_graft[pos];
 }
 
+/* Whether any grafts or shallow commits change the history we see */
+int has_commit_grafts(void)
+{
+	prepare_commit_graft();
+	return commit_graft_nr > 0;
+}
+
 int write_shallow_commits(int fd, int use_pack_protocol)
 {
 	int i, count = 0;
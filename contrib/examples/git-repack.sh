@@ -110,6 +110,10 @@ for name in $names ; do
 	done &&
 	mv -f "$PACKTMP-$name.pack" "$PACKDIR/pack-$name.pack" &&
 	mv -f "$PACKTMP-$name.idx"  "$PACKDIR/pack-$name.idx" &&
+	if test -f "$PACKTMP-$name.hints"
+	then
+		mv -f "$PACKTMP-$name.hints" "$PACKDIR/pack-$name.hints"
+	fi &&
 	test -f "$PACKDIR/pack-$name.pack" &&
 	test -f "$PACKDIR/pack-$name.idx" || {
 		echo >&2 "Couldn't replace the existing pack with updated one."
@@ -131,7 +135,7 @@ then
 		  do
 			case " $fullbases " in
 			*" $e "*) ;;
-			*)	rm -f "$e.pack" "$e.idx" "$e.keep" ;;
+			*)	rm -f "$e.pack" "$e.idx" "$e.keep" "$e.hints" ;;
 			esac
 		  done
 		)
@@ -1,6 +1,8 @@
 #include "cache.h"
 #include "attr.h"
 #include "run-command.h"
+#include "pkt-line.h"
+#include "sideband.h"
 
 /*
  * convert.c - convert a file when checking it out and checking it in.
@@ -24,13 +26,10 @@ struct text_stat {
 	unsigned printable, nonprintable;
 };
 
-static void gather_stats(const char *buf, unsigned long size, struct text_stat *stats)
+static void gather_stats_scalar(const char *buf, unsigned long i,
+				unsigned long size, struct text_stat *stats)
 {
-	unsigned long i;
-
-	memset(stats, 0, sizeof(*stats));
-
-	for (i = 0; i < size; i++) {
+	for (; i < size; i++) {
 		unsigned char c = buf[i];
 		if (c == '\r') {
 			stats->cr++;
@@ -63,6 +62,77 @@ static void gather_stats(const char *buf, unsigned long size, struct text_stat *
 	}
 }
 
+#if defined(__GNUC__) && defined(__SSE2__)
+#include <emmintrin.h>
+
+/*
+ * Classify 16 bytes at a time.  Everything that is not CR, LF or
+ * nonprintable is printable, so only the former need counting.
+ */
+static unsigned long gather_stats_sse2(const char *buf, unsigned long size,
+				       struct text_stat *stats)
+{
+	const __m128i v_cr = _mm_set1_epi8('\r');
+	const __m128i v_lf = _mm_set1_epi8('\n');
+	const __m128i v_nul = _mm_setzero_si128();
+	const __m128i v_del = _mm_set1_epi8(127);
+	const __m128i v_ctl = _mm_set1_epi8(31);
+	const __m128i v_bs = _mm_set1_epi8('\b');
+	const __m128i v_ht = _mm_set1_epi8('\t');
+	const __m128i v_ff = _mm_set1_epi8('\014');
+	const __m128i v_esc = _mm_set1_epi8('\033');
+	unsigned long i;
+	unsigned nonprintable = 0;
+
+	for (i = 0; i + 16 <= size; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+		__m128i cr = _mm_cmpeq_epi8(v, v_cr);
+		__m128i lf = _mm_cmpeq_epi8(v, v_lf);
+		__m128i ctl = _mm_cmpeq_epi8(_mm_min_epu8(v, v_ctl), v);
+		__m128i ok = _mm_or_si128(_mm_or_si128(cr, lf),
+			     _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, v_bs),
+						       _mm_cmpeq_epi8(v, v_ht)),
+					  _mm_or_si128(_mm_cmpeq_epi8(v, v_ff),
+						       _mm_cmpeq_epi8(v, v_esc))));
+		__m128i del = _mm_cmpeq_epi8(v, v_del);
+		unsigned cr_mask, lf_mask;
+
+		/* CR and LF are control characters, too */
+		if (!_mm_movemask_epi8(_mm_or_si128(ctl, del)))
+			continue; /* plain text, the common case */
+
+		cr_mask = _mm_movemask_epi8(cr);
+		lf_mask = _mm_movemask_epi8(lf);
+		nonprintable += __builtin_popcount(
+			_mm_movemask_epi8(_mm_or_si128(_mm_andnot_si128(ok, ctl),
+						       del)));
+		stats->nul += __builtin_popcount(
+			_mm_movemask_epi8(_mm_cmpeq_epi8(v, v_nul)));
+		stats->cr += __builtin_popcount(cr_mask);
+		stats->lf += __builtin_popcount(lf_mask);
+		if (i + 16 < size && buf[i + 16] == '\n')
+			lf_mask |= 1u << 16;
+		stats->crlf += __builtin_popcount(cr_mask & (lf_mask >> 1));
+	}
+	stats->nonprintable += nonprintable;
+	stats->printable += i - stats->cr - stats->lf - nonprintable;
+	return i;
+}
+#else
+static unsigned long gather_stats_sse2(const char *buf, unsigned long size,
+				       struct text_stat *stats)
+{
+	return 0;
+}
+#endif
+
+static void gather_stats(const char *buf, unsigned long size, struct text_stat *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	gather_stats_scalar(buf, gather_stats_sse2(buf, size, stats),
+			    size, stats);
+}
+
 /*
  * The same heuristics as diff.c::mmfile_is_binary()
  */
@@ -125,6 +195,14 @@ static int crlf_to_git(const char *path, const char *src, size_t len,
 	if ((action == CRLF_BINARY) || !auto_crlf || !len)
 		return 0;
 
+	/*
+	 * Without a CR there is nothing to strip, and unless we are
+	 * asked to check for irreversible conversion we do not need
+	 * the statistics at all.
+	 */
+	if (!checksafe && !memchr(src, '\r', len))
+		return 0;
+
 	gather_stats(src, len, &stats);
 
 	if (action == CRLF_GUESS) {
@@ -153,23 +231,27 @@ static int crlf_to_git(const char *path, const char *src, size_t len,
 	if (strbuf_avail(buf) + buf->len < len)
 		strbuf_grow(buf, len - buf->len);
 	dst = buf->buf;
-	if (action == CRLF_GUESS) {
+	for (;;) {
+		/* copy whole runs up to the next CR at once */
+		const char *cr = memchr(src, '\r', len);
+		size_t run = cr ? cr - src : len;
+
+		memmove(dst, src, run);
+		dst += run;
+		src += run;
+		len -= run;
+		if (!len)
+			break;
+
 		/*
 		 * If we guessed, we already know we rejected a file with
 		 * lone CR, and we can strip a CR without looking at what
 		 * follow it.
 		 */
-		do {
-			unsigned char c = *src++;
-			if (c != '\r')
-				*dst++ = c;
-		} while (--len);
-	} else {
-		do {
-			unsigned char c = *src++;
-			if (! (c == '\r' && (1 < len && *src == '\n')))
-				*dst++ = c;
-		} while (--len);
+		if (action != CRLF_GUESS && !(1 < len && src[1] == '\n'))
+			*dst++ = *src;
+		src++;
+		len--;
 	}
 	strbuf_setlen(buf, dst - buf->buf);
 	return 1;
@@ -178,22 +260,19 @@ static int crlf_to_git(const char *path, const char *src, size_t len,
 static int crlf_to_worktree(const char *path, const char *src, size_t len,
                             struct strbuf *buf, int action)
 {
-	char *to_free = NULL;
+	char *to_free = NULL, *dst;
 	struct text_stat stats;
 
 	if ((action == CRLF_BINARY) || (action == CRLF_INPUT) ||
 	    auto_crlf <= 0)
 		return 0;
 
-	if (!len)
+	/* No LF? Nothing to convert, regardless. */
+	if (!len || !memchr(src, '\n', len))
 		return 0;
 
 	gather_stats(src, len, &stats);
 
-	/* No LF? Nothing to convert, regardless. */
-	if (!stats.lf)
-		return 0;
-
 	/* Was it already in CRLF format? */
 	if (stats.lf == stats.crlf)
 		return 0;
@@ -212,20 +291,21 @@ static int crlf_to_worktree(const char *path, const char *src, size_t len,
 		to_free = strbuf_detach(buf, NULL);
 
 	strbuf_grow(buf, len + stats.lf - stats.crlf);
+	dst = buf->buf + buf->len;
 	for (;;) {
 		const char *nl = memchr(src, '\n', len);
 		if (!nl)
 			break;
-		if (nl > src && nl[-1] == '\r') {
-			strbuf_add(buf, src, nl + 1 - src);
-		} else {
-			strbuf_add(buf, src, nl - src);
-			strbuf_addstr(buf, "\r\n");
-		}
+		memcpy(dst, src, nl - src);
+		dst += nl - src;
+		if (nl == src || nl[-1] != '\r')
+			*dst++ = '\r';
+		*dst++ = '\n';
 		len -= nl + 1 - src;
 		src  = nl + 1;
 	}
-	strbuf_add(buf, src, len);
+	memcpy(dst, src, len);
+	strbuf_setlen(buf, dst + len - buf->buf);
 
 	free(to_free);
 	return 1;
@@ -267,8 +347,8 @@ static int filter_buffer(int fd, void *data)
 	return (write_err || status);
 }
 
-static int apply_filter(const char *path, const char *src, size_t len,
-                        struct strbuf *dst, const char *cmd)
+static int apply_single_file_filter(const char *path, const char *src, size_t len,
+                                   struct strbuf *dst, const char *cmd)
 {
 	/*
 	 * Create a pipeline to have the command filter the buffer's
@@ -316,13 +396,281 @@ static int apply_filter(const char *path, const char *src, size_t len,
 	return ret;
 }
 
+/*
+ * A long-running filter process is started once per git command and
+ * fed one blob after another over pkt-line framing on its stdin and
+ * stdout, instead of spawning "sh -c <cmd>" for every path:
+ *
+ *	git> git-filter-client, version=2, flush
+ *	filter> git-filter-server, version=2, flush
+ *	git> capability=clean, capability=smudge, flush
+ *	filter> capability=<supported>..., flush
+ *
+ * and then for each path
+ *
+ *	git> command=<clean|smudge>, pathname=<path>, flush,
+ *	     content..., flush
+ *	filter> status=<success|error|abort>, flush,
+ *	        content..., flush, [status=<...>], flush
+ *
+ * A filter that answers "abort" is not asked to perform that
+ * capability again.
+ */
+#define CAP_CLEAN	(1u<<0)
+#define CAP_SMUDGE	(1u<<1)
+
+static struct filter_process {
+	struct filter_process *next;
+	const char *cmd;
+	struct child_process process;
+	const char *argv[4];
+	unsigned supported;
+	unsigned broken:1;
+} *filter_processes;
+
+static pid_t filter_process_owner;
+
+static void stop_filter_process(struct filter_process *fp)
+{
+	if (fp->broken || !fp->process.pid)
+		return;
+	fp->broken = 1;
+	close(fp->process.in);
+	close(fp->process.out);
+	finish_command(&fp->process);
+}
+
+static void stop_all_filter_processes(void)
+{
+	struct filter_process *fp;
+
+	/* start_async() children exit() through here too */
+	if (getpid() != filter_process_owner)
+		return;
+	for (fp = filter_processes; fp; fp = fp->next)
+		stop_filter_process(fp);
+}
+
+static int filter_packet_line(int fd, const char *fmt, const char *arg)
+{
+	struct strbuf sb;
+	int ret;
+
+	strbuf_init(&sb, 0);
+	strbuf_addf(&sb, fmt, arg);
+	ret = packet_write_gently(fd, sb.buf, sb.len);
+	strbuf_release(&sb);
+	return ret;
+}
+
+/*
+ * Read one packet into buf; returns its length without a trailing
+ * LF, 0 for a flush packet and -1 on error.
+ */
+static int filter_read_line(int fd, char *buf, unsigned size)
+{
+	int len = packet_read_gently(fd, buf, size);
+	if (len > 0 && buf[len - 1] == '\n')
+		buf[--len] = '\0';
+	return len;
+}
+
+static int filter_handshake(struct filter_process *fp)
+{
+	static char buf[LARGE_PACKET_MAX];
+	int in = fp->process.in, out = fp->process.out;
+	int len;
+
+	if (filter_packet_line(in, "%s\n", "git-filter-client") ||
+	    filter_packet_line(in, "%s\n", "version=2") ||
+	    packet_flush_gently(in))
+		return error("cannot send handshake to filter process %s", fp->cmd);
+
+	if (filter_read_line(out, buf, sizeof(buf)) <= 0 ||
+	    strcmp(buf, "git-filter-server"))
+		return error("unexpected welcome from filter process %s", fp->cmd);
+	if (filter_read_line(out, buf, sizeof(buf)) <= 0 ||
+	    strcmp(buf, "version=2"))
+		return error("unsupported protocol version from filter process %s",
+			     fp->cmd);
+	if (filter_read_line(out, buf, sizeof(buf)))
+		return error("unexpected version line from filter process %s",
+			     fp->cmd);
+
+	if (filter_packet_line(in, "%s\n", "capability=clean") ||
+	    filter_packet_line(in, "%s\n", "capability=smudge") ||
+	    packet_flush_gently(in))
+		return error("cannot send capabilities to filter process %s",
+			     fp->cmd);
+	while ((len = filter_read_line(out, buf, sizeof(buf))) > 0) {
+		if (!strcmp(buf, "capability=clean"))
+			fp->supported |= CAP_CLEAN;
+		else if (!strcmp(buf, "capability=smudge"))
+			fp->supported |= CAP_SMUDGE;
+		/* unknown capabilities are ignored */
+	}
+	if (len < 0)
+		return error("cannot read capabilities from filter process %s",
+			     fp->cmd);
+	return 0;
+}
+
+static struct filter_process *get_filter_process(const char *cmd)
+{
+	struct filter_process *fp;
+	void (*old_sigpipe)(int);
+	int ret;
+
+	for (fp = filter_processes; fp; fp = fp->next)
+		if (!strcmp(fp->cmd, cmd))
+			return fp->broken ? NULL : fp;
+
+	fp = xcalloc(1, sizeof(*fp));
+	fp->cmd = cmd;
+	fp->next = filter_processes;
+	filter_processes = fp;
+	if (!filter_process_owner) {
+		filter_process_owner = getpid();
+		atexit(stop_all_filter_processes);
+	}
+
+	fp->argv[0] = "sh";
+	fp->argv[1] = "-c";
+	fp->argv[2] = cmd;
+	fp->process.argv = fp->argv;
+	fp->process.in = -1;
+	fp->process.out = -1;
+
+	fflush(NULL);
+	if (start_command(&fp->process)) {
+		error("cannot fork to run filter process %s", cmd);
+		fp->broken = 1;
+		return NULL;
+	}
+	/* later children must not hold our end of the pipes open */
+	fcntl(fp->process.in, F_SETFD, FD_CLOEXEC);
+	fcntl(fp->process.out, F_SETFD, FD_CLOEXEC);
+
+	old_sigpipe = signal(SIGPIPE, SIG_IGN);
+	ret = filter_handshake(fp);
+	signal(SIGPIPE, old_sigpipe);
+	if (ret) {
+		stop_filter_process(fp);
+		return NULL;
+	}
+	return fp;
+}
+
+/*
+ * Returns 1 if the filter converted the contents into dst, 0 if it
+ * reported an error or asked not to be bothered again, and -1 if the
+ * process is unusable (the caller may then fall back).
+ */
+static int filter_process_one(struct filter_process *fp, const char *path,
+			      const char *src, size_t len,
+			      struct strbuf *dst, unsigned wanted)
+{
+	static char buf[LARGE_PACKET_MAX];
+	int in = fp->process.in, out = fp->process.out;
+	const char *command = (wanted == CAP_CLEAN) ? "clean" : "smudge";
+	struct strbuf nbuf;
+	int n, status_ok = 0;
+
+	if (filter_packet_line(in, "command=%s\n", command) ||
+	    filter_packet_line(in, "pathname=%s\n", path) ||
+	    packet_flush_gently(in) ||
+	    packet_write_data_gently(in, src, len) ||
+	    packet_flush_gently(in))
+		return -1;
+
+	while ((n = filter_read_line(out, buf, sizeof(buf))) > 0) {
+		if (!strcmp(buf, "status=success"))
+			status_ok = 1;
+		else if (!strcmp(buf, "status=abort"))
+			fp->supported &= ~wanted;
+	}
+	if (n < 0)
+		return -1;
+	if (!status_ok) {
+		if (fp->supported & wanted)
+			error("filter process %s failed on %s", fp->cmd, path);
+		return 0;
+	}
+
+	strbuf_init(&nbuf, len);
+	while ((n = packet_read_gently(out, buf, sizeof(buf))) > 0)
+		strbuf_add(&nbuf, buf, n);
+	if (n < 0) {
+		strbuf_release(&nbuf);
+		return -1;
+	}
+
+	/* the filter may still change its mind after sending the content */
+	while ((n = filter_read_line(out, buf, sizeof(buf))) > 0) {
+		if (!strcmp(buf, "status=success"))
+			status_ok = 1;
+		else if (!strcmp(buf, "status=error"))
+			status_ok = 0;
+		else if (!strcmp(buf, "status=abort")) {
+			status_ok = 0;
+			fp->supported &= ~wanted;
+		}
+	}
+	if (n < 0) {
+		strbuf_release(&nbuf);
+		return -1;
+	}
+	if (!status_ok) {
+		if (fp->supported & wanted)
+			error("filter process %s failed on %s", fp->cmd, path);
+		strbuf_release(&nbuf);
+		return 0;
+	}
+
+	strbuf_swap(dst, &nbuf);
+	strbuf_release(&nbuf);
+	return 1;
+}
+
 static struct convert_driver {
 	const char *name;
 	struct convert_driver *next;
 	char *smudge;
 	char *clean;
+	char *process;
 } *user_convert, **user_convert_tail;
 
+static int apply_filter(const char *path, const char *src, size_t len,
+                        struct strbuf *dst, struct convert_driver *drv,
+                        unsigned wanted)
+{
+	const char *cmd;
+
+	if (!drv)
+		return 0;
+
+	if (drv->process) {
+		struct filter_process *fp = get_filter_process(drv->process);
+		if (fp && (fp->supported & wanted)) {
+			void (*old_sigpipe)(int);
+			int ret;
+
+			old_sigpipe = signal(SIGPIPE, SIG_IGN);
+			ret = filter_process_one(fp, path, src, len, dst, wanted);
+			signal(SIGPIPE, old_sigpipe);
+			if (ret >= 0)
+				return ret;
+			error("filter process %s died; not using it anymore",
+			      fp->cmd);
+			stop_filter_process(fp);
+		}
+	}
+
+	/* old-style filters, or a process that does not do this for us */
+	cmd = (wanted == CAP_CLEAN) ? drv->clean : drv->smudge;
+	return apply_single_file_filter(path, src, len, dst, cmd);
+}
+
 static int read_convert_config(const char *var, const char *value)
 {
 	const char *ep, *name;
@@ -371,6 +719,17 @@ static int read_convert_config(const char *var, const char *value)
 		drv->clean = strdup(value);
 		return 0;
 	}
+
+	/*
+	 * filter.<name>.process specifies a long-running filter
+	 * process that handles many paths over a single pipe.
+	 */
+	if (!strcmp("process", ep)) {
+		if (!value)
+			return config_error_nonbool(var);
+		drv->process = strdup(value);
+		return 0;
+	}
 	return 0;
 }
 
@@ -576,19 +935,16 @@ int convert_to_git(const char *path, const char *src, size_t len,
 	struct git_attr_check check[3];
 	int crlf = CRLF_GUESS;
 	int ident = 0, ret = 0;
-	char *filter = NULL;
+	struct convert_driver *drv = NULL;
 
 	setup_convert_check(check);
 	if (!git_checkattr(path, ARRAY_SIZE(check), check)) {
-		struct convert_driver *drv;
 		crlf = git_path_check_crlf(path, check + 0);
 		ident = git_path_check_ident(path, check + 1);
 		drv = git_path_check_convert(path, check + 2);
-		if (drv && drv->clean)
-			filter = drv->clean;
 	}
 
-	ret |= apply_filter(path, src, len, dst, filter);
+	ret |= apply_filter(path, src, len, dst, drv, CAP_CLEAN);
 	if (ret) {
 		src = dst->buf;
 		len = dst->len;
@@ -606,16 +962,13 @@ int convert_to_working_tree(const char *path, const char *src, size_t len, struc
 	struct git_attr_check check[3];
 	int crlf = CRLF_GUESS;
 	int ident = 0, ret = 0;
-	char *filter = NULL;
+	struct convert_driver *drv = NULL;
 
 	setup_convert_check(check);
 	if (!git_checkattr(path, ARRAY_SIZE(check), check)) {
-		struct convert_driver *drv;
 		crlf = git_path_check_crlf(path, check + 0);
 		ident = git_path_check_ident(path, check + 1);
 		drv = git_path_check_convert(path, check + 2);
-		if (drv && drv->smudge)
-			filter = drv->smudge;
 	}
 
 	ret |= ident_to_worktree(path, src, len, dst, ident);
@@ -628,5 +981,5 @@ int convert_to_working_tree(const char *path, const char *src, size_t len, struc
 		src = dst->buf;
 		len = dst->len;
 	}
-	return ret | apply_filter(path, src, len, dst, filter);
+	return ret | apply_filter(path, src, len, dst, drv, CAP_SMUDGE);
 }
@@ -112,33 +112,76 @@ static const unsigned int U[256] = {
 	0x133eb0ac, 0x6d8b90a1, 0x450d4467, 0x3bb8646a
 };
 
+/*
+ * The index is one block: the header, then for each hash bucket the
+ * offset of its first entry (plus one for the end of the last bucket),
+ * then the entries of all buckets, bucket after bucket and in the
+ * order of the reference buffer within each bucket.
+ */
 struct index_entry {
-	const unsigned char *ptr;
+	unsigned int offset;	/* of the last byte of the block in src_buf */
 	unsigned int val;
 };
 
-struct unpacked_index_entry {
-	struct index_entry entry;
-	struct unpacked_index_entry *next;
-};
-
 struct delta_index {
 	unsigned long memsize;
 	const void *src_buf;
 	unsigned long src_size;
 	unsigned int hash_mask;
-	struct index_entry *hash[FLEX_ARRAY];
+	struct index_entry *entries;
+	unsigned int hash[FLEX_ARRAY];
 };
 
+/*
+ * The fingerprint of the RABIN_WINDOW bytes after "data".  The first
+ * three bytes cannot reach the top of the polynomial and need no
+ * table lookup.
+ */
+static inline unsigned int rabin_block(const unsigned char *data)
+{
+	unsigned int i, val;
+
+	val = (data[1] << 16) | (data[2] << 8) | data[3];
+	for (i = 4; i <= RABIN_WINDOW; i++)
+		val = ((val << 8) | data[i]) ^ T[val >> RABIN_SHIFT];
+	return val;
+}
+
+/*
+ * The same for four consecutive blocks at once.  Each fingerprint
+ * depends on its previous step only, so interleaving them keeps
+ * several table lookups in flight.
+ */
+static inline void rabin_blocks(const unsigned char *data, unsigned int *val)
+{
+	const unsigned char *d0 = data, *d1 = data + RABIN_WINDOW,
+		*d2 = data + 2 * RABIN_WINDOW, *d3 = data + 3 * RABIN_WINDOW;
+	unsigned int i, v0, v1, v2, v3;
+
+	v0 = (d0[1] << 16) | (d0[2] << 8) | d0[3];
+	v1 = (d1[1] << 16) | (d1[2] << 8) | d1[3];
+	v2 = (d2[1] << 16) | (d2[2] << 8) | d2[3];
+	v3 = (d3[1] << 16) | (d3[2] << 8) | d3[3];
+	for (i = 4; i <= RABIN_WINDOW; i++) {
+		v0 = ((v0 << 8) | d0[i]) ^ T[v0 >> RABIN_SHIFT];
+		v1 = ((v1 << 8) | d1[i]) ^ T[v1 >> RABIN_SHIFT];
+		v2 = ((v2 << 8) | d2[i]) ^ T[v2 >> RABIN_SHIFT];
+		v3 = ((v3 << 8) | d3[i]) ^ T[v3 >> RABIN_SHIFT];
+	}
+	val[0] = v0;
+	val[1] = v1;
+	val[2] = v2;
+	val[3] = v3;
+}
+
 struct delta_index * create_delta_index(const void *buf, unsigned long bufsize)
 {
-	unsigned int i, hsize, hmask, entries, prev_val, *hash_count;
-	const unsigned char *data, *buffer = buf;
-	struct delta_index *index;
-	struct unpacked_index_entry *entry, **hash;
-	struct index_entry *packed_entry, **packed_hash;
-	void *mem;
+	unsigned int i, j, hsize, hmask, entries, nr, prev_val, *hash;
+	const unsigned char *buffer = buf;
+	struct delta_index *index, *shrunk;
+	struct index_entry *entry, *found;
 	unsigned long memsize;
+	int culled = 0;
 
 	if (!buf || !bufsize)
 		return NULL;
@@ -152,48 +195,67 @@ struct delta_index * create_delta_index(const void *buf, unsigned long bufsize)
 	hsize = 1 << i;
 	hmask = hsize - 1;
 
-	/* allocate lookup index */
-	memsize = sizeof(*hash) * hsize +
-		  sizeof(*entry) * entries;
-	mem = malloc(memsize);
-	if (!mem)
-		return NULL;
-	hash = mem;
-	mem = hash + hsize;
-	entry = mem;
-
-	memset(hash, 0, hsize * sizeof(*hash));
-
-	/* allocate an array to count hash entries */
-	hash_count = calloc(hsize, sizeof(*hash_count));
-	if (!hash_count) {
-		free(hash);
+	/*
+	 * Allocate the index for all the blocks, and as much again to
+	 * collect them before sorting them into their buckets; we give
+	 * back what we do not use at the end.
+	 */
+	memsize = sizeof(*index)
+		+ sizeof(*hash) * (hsize+1)
+		+ sizeof(*entry) * entries * 2;
+	index = malloc(memsize);
+	if (!index)
 		return NULL;
-	}
+	hash = index->hash;
+	entry = (struct index_entry *)(hash + hsize + 1);
+	found = entry + entries;
+	memset(hash, 0, sizeof(*hash) * (hsize+1));
 
-	/* then populate the index */
+	/*
+	 * Fingerprint the blocks from the end of the buffer down, and
+	 * count how many go to each bucket.
+	 */
 	prev_val = ~0;
-	for (data = buffer + entries * RABIN_WINDOW - RABIN_WINDOW;
-	     data >= buffer;
-	     data -= RABIN_WINDOW) {
-		unsigned int val = 0;
-		for (i = 1; i <= RABIN_WINDOW; i++)
-			val = ((val << 8) | data[i]) ^ T[val >> RABIN_SHIFT];
-		if (val == prev_val) {
-			/* keep the lowest of consecutive identical blocks */
-			entry[-1].entry.ptr = data + RABIN_WINDOW;
-			--entries;
-		} else {
-			prev_val = val;
-			i = val & hmask;
-			entry->entry.ptr = data + RABIN_WINDOW;
-			entry->entry.val = val;
-			entry->next = hash[i];
-			hash[i] = entry++;
-			hash_count[i]++;
+	nr = 0;
+	i = entries;
+	while (i) {
+		unsigned int val[4], n = i < 4 ? 1 : 4;
+
+		i -= n;
+		if (n == 4)
+			rabin_blocks(buffer + i * RABIN_WINDOW, val);
+		else
+			val[0] = rabin_block(buffer + i * RABIN_WINDOW);
+		for (j = n; j--; ) {
+			unsigned int offset = (i + j) * RABIN_WINDOW + RABIN_WINDOW;
+			if (val[j] == prev_val) {
+				/* keep the lowest of consecutive identical blocks */
+				found[nr - 1].offset = offset;
+			} else {
+				prev_val = val[j];
+				found[nr].offset = offset;
+				found[nr].val = val[j];
+				nr++;
+				hash[val[j] & hmask]++;
+			}
 		}
 	}
 
+	/*
+	 * Turn the counts into where each bucket ends, and move the
+	 * blocks there from the last one down, so that each bucket
+	 * starts at its lowest block.
+	 */
+	for (i = 0, j = 0; i < hsize; i++) {
+		if (hash[i] > HASH_LIMIT)
+			culled = 1;
+		j += hash[i];
+		hash[i] = j;
+	}
+	hash[hsize] = nr;
+	for (i = 0; i < nr; i++)
+		entry[--hash[found[i].val & hmask]] = found[i];
+
 	/*
 	 * Determine a limit on the number of entries in the same hash
 	 * bucket.  This guards us against pathological data sets causing
@@ -204,86 +266,56 @@ struct delta_index * create_delta_index(const void *buf, unsigned long bufsize)
 	 * Make sure none of the hash buckets has more entries than
 	 * we're willing to test.  Otherwise we cull the entry list
 	 * uniformly to still preserve a good repartition across
-	 * the reference buffer.
+	 * the reference buffer, and close the gaps this leaves.
 	 */
-	for (i = 0; i < hsize; i++) {
-		int acc;
-
-		if (hash_count[i] <= HASH_LIMIT)
-			continue;
-
-		/* We leave exactly HASH_LIMIT entries in the bucket */
-		entries -= hash_count[i] - HASH_LIMIT;
-
-		entry = hash[i];
-		acc = 0;
-
-		/*
-		 * Assume that this loop is gone through exactly
-		 * HASH_LIMIT times and is entered and left with
-		 * acc==0.  So the first statement in the loop
-		 * contributes (hash_count[i]-HASH_LIMIT)*HASH_LIMIT
-		 * to the accumulator, and the inner loop consequently
-		 * is run (hash_count[i]-HASH_LIMIT) times, removing
-		 * one element from the list each time.  Since acc
-		 * balances out to 0 at the final run, the inner loop
-		 * body can't be left with entry==NULL.  So we indeed
-		 * encounter entry==NULL in the outer loop only.
-		 */
-		do {
-			acc += hash_count[i] - HASH_LIMIT;
-			if (acc > 0) {
-				struct unpacked_index_entry *keep = entry;
-				do {
-					entry = entry->next;
+	if (culled) {
+		unsigned int dst = 0, src = hash[0];
+
+		for (i = 0; i < hsize; i++) {
+			unsigned int count = hash[i + 1] - src;
+			int acc = 0;
+
+			hash[i] = dst;
+			if (count <= HASH_LIMIT) {
+				memmove(entry + dst, entry + src,
+					count * sizeof(*entry));
+				dst += count;
+				src += count;
+				continue;
+			}
+
+			/*
+			 * We leave exactly HASH_LIMIT entries in the
+			 * bucket: each one we keep is followed by as
+			 * many dropped ones as it takes to bring acc
+			 * back down, and acc balances out to 0 at the
+			 * last one we keep.
+			 */
+			for (j = 0; j < count; j++) {
+				entry[dst++] = entry[src + j];
+				acc += count - HASH_LIMIT;
+				while (acc > 0) {
+					j++;
 					acc -= HASH_LIMIT;
-				} while (acc > 0);
-				keep->next = entry->next;
+				}
 			}
-			entry = entry->next;
-		} while (entry);
+			src += count;
+		}
+		hash[hsize] = dst;
+		nr = dst;
 	}
-	free(hash_count);
 
-	/*
-	 * Now create the packed index in array form
-	 * rather than linked lists.
-	 */
 	memsize = sizeof(*index)
-		+ sizeof(*packed_hash) * (hsize+1)
-		+ sizeof(*packed_entry) * entries;
-	mem = malloc(memsize);
-	if (!mem) {
-		free(hash);
-		return NULL;
-	}
-
-	index = mem;
+		+ sizeof(*hash) * (hsize+1)
+		+ sizeof(*entry) * nr;
+	shrunk = realloc(index, memsize);
+	if (shrunk)
+		index = shrunk;
 	index->memsize = memsize;
 	index->src_buf = buf;
 	index->src_size = bufsize;
 	index->hash_mask = hmask;
-
-	mem = index->hash;
-	packed_hash = mem;
-	mem = packed_hash + (hsize+1);
-	packed_entry = mem;
-
-	for (i = 0; i < hsize; i++) {
-		/*
-		 * Coalesce all entries belonging to one linked list
-		 * into consecutive array entries.
-		 */
-		packed_hash[i] = packed_entry;
-		for (entry = hash[i]; entry; entry = entry->next)
-			*packed_entry++ = entry->entry;
-	}
-
-	/* Sentinel value to indicate the length of the last hash bucket */
-	packed_hash[hsize] = packed_entry;
-
-	assert(packed_entry - (struct index_entry *)mem == entries);
-	free(hash);
+	index->entries = (struct index_entry *)(index->hash + hsize + 1);
 
 	return index;
 }
@@ -301,6 +333,61 @@ unsigned long sizeof_delta_index(struct delta_index *index)
 		return 0;
 }
 
+/*
+ * While scanning the target a byte at a time, we fetch the hash bucket
+ * of the position PREFETCH_AHEAD bytes further, with a second rolling
+ * fingerprint, so that it is in the cache by the time we get there.
+ * Smaller indices stay in the cache anyway, and the second fingerprint
+ * would only cost us.
+ */
+#define PREFETCH_AHEAD 8
+#define PREFETCH_MIN_INDEX (8 * 1024 * 1024)
+
+#ifdef __GNUC__
+#define prefetch(addr) __builtin_prefetch(addr)
+#else
+#define prefetch(addr) ((void)(addr))
+#endif
+
+/*
+ * The fingerprint of the window PREFETCH_AHEAD bytes after the one
+ * ending before "data", if there is one.
+ */
+static inline unsigned int rabin_ahead(const unsigned char *data,
+				       const unsigned char *top)
+{
+	unsigned int val = 0;
+	int j;
+
+	if (data + PREFETCH_AHEAD < top)
+		for (j = PREFETCH_AHEAD - RABIN_WINDOW; j < PREFETCH_AHEAD; j++)
+			val = ((val << 8) | data[j]) ^ T[val >> RABIN_SHIFT];
+	return val;
+}
+
+/*
+ * How many of the first "size" bytes at "a" and "b" are the same,
+ * comparing a word at a time.
+ */
+static inline unsigned int match_length(const unsigned char *a,
+					const unsigned char *b,
+					unsigned int size)
+{
+	unsigned int len = 0;
+
+	while (size - len >= sizeof(unsigned long)) {
+		unsigned long x, y;
+		memcpy(&x, a + len, sizeof(x));
+		memcpy(&y, b + len, sizeof(y));
+		if (x != y)
+			break;
+		len += sizeof(x);
+	}
+	while (len < size && a[len] == b[len])
+		len++;
+	return len;
+}
+
 /*
  * The maximum size for any opcode sequence, including the initial header
  * plus Rabin window plus biggest copy.
@@ -312,8 +399,8 @@ create_delta(const struct delta_index *index,
 	     const void *trg_buf, unsigned long trg_size,
 	     unsigned long *delta_size, unsigned long max_size)
 {
-	unsigned int i, outpos, outsize, moff, msize, val;
-	int inscnt;
+	unsigned int i, outpos, outsize, moff, msize, val, ahead;
+	int inscnt, prefetching;
 	const unsigned char *ref_data, *ref_top, *data, *top;
 	unsigned char *out;
 
@@ -356,31 +443,39 @@ create_delta(const struct delta_index *index,
 		val = ((val << 8) | *data) ^ T[val >> RABIN_SHIFT];
 	}
 	inscnt = i;
+	prefetching = index->memsize >= PREFETCH_MIN_INDEX;
+	ahead = rabin_ahead(data, top);
 
 	moff = 0;
 	msize = 0;
 	while (data < top) {
 		if (msize < 4096) {
-			struct index_entry *entry;
+			const struct index_entry *entry, *end;
+			if (prefetching && data + PREFETCH_AHEAD < top) {
+				ahead ^= U[data[PREFETCH_AHEAD - RABIN_WINDOW]];
+				ahead = ((ahead << 8) | data[PREFETCH_AHEAD])
+					^ T[ahead >> RABIN_SHIFT];
+				prefetch(index->hash + (ahead & index->hash_mask));
+			}
 			val ^= U[data[-RABIN_WINDOW]];
 			val = ((val << 8) | *data) ^ T[val >> RABIN_SHIFT];
 			i = val & index->hash_mask;
-			for (entry = index->hash[i]; entry < index->hash[i+1]; entry++) {
-				const unsigned char *ref = entry->ptr;
-				const unsigned char *src = data;
+			entry = index->entries + index->hash[i];
+			end = index->entries + index->hash[i+1];
+			for (; entry < end; entry++) {
+				const unsigned char *ref = ref_data + entry->offset;
 				unsigned int ref_size = ref_top - ref;
 				if (entry->val != val)
 					continue;
-				if (ref_size > top - src)
-					ref_size = top - src;
+				if (ref_size > top - data)
+					ref_size = top - data;
 				if (ref_size <= msize)
 					break;
-				while (ref_size-- && *src++ == *ref)
-					ref++;
-				if (msize < ref - entry->ptr) {
+				ref_size = match_length(ref, data, ref_size);
+				if (msize < ref_size) {
 					/* this is our best match so far */
-					msize = ref - entry->ptr;
-					moff = entry->ptr - ref_data;
+					msize = ref_size;
+					moff = entry->offset;
 					if (msize >= 4096) /* good enough */
 						break;
 				}
@@ -451,6 +546,7 @@ create_delta(const struct delta_index *index,
 				for (j = -RABIN_WINDOW; j < 0; j++)
 					val = ((val << 8) | data[j])
 					      ^ T[val >> RABIN_SHIFT];
+				ahead = rabin_ahead(data, top);
 			}
 		}
 
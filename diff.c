@@ -20,6 +20,9 @@
 
 static int diff_detect_rename_default;
 static int diff_rename_limit_default = 200;
+static int diff_rename_prefilter_default;
+static int diff_rename_cache_default;
+static long diff_algorithm_default;
 int diff_use_color_default = -1;
 static const char *external_diff_cmd_cfg;
 int diff_auto_refresh_index = 1;
@@ -123,6 +126,15 @@ static int parse_funcname_pattern(const char *var, const char *ep, const char *v
 	return 0;
 }
 
+static long parse_diff_algorithm(const char *value)
+{
+	if (!strcasecmp(value, "myers") || !strcasecmp(value, "default"))
+		return 0;
+	if (!strcasecmp(value, "histogram"))
+		return XDF_HISTOGRAM_DIFF;
+	return -1;
+}
+
 /*
  * These are to give UI layer defaults.
  * The core-level commands such as git-diff-files should
@@ -135,6 +147,14 @@ int git_diff_ui_config(const char *var, const char *value)
 		diff_rename_limit_default = git_config_int(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "diff.renameprefilter")) {
+		diff_rename_prefilter_default = git_config_bool(var, value);
+		return 0;
+	}
+	if (!strcmp(var, "diff.renamecache")) {
+		diff_rename_cache_default = git_config_bool(var, value);
+		return 0;
+	}
 	if (!strcmp(var, "diff.color") || !strcmp(var, "color.diff")) {
 		diff_use_color_default = git_config_colorbool(var, value, -1);
 		return 0;
@@ -149,6 +169,14 @@ int git_diff_ui_config(const char *var, const char *value)
 			diff_detect_rename_default = DIFF_DETECT_RENAME;
 		return 0;
 	}
+	if (!strcmp(var, "diff.algorithm")) {
+		if (!value)
+			return config_error_nonbool(var);
+		diff_algorithm_default = parse_diff_algorithm(value);
+		if (diff_algorithm_default < 0)
+			die("unknown diff algorithm '%s' in %s", value, var);
+		return 0;
+	}
 	if (!strcmp(var, "diff.autorefreshindex")) {
 		diff_auto_refresh_index = git_config_bool(var, value);
 		return 0;
@@ -1313,6 +1341,21 @@ int diff_filespec_is_binary(struct diff_filespec *one)
 	return one->is_binary;
 }
 
+/*
+ * Whether the "diff" attribute of the path is set or unset, so that
+ * it, not the contents, decides if the file is binary.
+ */
+int diff_filespec_binary_by_attr(struct diff_filespec *one)
+{
+	struct git_attr_check attr_diff_check;
+
+	setup_diff_attr_check(&attr_diff_check);
+	if (git_checkattr(one->path, 1, &attr_diff_check))
+		return 0;
+	return ATTR_TRUE(attr_diff_check.value) ||
+		ATTR_FALSE(attr_diff_check.value);
+}
+
 static const char *funcname_pattern(const char *ident)
 {
 	struct funcname_pattern *pp;
@@ -2228,6 +2271,7 @@ void diff_setup(struct diff_options *options)
 	else
 		DIFF_OPT_CLR(options, COLOR_DIFF);
 	options->detect_rename = diff_detect_rename_default;
+	options->xdl_opts |= diff_algorithm_default;
 
 	options->a_prefix = "a/";
 	options->b_prefix = "b/";
@@ -2290,6 +2334,10 @@ int diff_setup_done(struct diff_options *options)
 
 	if (options->detect_rename && options->rename_limit < 0)
 		options->rename_limit = diff_rename_limit_default;
+	if (diff_rename_prefilter_default)
+		DIFF_OPT_SET(options, RENAME_PREFILTER);
+	if (diff_rename_cache_default)
+		DIFF_OPT_SET(options, RENAME_CACHE);
 	if (options->setup & DIFF_SETUP_USE_CACHE) {
 		if (!active_cache)
 			/* read-cache does not die even when it fails
@@ -2466,6 +2514,15 @@ int diff_opt_parse(struct diff_options *options, const char **av, int ac)
 		options->xdl_opts |= XDF_IGNORE_WHITESPACE_CHANGE;
 	else if (!strcmp(arg, "--ignore-space-at-eol"))
 		options->xdl_opts |= XDF_IGNORE_WHITESPACE_AT_EOL;
+	else if (!strcmp(arg, "--histogram"))
+		options->xdl_opts |= XDF_HISTOGRAM_DIFF;
+	else if (!prefixcmp(arg, "--diff-algorithm=")) {
+		long algorithm = parse_diff_algorithm(arg + 17);
+		if (algorithm < 0)
+			return error("unknown diff algorithm '%s'", arg + 17);
+		options->xdl_opts &= ~XDF_DIFF_ALGORITHM_MASK;
+		options->xdl_opts |= algorithm;
+	}
 
 	/* flags options */
 	else if (!strcmp(arg, "--binary")) {
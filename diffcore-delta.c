@@ -163,6 +163,47 @@ static struct spanhash_top *hash_chars(struct diff_filespec *one)
 	return hash;
 }
 
+/*
+ * Fill in the span hashes of "one" ahead of time, so that comparing
+ * it with others later does not have to look at its data (or at its
+ * attributes) anymore.
+ */
+void diffcore_fill_count(struct diff_filespec *one, void **count_p)
+{
+	if (!*count_p)
+		*count_p = hash_chars(one);
+}
+
+/*
+ * MinHash signature of the set of spans in "count": for each of
+ * DIFFCORE_SIGNATURE_SIZE hash functions, the smallest value it takes
+ * over the spans.  Two signatures agree at a given position with a
+ * probability equal to the ratio of the spans the files share to all
+ * the spans in either of them.  Returns the number of spans, which is
+ * zero (and the signature meaningless) for an empty file.
+ */
+int diffcore_count_signature(void *count, unsigned int *sig)
+{
+	struct spanhash_top *top = count;
+	struct spanhash *s;
+	int i, nr = 0;
+
+	for (i = 0; i < DIFFCORE_SIGNATURE_SIZE; i++)
+		sig[i] = ~0u;
+	for (s = top->data; s->cnt; s++) {
+		for (i = 0; i < DIFFCORE_SIGNATURE_SIZE; i++) {
+			unsigned int h = s->hashval * 0x9e3779b1u + i * 0x7f4a7c15u;
+			h ^= h >> 15;
+			h *= 0x85ebca6bu;
+			h ^= h >> 13;
+			if (h < sig[i])
+				sig[i] = h;
+		}
+		nr++;
+	}
+	return nr;
+}
+
 int diffcore_count_changes(struct diff_filespec *src,
 			   struct diff_filespec *dst,
 			   void **src_count_p,
@@ -4,18 +4,99 @@
 #include "cache.h"
 #include "diff.h"
 #include "diffcore.h"
+#include "hash.h"
+#include "trigram.h"
 
-static unsigned int contains(struct diff_filespec *one,
-			     const char *needle, unsigned long len,
-			     regex_t *regexp)
+/*
+ * "log -S" sees the same blob again and again, as the postimage of
+ * one commit and the preimage of the next, so we remember how many
+ * times the needle occurs in each blob we have counted it in.
+ */
+struct pickaxe_count {
+	struct pickaxe_count *next;
+	unsigned char sha1[20];
+	unsigned int cnt;
+};
+
+static struct hash_table counts;
+static char *counted_needle;
+static int counted_opts;
+
+/* what the blobs must contain for the needle to be in them */
+static char *needle_literal;
+
+static unsigned int hash_count(const unsigned char *sha1)
+{
+	unsigned int hash;
+	memcpy(&hash, sha1, sizeof(hash));
+	return hash;
+}
+
+static struct pickaxe_count *lookup_count(const unsigned char *sha1)
+{
+	struct pickaxe_count *c = lookup_hash(hash_count(sha1), &counts);
+
+	for (; c; c = c->next)
+		if (!hashcmp(c->sha1, sha1))
+			return c;
+	return NULL;
+}
+
+static void remember_count(const unsigned char *sha1, unsigned int cnt)
+{
+	struct pickaxe_count *c = xmalloc(sizeof(*c));
+	void **pos;
+
+	hashcpy(c->sha1, sha1);
+	c->cnt = cnt;
+	c->next = NULL;
+	pos = insert_hash(hash_count(sha1), c, &counts);
+	if (pos) {
+		c->next = *pos;
+		*pos = c;
+	}
+}
+
+static int free_count(void *ptr)
+{
+	struct pickaxe_count *c = ptr;
+
+	while (c) {
+		struct pickaxe_count *next = c->next;
+		free(c);
+		c = next;
+	}
+	return 0;
+}
+
+/* The counts are only good for the same needle. */
+static void prepare_counts(const char *needle, int opts)
+{
+	if (counted_needle && !strcmp(counted_needle, needle) &&
+	    counted_opts == opts)
+		return;
+	for_each_hash(&counts, free_count);
+	free_hash(&counts);
+	init_hash(&counts);
+	free(counted_needle);
+	counted_needle = xstrdup(needle);
+	counted_opts = opts;
+	free(needle_literal);
+	if (opts & DIFF_PICKAXE_REGEX)
+		needle_literal = trigram_literal_of_regex(needle, 1);
+	else
+		needle_literal = xstrdup(needle);
+}
+
+static unsigned int count_needle(struct diff_filespec *one,
+				 const char *needle, unsigned long len,
+				 regex_t *regexp)
 {
 	unsigned int cnt;
-	unsigned long offset, sz;
+	unsigned long sz;
 	const char *data;
 	if (diff_populate_filespec(one, 0))
 		return 0;
-	if (!len)
-		return 0;
 
 	sz = one->size;
 	data = one->data;
@@ -33,21 +114,44 @@ static unsigned int contains(struct diff_filespec *one,
 		}
 
 	} else { /* Classic exact string match */
-		/* Yes, I've heard of strstr(), but the thing is *data may
-		 * not be NUL terminated.  Sue me.
-		 */
-		for (offset = 0; offset + len <= sz; offset++) {
-			/* we count non-overlapping occurrences of needle */
-			if (!memcmp(needle, data + offset, len)) {
-				offset += len - 1;
-				cnt++;
-			}
+		/* *data may not be NUL terminated, hence memmem() */
+		const char *end = data + sz;
+		const char *found;
+
+		/* we count non-overlapping occurrences of needle */
+		while ((found = memmem(data, end - data, needle, len))) {
+			data = found + len;
+			cnt++;
 		}
 	}
 	diff_free_filespec_data(one);
 	return cnt;
 }
 
+static unsigned int contains(struct diff_filespec *one,
+			     const char *needle, unsigned long len,
+			     regex_t *regexp)
+{
+	struct pickaxe_count *c;
+	unsigned int cnt;
+
+	if (!len)
+		return 0;
+	if (!one->sha1_valid || is_null_sha1(one->sha1))
+		return count_needle(one, needle, len, regexp);
+	c = lookup_count(one->sha1);
+	if (c)
+		return c->cnt;
+	if (needle_literal &&
+	    !trigram_blob_may_contain(one->sha1, needle_literal,
+				      strlen(needle_literal)))
+		cnt = 0;
+	else
+		cnt = count_needle(one, needle, len, regexp);
+	remember_count(one->sha1, cnt);
+	return cnt;
+}
+
 void diffcore_pickaxe(const char *needle, int opts)
 {
 	struct diff_queue_struct *q = &diff_queued_diff;
@@ -58,6 +162,8 @@ void diffcore_pickaxe(const char *needle, int opts)
 	outq.queue = NULL;
 	outq.nr = outq.alloc = 0;
 
+	prepare_counts(needle, opts);
+
 	if (opts & DIFF_PICKAXE_REGEX) {
 		int err;
 		err = regcomp(&regex, needle, REG_EXTENDED | REG_NEWLINE);
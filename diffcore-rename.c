@@ -5,6 +5,11 @@
 #include "diff.h"
 #include "diffcore.h"
 #include "hash.h"
+#include "rename-cache.h"
+#ifdef USE_PTHREADS
+#include "thread-utils.h"
+#include <pthread.h>
+#endif
 
 /* Table of rename/copy destinations */
 
@@ -116,6 +121,77 @@ struct diff_score {
 	short name_score;
 };
 
+static int use_rename_cache;
+
+/*
+ * We would not consider edits that change the file size so
+ * drastically.  delta_size must be smaller than
+ * (MAX_SCORE-minimum_score)/MAX_SCORE * min(src_size, dst_size).
+ *
+ * Note that base_size == 0 case is handled here already
+ * and the final score computation would not have a
+ * divide-by-zero issue.
+ */
+static int similar_sizes(unsigned long src_size, unsigned long dst_size,
+			 int minimum_score)
+{
+	unsigned long max_size, delta_size, base_size;
+
+	max_size = ((src_size > dst_size) ? src_size : dst_size);
+	base_size = ((src_size < dst_size) ? src_size : dst_size);
+	delta_size = max_size - base_size;
+	return delta_size * MAX_SCORE <= base_size * (MAX_SCORE-minimum_score);
+}
+
+/*
+ * The cache is keyed on the blobs alone, but when the "diff" attribute
+ * decides whether a path is binary, the score also depends on the
+ * path; such pairs are neither looked up nor recorded.
+ */
+static int rename_cacheable(struct diff_filespec *src,
+			    struct diff_filespec *dst)
+{
+	return use_rename_cache && src->sha1_valid && dst->sha1_valid &&
+		!src->binary_by_attr && !dst->binary_by_attr;
+}
+
+/* The size of a blob, without reading it if we can help it */
+static unsigned long blob_size(struct diff_filespec *one)
+{
+	if (!one->size && !one->data && !one->cnt_data)
+		sha1_object_info(one->sha1, &one->size);
+	return one->size;
+}
+
+/*
+ * The score of the pair if we know it without reading the blobs: 0
+ * if they are not both regular files, or if with diff.renameCache
+ * their sizes rule them out, or what the cache remembers for them.
+ * Otherwise -1.
+ */
+static int cached_similarity(struct diff_filespec *src,
+			     struct diff_filespec *dst,
+			     int minimum_score)
+{
+	/* We deal only with regular files.  Symlink renames are handled
+	 * only when they are exact matches --- in other words, no edits
+	 * after renaming.
+	 */
+	if (!S_ISREG(src->mode) || !S_ISREG(dst->mode))
+		return 0;
+
+	/*
+	 * With diff.renameCache, the pair may have been scored by an
+	 * earlier command; then we do not even have to read the blobs.
+	 * Their sizes are enough to rule out most pairs, too.
+	 */
+	if (!rename_cacheable(src, dst))
+		return -1;
+	if (!similar_sizes(blob_size(src), blob_size(dst), minimum_score))
+		return 0;
+	return rename_cache_lookup(src->sha1, dst->sha1);
+}
+
 static int estimate_similarity(struct diff_filespec *src,
 			       struct diff_filespec *dst,
 			       int minimum_score)
@@ -133,16 +209,14 @@ static int estimate_similarity(struct diff_filespec *src,
 	 * match than anything else; the destination does not even
 	 * call into this function in that case.
 	 */
-	unsigned long max_size, delta_size, base_size, src_copied, literal_added;
+	unsigned long max_size, base_size, src_copied, literal_added;
 	unsigned long delta_limit;
-	int score;
+	int score, cache;
 
-	/* We deal only with regular files.  Symlink renames are handled
-	 * only when they are exact matches --- in other words, no edits
-	 * after renaming.
-	 */
-	if (!S_ISREG(src->mode) || !S_ISREG(dst->mode))
-		return 0;
+	score = cached_similarity(src, dst, minimum_score);
+	if (0 <= score)
+		return score;
+	cache = rename_cacheable(src, dst);
 
 	/*
 	 * Need to check that source and destination sizes are
@@ -158,21 +232,11 @@ static int estimate_similarity(struct diff_filespec *src,
 	if (!dst->cnt_data && diff_populate_filespec(dst, 0))
 		return 0;
 
-	max_size = ((src->size > dst->size) ? src->size : dst->size);
-	base_size = ((src->size < dst->size) ? src->size : dst->size);
-	delta_size = max_size - base_size;
-
-	/* We would not consider edits that change the file size so
-	 * drastically.  delta_size must be smaller than
-	 * (MAX_SCORE-minimum_score)/MAX_SCORE * min(src->size, dst->size).
-	 *
-	 * Note that base_size == 0 case is handled here already
-	 * and the final score computation below would not have a
-	 * divide-by-zero issue.
-	 */
-	if (base_size * (MAX_SCORE-minimum_score) < delta_size * MAX_SCORE)
+	if (!similar_sizes(src->size, dst->size, minimum_score))
 		return 0;
 
+	max_size = ((src->size > dst->size) ? src->size : dst->size);
+	base_size = ((src->size < dst->size) ? src->size : dst->size);
 	delta_limit = (unsigned long)
 		(base_size * (MAX_SCORE-minimum_score) / MAX_SCORE);
 	if (diffcore_count_changes(src, dst,
@@ -188,6 +252,8 @@ static int estimate_similarity(struct diff_filespec *src,
 		score = 0; /* should not happen */
 	else
 		score = (int)(src_copied * MAX_SCORE / max_size);
+	if (cache)
+		rename_cache_record(src->sha1, dst->sha1, score);
 	return score;
 }
 
@@ -409,6 +475,324 @@ static void record_if_better(struct diff_score m[], struct diff_score *o)
 		m[worst] = *o;
 }
 
+/*
+ * When diff.renamePrefilter is set and there are too many pairs to
+ * compare them all, only the pairs whose MinHash signatures (see
+ * diffcore-delta.c) agree on at least one band of RENAME_BAND_ROWS
+ * consecutive values are compared.  Files whose similarity is above
+ * the usual thresholds share most of their spans and almost always
+ * have such a band in common, while unrelated files rarely do.
+ */
+#define RENAME_BAND_ROWS 2
+#define RENAME_BANDS (DIFFCORE_SIGNATURE_SIZE / RENAME_BAND_ROWS)
+
+struct band_entry {
+	unsigned int hash;
+	int src;
+};
+
+struct rename_sketch {
+	struct band_entry *band[RENAME_BANDS];
+	int nr;
+};
+
+static unsigned int band_hash(const unsigned int *sig, int band)
+{
+	unsigned int hash = 0;
+	int i;
+
+	for (i = 0; i < RENAME_BAND_ROWS; i++)
+		hash = hash * 0x9e3779b1u + sig[band * RENAME_BAND_ROWS + i];
+	return hash;
+}
+
+static int band_entry_cmp(const void *a_, const void *b_)
+{
+	const struct band_entry *a = a_, *b = b_;
+
+	if (a->hash != b->hash)
+		return a->hash < b->hash ? -1 : 1;
+	return a->src - b->src;
+}
+
+static void prepare_count(struct diff_filespec *one)
+{
+	if (!S_ISREG(one->mode) || one->cnt_data ||
+	    diff_populate_filespec(one, 0))
+		return;
+	diffcore_fill_count(one, &one->cnt_data);
+	diff_free_filespec_blob(one);
+}
+
+static void prepare_sketch(struct rename_sketch *sk)
+{
+	unsigned int sig[DIFFCORE_SIGNATURE_SIZE];
+	int i, b;
+
+	for (b = 0; b < RENAME_BANDS; b++)
+		sk->band[b] = xmalloc(rename_src_nr * sizeof(struct band_entry));
+	sk->nr = 0;
+	for (i = 0; i < rename_src_nr; i++) {
+		struct diff_filespec *one = rename_src[i].one;
+
+		prepare_count(one);
+		if (!one->cnt_data || !diffcore_count_signature(one->cnt_data, sig))
+			continue;
+		for (b = 0; b < RENAME_BANDS; b++) {
+			sk->band[b][sk->nr].hash = band_hash(sig, b);
+			sk->band[b][sk->nr].src = i;
+		}
+		sk->nr++;
+	}
+	for (b = 0; b < RENAME_BANDS; b++)
+		qsort(sk->band[b], sk->nr, sizeof(struct band_entry),
+		      band_entry_cmp);
+}
+
+static void free_sketch(struct rename_sketch *sk)
+{
+	int b;
+
+	for (b = 0; b < RENAME_BANDS; b++)
+		free(sk->band[b]);
+}
+
+static int int_cmp(const void *a_, const void *b_)
+{
+	const int *a = a_, *b = b_;
+	return *a - *b;
+}
+
+/*
+ * Collect the sources sharing a band with "two", in increasing order
+ * (the same order in which all the sources would be looked at).
+ */
+static int sketch_sources(const struct rename_sketch *sk,
+			  struct diff_filespec *two, int **src_p)
+{
+	unsigned int sig[DIFFCORE_SIGNATURE_SIZE];
+	int *src = NULL;
+	int b, i, nr = 0, alloc = 0;
+
+	if (!two->cnt_data || !diffcore_count_signature(two->cnt_data, sig))
+		return 0;
+	for (b = 0; b < RENAME_BANDS; b++) {
+		const struct band_entry *e = sk->band[b];
+		unsigned int hash = band_hash(sig, b);
+		int lo = 0, hi = sk->nr;
+
+		while (lo < hi) {
+			int mi = (lo + hi) / 2;
+			if (e[mi].hash < hash)
+				lo = mi + 1;
+			else
+				hi = mi;
+		}
+		for (; lo < sk->nr && e[lo].hash == hash; lo++) {
+			ALLOC_GROW(src, nr + 1, alloc);
+			src[nr++] = e[lo].src;
+		}
+	}
+	qsort(src, nr, sizeof(*src), int_cmp);
+	for (b = i = 0; i < nr; i++)
+		if (!b || src[b - 1] != src[i])
+			src[b++] = src[i];
+	*src_p = src;
+	return b;
+}
+
+/*
+ * Fill "m" with the best sources for rename_dst[dst_index].  When
+ * "prepared", the span hashes of every regular file whose pairs are
+ * not all in the rename cache have been computed already, and nothing
+ * is read or freed here, so that several threads can work on different
+ * destinations at the same time.  With a "sketch", only the sources it
+ * suggests are looked at.
+ */
+static void find_candidates(struct diff_score *m, int dst_index,
+			    int minimum_score, int prepared,
+			    const struct rename_sketch *sketch)
+{
+	struct diff_filespec *two = rename_dst[dst_index].two;
+	int *src = NULL;
+	int j, k, nr;
+
+	for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
+		m[j].dst = -1;
+
+	nr = sketch ? sketch_sources(sketch, two, &src) : rename_src_nr;
+	for (k = 0; k < nr; k++) {
+		struct diff_filespec *one;
+		struct diff_score this_src;
+
+		j = src ? src[k] : k;
+		one = rename_src[j].one;
+		if (!prepared || (one->cnt_data && two->cnt_data))
+			this_src.score = estimate_similarity(one, two,
+							     minimum_score);
+		else if (one->size && two->size) {
+			/* in the cache, or unreadable, or not a file */
+			this_src.score = cached_similarity(one, two,
+							   minimum_score);
+			if (this_src.score < 0)
+				this_src.score = 0;
+		} else
+			this_src.score = 0; /* unreadable, or not a file */
+		this_src.name_score = basename_same(one, two);
+		this_src.dst = dst_index;
+		this_src.src = j;
+		record_if_better(m, &this_src);
+		if (!prepared)
+			diff_free_filespec_blob(one);
+	}
+	free(src);
+	/* We do not need the text anymore */
+	if (!prepared)
+		diff_free_filespec_blob(two);
+}
+
+#ifdef USE_PTHREADS
+/*
+ * Comparing every destination with every source is what makes inexact
+ * rename detection slow.  Reading the blobs and hashing them is done
+ * once up front; after that the rows of the matrix are independent,
+ * and the threads hand them out to each other one at a time.  Every
+ * row ends up in the same slot of the matrix whichever thread filled
+ * it, so the result is the same as without threads.
+ */
+#define RENAME_MIN_PAIRS_PER_THREAD 1000
+#define RENAME_MAX_THREADS 16
+
+struct rename_matrix {
+	struct diff_score *mx;
+	int *dst_index;
+	int nr, next;
+	int minimum_score;
+	const struct rename_sketch *sketch;
+	pthread_mutex_t mutex;
+};
+
+static void *fill_rows(void *data)
+{
+	struct rename_matrix *rm = data;
+
+	for (;;) {
+		int row;
+
+		pthread_mutex_lock(&rm->mutex);
+		row = rm->next++;
+		pthread_mutex_unlock(&rm->mutex);
+		if (rm->nr <= row)
+			break;
+		find_candidates(&rm->mx[row * NUM_CANDIDATE_PER_DST],
+				rm->dst_index[row], rm->minimum_score, 1,
+				rm->sketch);
+	}
+	return NULL;
+}
+
+/*
+ * Compute the span hashes of the files that are in a pair the rename
+ * cache does not know.  The threads then read no object at all: the
+ * pairs of the other files are answered from the cache and their
+ * sizes, which we look up here.  A sketch needs the span hashes of
+ * every file to find the candidates in the first place.
+ */
+static void prepare_uncached(const int *dst_index, int nr, int minimum_score,
+			     const struct rename_sketch *sketch)
+{
+	char *src_needed, *dst_needed;
+	int i, j;
+
+	if (!use_rename_cache || sketch) {
+		for (i = 0; i < rename_src_nr; i++)
+			prepare_count(rename_src[i].one);
+		for (i = 0; i < nr; i++)
+			prepare_count(rename_dst[dst_index[i]].two);
+		return;
+	}
+
+	src_needed = xcalloc(rename_src_nr, 1);
+	dst_needed = xcalloc(nr, 1);
+	for (i = 0; i < rename_src_nr; i++)
+		if (S_ISREG(rename_src[i].one->mode) &&
+		    rename_src[i].one->sha1_valid)
+			blob_size(rename_src[i].one);
+	for (i = 0; i < nr; i++)
+		if (S_ISREG(rename_dst[dst_index[i]].two->mode) &&
+		    rename_dst[dst_index[i]].two->sha1_valid)
+			blob_size(rename_dst[dst_index[i]].two);
+	for (i = 0; i < nr; i++) {
+		struct diff_filespec *two = rename_dst[dst_index[i]].two;
+
+		for (j = 0; j < rename_src_nr; j++) {
+			struct diff_filespec *one = rename_src[j].one;
+
+			/*
+			 * An empty blob would have its size looked up
+			 * again by the threads.
+			 */
+			if (cached_similarity(one, two, minimum_score) < 0 ||
+			    (S_ISREG(one->mode) && !one->size) ||
+			    (S_ISREG(two->mode) && !two->size))
+				src_needed[j] = dst_needed[i] = 1;
+		}
+	}
+	for (i = 0; i < rename_src_nr; i++)
+		if (src_needed[i])
+			prepare_count(rename_src[i].one);
+	for (i = 0; i < nr; i++)
+		if (dst_needed[i])
+			prepare_count(rename_dst[dst_index[i]].two);
+	free(src_needed);
+	free(dst_needed);
+}
+
+static int fill_matrix_threaded(struct diff_score *mx, int num_create,
+				int minimum_score,
+				const struct rename_sketch *sketch)
+{
+	struct rename_matrix rm;
+	pthread_t threads[RENAME_MAX_THREADS];
+	int started[RENAME_MAX_THREADS];
+	int i, nr_threads;
+
+	nr_threads = online_cpus();
+	if (!sketch &&
+	    nr_threads > (double)num_create * rename_src_nr / RENAME_MIN_PAIRS_PER_THREAD)
+		nr_threads = (double)num_create * rename_src_nr / RENAME_MIN_PAIRS_PER_THREAD;
+	if (nr_threads > RENAME_MAX_THREADS)
+		nr_threads = RENAME_MAX_THREADS;
+	if (nr_threads < 2)
+		return 0;
+
+	rm.mx = mx;
+	rm.dst_index = xmalloc(num_create * sizeof(*rm.dst_index));
+	rm.nr = rm.next = 0;
+	rm.minimum_score = minimum_score;
+	rm.sketch = sketch;
+	pthread_mutex_init(&rm.mutex, NULL);
+
+	for (i = 0; i < rename_dst_nr; i++)
+		if (!rename_dst[i].pair)
+			rm.dst_index[rm.nr++] = i;
+	prepare_uncached(rm.dst_index, rm.nr, minimum_score, sketch);
+
+	for (i = 1; i < nr_threads; i++)
+		started[i] = !pthread_create(&threads[i], NULL, fill_rows, &rm);
+	fill_rows(&rm);
+	for (i = 1; i < nr_threads; i++)
+		if (started[i])
+			pthread_join(threads[i], NULL);
+
+	pthread_mutex_destroy(&rm.mutex);
+	free(rm.dst_index);
+	return 1;
+}
+#else
+#define fill_matrix_threaded(mx, num_create, minimum_score, sketch)	0
+#endif
+
 void diffcore_rename(struct diff_options *options)
 {
 	int detect_rename = options->detect_rename;
@@ -417,7 +801,8 @@ void diffcore_rename(struct diff_options *options)
 	struct diff_queue_struct *q = &diff_queued_diff;
 	struct diff_queue_struct outq;
 	struct diff_score *mx;
-	int i, j, rename_count;
+	struct rename_sketch sketch;
+	int i, rename_count, use_sketch = 0;
 	int num_create, num_src, dst_cnt;
 
 	if (!minimum_score)
@@ -492,38 +877,45 @@ void diffcore_rename(struct diff_options *options)
 		rename_limit = 32767;
 	if ((num_create > rename_limit && num_src > rename_limit) ||
 	    (num_create * num_src > rename_limit * rename_limit)) {
-		if (options->warn_on_too_large_rename)
-			warning("too many files, skipping inexact rename detection");
-		goto cleanup;
+		if (DIFF_OPT_TST(options, RENAME_PREFILTER)) {
+			prepare_sketch(&sketch);
+			use_sketch = 1;
+		} else {
+			if (options->warn_on_too_large_rename)
+				warning("too many files, skipping inexact rename detection");
+			goto cleanup;
+		}
 	}
 
-	mx = xcalloc(num_create * NUM_CANDIDATE_PER_DST, sizeof(*mx));
-	for (dst_cnt = i = 0; i < rename_dst_nr; i++) {
-		struct diff_filespec *two = rename_dst[i].two;
-		struct diff_score *m;
-
-		if (rename_dst[i].pair)
-			continue; /* dealt with exact match already. */
-
-		m = &mx[dst_cnt * NUM_CANDIDATE_PER_DST];
-		for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
-			m[j].dst = -1;
+	use_rename_cache = DIFF_OPT_TST(options, RENAME_CACHE);
+	if (use_rename_cache) {
+		prepare_rename_cache();
+		/* look up the attributes here; the threads must not */
+		for (i = 0; i < rename_src_nr; i++)
+			rename_src[i].one->binary_by_attr =
+				diff_filespec_binary_by_attr(rename_src[i].one);
+		for (i = 0; i < rename_dst_nr; i++)
+			rename_dst[i].two->binary_by_attr =
+				diff_filespec_binary_by_attr(rename_dst[i].two);
+	}
 
-		for (j = 0; j < rename_src_nr; j++) {
-			struct diff_filespec *one = rename_src[j].one;
-			struct diff_score this_src;
-			this_src.score = estimate_similarity(one, two,
-							     minimum_score);
-			this_src.name_score = basename_same(one, two);
-			this_src.dst = i;
-			this_src.src = j;
-			record_if_better(m, &this_src);
-			diff_free_filespec_blob(one);
+	mx = xcalloc(num_create * NUM_CANDIDATE_PER_DST, sizeof(*mx));
+	dst_cnt = num_create;
+	if (!fill_matrix_threaded(mx, num_create, minimum_score,
+				  use_sketch ? &sketch : NULL)) {
+		for (dst_cnt = i = 0; i < rename_dst_nr; i++) {
+			if (rename_dst[i].pair)
+				continue; /* dealt with exact match already. */
+			if (use_sketch)
+				prepare_count(rename_dst[i].two);
+			find_candidates(&mx[dst_cnt * NUM_CANDIDATE_PER_DST],
+					i, minimum_score, use_sketch,
+					use_sketch ? &sketch : NULL);
+			dst_cnt++;
 		}
-		/* We do not need the text anymore */
-		diff_free_filespec_blob(two);
-		dst_cnt++;
 	}
+	if (use_sketch)
+		free_sketch(&sketch);
 
 	/* cost matrix sorted by most to least similar pair */
 	qsort(mx, dst_cnt * NUM_CANDIDATE_PER_DST, sizeof(*mx), score_compare);
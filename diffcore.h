@@ -42,6 +42,7 @@ struct diff_filespec {
 	unsigned should_munmap : 1; /* data should be munmap()'ed */
 	unsigned checked_attr : 1;
 	unsigned is_binary : 1; /* data should be considered "binary" */
+	unsigned binary_by_attr : 1; /* the "diff" attribute decides that */
 };
 
 extern struct diff_filespec *alloc_filespec(const char *);
@@ -53,6 +54,7 @@ extern int diff_populate_filespec(struct diff_filespec *, int);
 extern void diff_free_filespec_data(struct diff_filespec *);
 extern void diff_free_filespec_blob(struct diff_filespec *);
 extern int diff_filespec_is_binary(struct diff_filespec *);
+extern int diff_filespec_binary_by_attr(struct diff_filespec *);
 
 struct diff_filepair {
 	struct diff_filespec *one;
@@ -110,6 +112,9 @@ void diff_debug_queue(const char *, struct diff_queue_struct *);
 #define diff_debug_queue(a,b) do {} while(0)
 #endif
 
+#define DIFFCORE_SIGNATURE_SIZE 64
+extern void diffcore_fill_count(struct diff_filespec *, void **);
+extern int diffcore_count_signature(void *, unsigned int *);
 extern int diffcore_count_changes(struct diff_filespec *src,
 				  struct diff_filespec *dst,
 				  void **src_count_p,
@@ -420,7 +420,18 @@ enum exist_status {
  */
 static enum exist_status directory_exists_in_index(const char *dirname, int len)
 {
-	int pos = cache_name_pos(dirname, len);
+	int pos;
+
+	if (ignore_case) {
+		struct cache_entry *ce = cache_name_exists(dirname, len, 1);
+		if (ce && S_ISGITLINK(ce->ce_mode))
+			return index_gitdir;
+		if (index_dir_exists(&the_index, dirname, len))
+			return index_directory;
+		return index_nonexistent;
+	}
+
+	pos = cache_name_pos(dirname, len);
 	if (pos < 0)
 		pos = -pos-1;
 	while (pos < active_nr) {
@@ -10,27 +10,31 @@ static void create_directories(const char *path, const struct checkout *state)
 	while ((slash = strchr(slash+1, '/')) != NULL) {
 		struct stat st;
 		int stat_status;
+		unsigned want;
 
+		/*
+		 * checkout-index --prefix=<dir>; <dir> is allowed
+		 * to be a symlink to an existing directory.  Below
+		 * it, if there currently is a symlink, we would want
+		 * to replace it with a real directory.
+		 */
 		len = slash - path;
+		want = len <= state->base_dir_len ?
+			DIR_CACHE_STAT : DIR_CACHE_LSTAT;
+		if (dir_cache_has(path, len, want))
+			continue;
 		memcpy(buf, path, len);
 		buf[len] = 0;
 
-		if (len <= state->base_dir_len)
-			/*
-			 * checkout-index --prefix=<dir>; <dir> is
-			 * allowed to be a symlink to an existing
-			 * directory.
-			 */
+		if (want == DIR_CACHE_STAT)
 			stat_status = stat(buf, &st);
 		else
-			/*
-			 * if there currently is a symlink, we would
-			 * want to replace it with a real directory.
-			 */
 			stat_status = lstat(buf, &st);
 
-		if (!stat_status && S_ISDIR(st.st_mode))
+		if (!stat_status && S_ISDIR(st.st_mode)) {
+			dir_cache_add(buf, len, want);
 			continue; /* ok, it is already a directory. */
+		}
 
 		/*
 		 * We know stat_status == 0 means something exists
@@ -40,10 +44,13 @@ static void create_directories(const char *path, const struct checkout *state)
 		 */
 		if (mkdir(buf, 0777)) {
 			if (errno == EEXIST && state->force &&
-			    !unlink(buf) && !mkdir(buf, 0777))
+			    !unlink(buf) && !mkdir(buf, 0777)) {
+				dir_cache_add(buf, len, DIR_CACHE_LSTAT);
 				continue;
+			}
 			die("cannot create directory at %s", buf);
 		}
+		dir_cache_add(buf, len, DIR_CACHE_LSTAT);
 	}
 	free(buf);
 }
@@ -225,6 +232,7 @@ int checkout_entry(struct cache_entry *ce, const struct checkout *state, char *t
 			if (!state->force)
 				return error("%s is a directory", path);
 			remove_subtree(path);
+			dir_cache_invalidate();
 		} else if (unlink(path))
 			return error("unable to unlink old '%s' (%s)", path, strerror(errno));
 	} else if (state->not_new)
@@ -1,6 +1,7 @@
 #include "cache.h"
 #include "grep.h"
 #include "xdiff-interface.h"
+#include "trigram.h"
 
 void append_grep_pattern(struct grep_opt *opt, const char *pat,
 			 const char *origin, int no, enum grep_pat_token t)
@@ -134,6 +135,168 @@ static struct grep_expr *compile_pattern_expr(struct grep_pat **list)
 	return compile_pattern_or(list);
 }
 
+/*
+ * With fixed strings, grep_buffer() first looks for where any of them
+ * occurs in the rest of the buffer, and skips the lines before that
+ * without looking at them one by one.  A single string is searched for
+ * with Boyer-Moore-Horspool, several of them at once with Aho-Corasick.
+ */
+struct literal_state {
+	int child;		/* first state one byte deeper */
+	int sibling;		/* next child of our parent */
+	int fail;
+	int depth;
+	unsigned char ch;
+	unsigned char out;	/* some pattern ends here */
+};
+
+struct grep_literals {
+	/* one string */
+	const unsigned char *needle;
+	size_t needle_len;
+	size_t skip[256];
+
+	/* several strings: the trie, with state 0 the root */
+	struct literal_state *state;
+	int nr, alloc;
+	int root[256];		/* transitions out of the root */
+};
+
+static int literal_child(struct grep_literals *l, int s, unsigned char ch)
+{
+	int c;
+
+	if (!s)
+		return l->root[ch];
+	for (c = l->state[s].child; c; c = l->state[c].sibling)
+		if (l->state[c].ch == ch)
+			return c;
+	return 0;
+}
+
+static void add_literal(struct grep_literals *l, const char *pattern)
+{
+	const unsigned char *cp = (const unsigned char *)pattern;
+	int s = 0;
+
+	for (; *cp; cp++) {
+		int c = literal_child(l, s, *cp);
+		if (!c) {
+			ALLOC_GROW(l->state, l->nr + 1, l->alloc);
+			c = l->nr++;
+			memset(&l->state[c], 0, sizeof(l->state[c]));
+			l->state[c].ch = *cp;
+			l->state[c].depth = l->state[s].depth + 1;
+			if (s) {
+				l->state[c].sibling = l->state[s].child;
+				l->state[s].child = c;
+			} else
+				l->root[*cp] = c;
+		}
+		s = c;
+	}
+	l->state[s].out = 1;
+}
+
+/* Fill in the failure links, breadth first. */
+static void finish_literals(struct grep_literals *l)
+{
+	int *queue = xmalloc(l->nr * sizeof(*queue));
+	int head = 0, tail = 0, i;
+
+	for (i = 0; i < 256; i++)
+		if (l->root[i])
+			queue[tail++] = l->root[i];
+	while (head < tail) {
+		int s = queue[head++], c;
+		for (c = l->state[s].child; c; c = l->state[c].sibling) {
+			int f = l->state[s].fail;
+			while (f && !literal_child(l, f, l->state[c].ch))
+				f = l->state[f].fail;
+			f = literal_child(l, f, l->state[c].ch);
+			l->state[c].fail = f;
+			l->state[c].out |= l->state[f].out;
+			queue[tail++] = c;
+		}
+	}
+	free(queue);
+}
+
+static void compile_literals(struct grep_opt *opt)
+{
+	struct grep_literals *l;
+	struct grep_pat *p;
+	int nr = 0;
+	size_t i;
+
+	for (p = opt->pattern_list; p; p = p->next) {
+		if (p->token != GREP_PATTERN || !*p->pattern)
+			return;
+		nr++;
+	}
+	l = xcalloc(1, sizeof(*l));
+	if (nr == 1) {
+		p = opt->pattern_list;
+		l->needle = (const unsigned char *)p->pattern;
+		l->needle_len = strlen(p->pattern);
+		for (i = 0; i < 256; i++)
+			l->skip[i] = l->needle_len;
+		for (i = 0; i + 1 < l->needle_len; i++)
+			l->skip[l->needle[i]] = l->needle_len - 1 - i;
+	} else {
+		l->alloc = 64;
+		l->state = xcalloc(l->alloc, sizeof(*l->state));
+		l->nr = 1;
+		for (p = opt->pattern_list; p; p = p->next)
+			add_literal(l, p->pattern);
+		finish_literals(l);
+	}
+	opt->literals = l;
+}
+
+static void free_literals(struct grep_opt *opt)
+{
+	if (!opt->literals)
+		return;
+	free(opt->literals->state);
+	free(opt->literals);
+	opt->literals = NULL;
+}
+
+/*
+ * Returns where the first occurrence of any of the strings in the
+ * buffer starts (or may start, with several of them), or NULL.
+ */
+static const char *find_literal(struct grep_literals *l,
+				const char *buf, unsigned long size)
+{
+	const unsigned char *cp = (const unsigned char *)buf;
+	const unsigned char *end = cp + size;
+	int s = 0, t = 0;
+
+	if (l->needle) {
+		size_t last = l->needle_len - 1;
+
+		while ((size_t)(end - cp) > last) {
+			unsigned char ch = cp[last];
+			if (ch == l->needle[last] &&
+			    !memcmp(cp, l->needle, last))
+				return (const char *)cp;
+			cp += l->skip[ch];
+		}
+		return NULL;
+	}
+
+	for (; cp < end; cp++) {
+		while (s && !(t = literal_child(l, s, *cp)))
+			s = l->state[s].fail;
+		s = s ? t : l->root[*cp];
+		if (l->state[s].out)
+			return (const char *)cp + 1 - l->state[s].depth;
+	}
+	return NULL;
+}
+
 void compile_grep_patterns(struct grep_opt *opt)
 {
 	struct grep_pat *p;
@@ -146,8 +309,14 @@ void compile_grep_patterns(struct grep_opt *opt)
 		case GREP_PATTERN: /* atom */
 		case GREP_PATTERN_HEAD:
 		case GREP_PATTERN_BODY:
-			if (!opt->fixed)
-				compile_regexp(p, opt);
+			if (opt->fixed) {
+				p->literal = xstrdup(p->pattern);
+				break;
+			}
+			compile_regexp(p, opt);
+			if (!(opt->regflags & REG_ICASE))
+				p->literal = trigram_literal_of_regex(p->pattern,
+					!!(opt->regflags & REG_EXTENDED));
 			break;
 		default:
 			opt->extended = 1;
@@ -155,8 +324,11 @@ void compile_grep_patterns(struct grep_opt *opt)
 		}
 	}
 
-	if (!opt->extended)
+	if (!opt->extended) {
+		if (opt->fixed)
+			compile_literals(opt);
 		return;
+	}
 
 	/* Then bundle them up in an expression.
 	 * A classic recursive descent parser would do.
@@ -195,6 +367,7 @@ void free_grep_patterns(struct grep_opt *opt)
 		case GREP_PATTERN_HEAD:
 		case GREP_PATTERN_BODY:
 			regfree(&p->regexp);
+			free(p->literal);
 			break;
 		default:
 			break;
@@ -202,6 +375,7 @@ void free_grep_patterns(struct grep_opt *opt)
 		free(p);
 	}
 
+	free_literals(opt);
 	if (!opt->extended)
 		return;
 	free_pattern_expr(opt->pattern_expression);
@@ -223,14 +397,37 @@ static int word_char(char ch)
 	return isalnum(ch) || ch == '_';
 }
 
+static void grep_output(struct grep_opt *opt, const void *buf, size_t size)
+{
+	if (opt->output)
+		opt->output(opt, buf, size);
+	else
+		fwrite(buf, size, 1, stdout);
+}
+
+static void grep_puts(struct grep_opt *opt, const char *str)
+{
+	grep_output(opt, str, strlen(str));
+}
+
+static void show_name(struct grep_opt *opt, const char *name, char sign)
+{
+	grep_puts(opt, name);
+	grep_output(opt, &sign, 1);
+}
+
 static void show_line(struct grep_opt *opt, const char *bol, const char *eol,
 		      const char *name, unsigned lno, char sign)
 {
 	if (opt->pathname)
-		printf("%s%c", name, sign);
-	if (opt->linenum)
-		printf("%d%c", lno, sign);
-	printf("%.*s\n", (int)(eol-bol), bol);
+		show_name(opt, name, sign);
+	if (opt->linenum) {
+		char buf[32];
+		int len = sprintf(buf, "%d%c", lno, sign);
+		grep_output(opt, buf, len);
+	}
+	grep_output(opt, bol, eol - bol);
+	grep_output(opt, "\n", 1);
 }
 
 static int fixmatch(const char *pattern, char *line, regmatch_t *match)
@@ -365,6 +562,30 @@ static int match_line(struct grep_opt *opt, char *bol, char *eol,
 	return 0;
 }
 
+/*
+ * Skip the lines before the first one that may match the fixed
+ * strings; returns 1 if none of the rest of the buffer can.
+ */
+static int look_ahead(struct grep_opt *opt, char **bol_p,
+		      unsigned long *left_p, unsigned *lno_p)
+{
+	char *bol = *bol_p, *sol, *cp;
+	const char *hit;
+
+	hit = find_literal(opt->literals, bol, *left_p);
+	if (!hit)
+		return 1;
+	for (sol = (char *)hit; bol < sol && sol[-1] != '\n'; sol--)
+		;
+	if (sol == bol)
+		return 0;
+	for (cp = bol; (cp = memchr(cp, '\n', sol - cp)) != NULL; cp++)
+		(*lno_p)++;
+	*left_p -= sol - bol;
+	*bol_p = sol;
+	return 0;
+}
+
 static int grep_buffer_1(struct grep_opt *opt, const char *name,
 			 char *buf, unsigned long size, int collect_hits)
 {
@@ -380,6 +601,7 @@ static int grep_buffer_1(struct grep_opt *opt, const char *name,
 	int binary_match_only = 0;
 	const char *hunk_mark = "";
 	unsigned count = 0;
+	int try_look_ahead = opt->literals && !opt->invert && !collect_hits;
 	enum grep_context ctx = GREP_CONTEXT_HEAD;
 
 	if (buffer_is_binary(buf, size)) {
@@ -404,6 +626,24 @@ static int grep_buffer_1(struct grep_opt *opt, const char *name,
 		char *eol, ch;
 		int hit;
 
+		if (try_look_ahead &&
+		    !(last_hit && lno <= last_hit + opt->post_context)) {
+			char *from = bol;
+			if (look_ahead(opt, &bol, &left, &lno))
+				break;
+			if (opt->pre_context && bol != from) {
+				/* we did not record the lines we skipped */
+				char *cp = bol;
+				unsigned i;
+				for (i = 0; i < opt->pre_context && buf < cp; i++) {
+					prev[i].eol = --cp;
+					while (buf < cp && cp[-1] != '\n')
+						cp--;
+					prev[i].bol = cp;
+				}
+			}
+		}
+
 		eol = end_of_line(bol, &left);
 		ch = *eol;
 		*eol = 0;
@@ -433,11 +673,13 @@ static int grep_buffer_1(struct grep_opt *opt, const char *name,
 			if (opt->status_only)
 				return 1;
 			if (binary_match_only) {
-				printf("Binary file %s matches\n", name);
+				grep_puts(opt, "Binary file ");
+				grep_puts(opt, name);
+				grep_puts(opt, " matches\n");
 				return 1;
 			}
 			if (opt->name_only) {
-				printf("%s\n", name);
+				show_name(opt, name, '\n');
 				return 1;
 			}
 			/* Hit at this line.  If we haven't shown the
@@ -455,7 +697,7 @@ static int grep_buffer_1(struct grep_opt *opt, const char *name,
 				if (from <= last_shown)
 					from = last_shown + 1;
 				if (last_shown && from != last_shown + 1)
-					printf(hunk_mark);
+					grep_puts(opt, hunk_mark);
 				while (from < lno) {
 					pcl = &prev[lno-from-1];
 					show_line(opt, pcl->bol, pcl->eol,
@@ -465,7 +707,7 @@ static int grep_buffer_1(struct grep_opt *opt, const char *name,
 				last_shown = lno-1;
 			}
 			if (last_shown && lno != last_shown + 1)
-				printf(hunk_mark);
+				grep_puts(opt, hunk_mark);
 			if (!opt->count)
 				show_line(opt, bol, eol, name, lno, ':');
 			last_shown = last_hit = lno;
@@ -476,7 +718,7 @@ static int grep_buffer_1(struct grep_opt *opt, const char *name,
 			 * we need to show this line.
 			 */
 			if (last_shown && lno != last_shown + 1)
-				printf(hunk_mark);
+				grep_puts(opt, hunk_mark);
 			show_line(opt, bol, eol, name, lno, '-');
 			last_shown = lno;
 		}
@@ -503,7 +745,7 @@ static int grep_buffer_1(struct grep_opt *opt, const char *name,
 		return 0;
 	if (opt->unmatch_name_only) {
 		/* We did not see any hit, so we want to show this */
-		printf("%s\n", name);
+		show_name(opt, name, '\n');
 		return 1;
 	}
 
@@ -512,8 +754,12 @@ static int grep_buffer_1(struct grep_opt *opt, const char *name,
 	 * which feels mostly useless but sometimes useful.  Maybe
 	 * make it another option?  For now suppress them.
 	 */
-	if (opt->count && count)
-		printf("%s:%u\n", name, count);
+	if (opt->count && count) {
+		char buf[32];
+		int len = sprintf(buf, "%u\n", count);
+		show_name(opt, name, ':');
+		grep_output(opt, buf, len);
+	}
 	return !!last_hit;
 }
 
@@ -563,3 +809,23 @@ int grep_buffer(struct grep_opt *opt, const char *name, char *buf, unsigned long
 
 	return grep_buffer_1(opt, name, buf, size, 0);
 }
+
+/*
+ * Returns 0 if the trigram index tells us that no line of the blob
+ * can match, so that it does not have to be read at all.  That is
+ * only so when every pattern needs some string to match, and when
+ * lines that do not match are not of interest themselves.
+ */
+int grep_blob_may_match(struct grep_opt *opt, const unsigned char *sha1)
+{
+	struct grep_pat *p;
+
+	if (opt->extended || opt->invert || opt->unmatch_name_only)
+		return 1;
+	for (p = opt->pattern_list; p; p = p->next)
+		if (!p->literal ||
+		    trigram_blob_may_contain(sha1, p->literal,
+					     strlen(p->literal)))
+			return 1;
+	return 0;
+}
@@ -24,6 +24,7 @@ struct grep_pat {
 	enum grep_pat_token token;
 	const char *pattern;
 	regex_t regexp;
+	char *literal;		/* what every match must contain */
 };
 
 enum grep_expr_node {
@@ -46,10 +47,13 @@ struct grep_expr {
 	} u;
 };
 
+struct grep_literals;
+
 struct grep_opt {
 	struct grep_pat *pattern_list;
 	struct grep_pat **pattern_tail;
 	struct grep_expr *pattern_expression;
+	struct grep_literals *literals;
 	int prefix_length;
 	regex_t regexp;
 	unsigned linenum:1;
@@ -71,11 +75,16 @@ struct grep_opt {
 	int regflags;
 	unsigned pre_context;
 	unsigned post_context;
+
+	/* where the output goes, if not to stdout */
+	void (*output)(struct grep_opt *opt, const void *data, size_t size);
+	void *output_priv;
 };
 
 extern void append_grep_pattern(struct grep_opt *opt, const char *pat, const char *origin, int no, enum grep_pat_token t);
 extern void compile_grep_patterns(struct grep_opt *opt);
 extern void free_grep_patterns(struct grep_opt *opt);
 extern int grep_buffer(struct grep_opt *opt, const char *name, char *buf, unsigned long size);
+extern int grep_blob_may_match(struct grep_opt *opt, const unsigned char *sha1);
 
 #endif
@@ -7,6 +7,10 @@
  */
 #define NO_THE_INDEX_COMPATIBILITY_MACROS
 #include "cache.h"
+#ifdef USE_PTHREADS
+#include "thread-utils.h"
+#include <pthread.h>
+#endif
 
 /*
  * This removes bit 5 if bit 6 is set.
@@ -32,58 +36,281 @@ static unsigned int hash_name(const char *name, int namelen)
 	return hash;
 }
 
-static void hash_index_entry(struct index_state *istate, struct cache_entry *ce)
+static int slow_same_name(const char *name1, int len1, const char *name2, int len2)
+{
+	if (len1 != len2)
+		return 0;
+
+	while (len1) {
+		unsigned char c1 = *name1++;
+		unsigned char c2 = *name2++;
+		len1--;
+		if (c1 != c2) {
+			c1 = toupper(c1);
+			c2 = toupper(c2);
+			if (c1 != c2)
+				return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+ * Hash the full name, and remember the hash and length of its
+ * leading directory on the way (the hash is computed left to right,
+ * so the prefix hash is what we had when we saw the last slash).
+ */
+struct name_hashes {
+	unsigned int hash, dir_hash;
+	int dir_len;
+};
+
+static void hash_name_and_dir(const char *name, int namelen, struct name_hashes *h)
+{
+	unsigned int hash = 0x123;
+	int i;
+
+	h->dir_hash = 0;
+	h->dir_len = 0;
+	for (i = 0; i < namelen; i++) {
+		unsigned char c = name[i];
+		if (c == '/') {
+			h->dir_hash = hash;
+			h->dir_len = i;
+		}
+		hash = hash*101 + icase_hash(c);
+	}
+	h->hash = hash;
+}
+
+/*
+ * With core.ignorecase, every leading directory of the index entries
+ * is hashed, too, so that case-insensitive directory lookups do not
+ * have to scan the index.  "nr" counts the entries and non-empty
+ * subdirectories directly inside; a directory whose count dropped to
+ * zero no longer exists (like entries, we never unhash them).  "ce"
+ * is some entry somewhere below, or NULL once that one is removed.
+ */
+struct dir_hash_entry {
+	struct dir_hash_entry *next;
+	struct dir_hash_entry *parent;
+	struct cache_entry *ce;
+	unsigned int nr;
+	int namelen;
+	char name[FLEX_ARRAY];
+};
+
+static struct dir_hash_entry *find_dir_entry(struct index_state *istate,
+		const char *name, int namelen, unsigned int hash)
+{
+	struct dir_hash_entry *dir = lookup_hash(hash, &istate->dir_hash);
+
+	for (; dir; dir = dir->next)
+		if (slow_same_name(dir->name, dir->namelen, name, namelen))
+			return dir;
+	return NULL;
+}
+
+static struct dir_hash_entry *hash_dir_entry(struct index_state *istate,
+		struct cache_entry *ce, int namelen, unsigned int hash)
+{
+	struct dir_hash_entry *dir;
+	void **pos;
+
+	dir = find_dir_entry(istate, ce->name, namelen, hash);
+	if (dir)
+		return dir;
+
+	dir = xcalloc(1, sizeof(*dir) + namelen + 1);
+	dir->ce = ce;
+	dir->namelen = namelen;
+	memcpy(dir->name, ce->name, namelen);
+	pos = insert_hash(hash, dir, &istate->dir_hash);
+	if (pos) {
+		dir->next = *pos;
+		*pos = dir;
+	}
+
+	/* and its parent, unless it is at the top level */
+	while (namelen > 0 && ce->name[namelen - 1] != '/')
+		namelen--;
+	if (namelen > 1)
+		dir->parent = hash_dir_entry(istate, ce, namelen - 1,
+					     hash_name(ce->name, namelen - 1));
+	return dir;
+}
+
+static void add_dir_entry(struct index_state *istate, struct cache_entry *ce,
+			  const struct name_hashes *h)
+{
+	struct dir_hash_entry *dir, *d;
+
+	if (!h->dir_len)
+		return;
+	dir = hash_dir_entry(istate, ce, h->dir_len, h->dir_hash);
+	for (d = dir; d; d = d->parent)
+		if (!d->ce)
+			d->ce = ce;
+	while (dir && !(dir->nr++))
+		dir = dir->parent;
+}
+
+static void remove_dir_entry(struct index_state *istate, struct cache_entry *ce)
+{
+	struct dir_hash_entry *dir, *d;
+	struct name_hashes h;
+
+	hash_name_and_dir(ce->name, ce_namelen(ce), &h);
+	if (!h.dir_len)
+		return;
+	dir = find_dir_entry(istate, ce->name, h.dir_len, h.dir_hash);
+	for (d = dir; d; d = d->parent)
+		if (d->ce == ce)
+			d->ce = NULL;
+	while (dir && dir->nr && !(--dir->nr))
+		dir = dir->parent;
+}
+
+static void hash_index_entry(struct index_state *istate, struct cache_entry *ce,
+			     const struct name_hashes *h)
 {
 	void **pos;
-	unsigned int hash;
 
 	if (ce->ce_flags & CE_HASHED)
 		return;
 	ce->ce_flags |= CE_HASHED;
 	ce->next = NULL;
-	hash = hash_name(ce->name, ce_namelen(ce));
-	pos = insert_hash(hash, ce, &istate->name_hash);
+	pos = insert_hash(h->hash, ce, &istate->name_hash);
 	if (pos) {
 		ce->next = *pos;
 		*pos = ce;
 	}
+	if (ignore_case && !(ce->ce_flags & CE_UNHASHED))
+		add_dir_entry(istate, ce, h);
+}
+
+/*
+ * Hashing the names is what is expensive for a large index, and it
+ * is independent for every entry; split that among threads and only
+ * insert the results into the tables serially.
+ */
+#define LAZY_MIN_PER_THREAD 4000
+#define LAZY_MAX_THREADS 16
+
+struct lazy_hash_range {
+	struct index_state *istate;
+	struct name_hashes *hashes;
+	int begin, end;
+};
+
+static void *hash_range(void *data)
+{
+	struct lazy_hash_range *r = data;
+	int nr;
+
+	for (nr = r->begin; nr < r->end; nr++) {
+		struct cache_entry *ce = r->istate->cache[nr];
+		hash_name_and_dir(ce->name, ce_namelen(ce), &r->hashes[nr]);
+	}
+	return NULL;
+}
+
+static void hash_all_names(struct index_state *istate, struct name_hashes *hashes)
+{
+	struct lazy_hash_range r[LAZY_MAX_THREADS];
+	int i, nr_threads = 1;
+#ifdef USE_PTHREADS
+	pthread_t threads[LAZY_MAX_THREADS];
+	int started[LAZY_MAX_THREADS];
+
+	nr_threads = online_cpus();
+	if (nr_threads > istate->cache_nr / LAZY_MIN_PER_THREAD)
+		nr_threads = istate->cache_nr / LAZY_MIN_PER_THREAD;
+	if (nr_threads > LAZY_MAX_THREADS)
+		nr_threads = LAZY_MAX_THREADS;
+	if (nr_threads < 1)
+		nr_threads = 1;
+#endif
+
+	for (i = 0; i < nr_threads; i++) {
+		r[i].istate = istate;
+		r[i].hashes = hashes;
+		r[i].begin = (unsigned long)istate->cache_nr * i / nr_threads;
+		r[i].end = (unsigned long)istate->cache_nr * (i + 1) / nr_threads;
+	}
+#ifdef USE_PTHREADS
+	for (i = 1; i < nr_threads; i++)
+		started[i] = !pthread_create(&threads[i], NULL, hash_range, &r[i]);
+#endif
+	hash_range(&r[0]);
+#ifdef USE_PTHREADS
+	for (i = 1; i < nr_threads; i++) {
+		if (started[i])
+			pthread_join(threads[i], NULL);
+		else
+			hash_range(&r[i]);
+	}
+#endif
 }
 
 static void lazy_init_name_hash(struct index_state *istate)
 {
+	struct name_hashes *hashes;
 	int nr;
 
 	if (istate->name_hash_initialized)
 		return;
+	hashes = xmalloc(istate->cache_nr * sizeof(*hashes));
+	hash_all_names(istate, hashes);
 	for (nr = 0; nr < istate->cache_nr; nr++)
-		hash_index_entry(istate, istate->cache[nr]);
+		hash_index_entry(istate, istate->cache[nr], &hashes[nr]);
+	free(hashes);
 	istate->name_hash_initialized = 1;
 }
 
 void add_name_hash(struct index_state *istate, struct cache_entry *ce)
 {
+	if (istate->name_hash_initialized) {
+		struct name_hashes h;
+
+		if (!(ce->ce_flags & CE_HASHED)) {
+			ce->ce_flags &= ~CE_UNHASHED;
+			hash_name_and_dir(ce->name, ce_namelen(ce), &h);
+			hash_index_entry(istate, ce, &h);
+		} else if (ignore_case && (ce->ce_flags & CE_UNHASHED)) {
+			hash_name_and_dir(ce->name, ce_namelen(ce), &h);
+			add_dir_entry(istate, ce, &h);
+		}
+	}
 	ce->ce_flags &= ~CE_UNHASHED;
-	if (istate->name_hash_initialized)
-		hash_index_entry(istate, ce);
 }
 
-static int slow_same_name(const char *name1, int len1, const char *name2, int len2)
+void remove_name_hash(struct index_state *istate, struct cache_entry *ce)
 {
-	if (len1 != len2)
-		return 0;
+	if (ignore_case && istate->name_hash_initialized &&
+	    (ce->ce_flags & CE_HASHED) && !(ce->ce_flags & CE_UNHASHED))
+		remove_dir_entry(istate, ce);
+	ce->ce_flags |= CE_UNHASHED;
+}
 
-	while (len1) {
-		unsigned char c1 = *name1++;
-		unsigned char c2 = *name2++;
-		len1--;
-		if (c1 != c2) {
-			c1 = toupper(c1);
-			c2 = toupper(c2);
-			if (c1 != c2)
-				return 0;
-		}
+static int free_dir_chain(void *ptr)
+{
+	struct dir_hash_entry *dir = ptr;
+
+	while (dir) {
+		struct dir_hash_entry *next = dir->next;
+		free(dir);
+		dir = next;
 	}
-	return 1;
+	return 0;
+}
+
+void free_name_hash(struct index_state *istate)
+{
+	free_hash(&istate->name_hash);
+	for_each_hash(&istate->dir_hash, free_dir_chain);
+	free_hash(&istate->dir_hash);
+	istate->name_hash_initialized = 0;
 }
 
 static int same_name(const struct cache_entry *ce, const char *name, int namelen, int icase)
@@ -100,12 +327,59 @@ static int same_name(const struct cache_entry *ce, const char *name, int namelen
 	return icase && slow_same_name(name, namelen, ce->name, len);
 }
 
+/*
+ * An entry inside the directory, for when the one it remembered was
+ * removed.  Searching the index for another is slow, but we keep what
+ * we find, and "dir/" lookups are rare.
+ */
+static struct cache_entry *dir_entry_ce(struct index_state *istate,
+					struct dir_hash_entry *dir)
+{
+	int nr;
+
+	if (dir->ce)
+		return dir->ce;
+	for (nr = 0; nr < istate->cache_nr; nr++) {
+		struct cache_entry *ce = istate->cache[nr];
+
+		if (!(ce->ce_flags & CE_UNHASHED) &&
+		    ce_namelen(ce) > dir->namelen &&
+		    ce->name[dir->namelen] == '/' &&
+		    slow_same_name(ce->name, dir->namelen,
+				   dir->name, dir->namelen))
+			return dir->ce = ce;
+	}
+	return NULL;
+}
+
+int index_dir_exists(struct index_state *istate, const char *name, int namelen)
+{
+	struct dir_hash_entry *dir;
+
+	lazy_init_name_hash(istate);
+	dir = find_dir_entry(istate, name, namelen, hash_name(name, namelen));
+	return dir && dir->nr;
+}
+
 struct cache_entry *index_name_exists(struct index_state *istate, const char *name, int namelen, int icase)
 {
 	unsigned int hash = hash_name(name, namelen);
 	struct cache_entry *ce;
 
 	lazy_init_name_hash(istate);
+
+	/*
+	 * "dir/" asks whether anything is in that directory; answer
+	 * with one of its entries, good enough for existence checks.
+	 */
+	if (icase && ignore_case && namelen > 1 && name[namelen - 1] == '/') {
+		struct dir_hash_entry *dir;
+		dir = find_dir_entry(istate, name, namelen - 1,
+				     hash_name(name, namelen - 1));
+		if (dir && dir->nr)
+			return dir_entry_ce(istate, dir);
+	}
+
 	ce = lookup_hash(hash, &istate->name_hash);
 
 	while (ce) {
@@ -1,5 +1,6 @@
 #include "cache.h"
 #include "pkt-line.h"
+#include "sideband.h"
 
 /*
  * Write a packetized stream, where each line is preceded by
@@ -43,10 +44,18 @@ void packet_flush(int fd)
 }
 
 #define hex(a) (hexchar[(a) & 15])
+static void set_packet_header(char *buf, unsigned n)
+{
+	static char hexchar[] = "0123456789abcdef";
+	buf[0] = hex(n >> 12);
+	buf[1] = hex(n >> 8);
+	buf[2] = hex(n >> 4);
+	buf[3] = hex(n);
+}
+
 void packet_write(int fd, const char *fmt, ...)
 {
 	static char buffer[1000];
-	static char hexchar[] = "0123456789abcdef";
 	va_list args;
 	unsigned n;
 
@@ -56,29 +65,72 @@ void packet_write(int fd, const char *fmt, ...)
 	if (n >= sizeof(buffer)-4)
 		die("protocol error: impossibly long line");
 	n += 4;
-	buffer[0] = hex(n >> 12);
-	buffer[1] = hex(n >> 8);
-	buffer[2] = hex(n >> 4);
-	buffer[3] = hex(n);
+	set_packet_header(buffer, n);
 	safe_write(fd, buffer, n);
 }
 
-static void safe_read(int fd, void *buffer, unsigned size)
+/*
+ * Binary-safe variants that report errors to the caller instead of
+ * dying; used when talking to a helper process whose failure should
+ * not take us down with it.
+ */
+int packet_flush_gently(int fd)
+{
+	if (write_in_full(fd, "0000", 4) != 4)
+		return error("flush packet write failed");
+	return 0;
+}
+
+int packet_write_gently(int fd, const char *buf, unsigned size)
+{
+	static char packet[LARGE_PACKET_MAX];
+
+	if (size > sizeof(packet) - 4)
+		return error("packet write failed: data exceeds max packet size");
+	set_packet_header(packet, size + 4);
+	memcpy(packet + 4, buf, size);
+	if (write_in_full(fd, packet, size + 4) != size + 4)
+		return error("packet write failed");
+	return 0;
+}
+
+int packet_write_data_gently(int fd, const char *buf, unsigned long size)
+{
+	while (size) {
+		unsigned chunk = LARGE_PACKET_MAX - 4;
+		if (size < chunk)
+			chunk = size;
+		if (packet_write_gently(fd, buf, chunk))
+			return -1;
+		buf += chunk;
+		size -= chunk;
+	}
+	return 0;
+}
+
+static int safe_read(int fd, void *buffer, unsigned size, int gently)
 {
 	ssize_t ret = read_in_full(fd, buffer, size);
-	if (ret < 0)
+	if (ret < 0) {
+		if (gently)
+			return error("read error (%s)", strerror(errno));
 		die("read error (%s)", strerror(errno));
-	else if (ret < size)
+	} else if (ret < size) {
+		if (gently)
+			return error("The remote end hung up unexpectedly");
 		die("The remote end hung up unexpectedly");
+	}
+	return 0;
 }
 
-int packet_read_line(int fd, char *buffer, unsigned size)
+static int packet_read_internal(int fd, char *buffer, unsigned size, int gently)
 {
 	int n;
 	unsigned len;
 	char linelen[4];
 
-	safe_read(fd, linelen, 4);
+	if (safe_read(fd, linelen, 4, gently))
+		return -1;
 
 	len = 0;
 	for (n = 0; n < 4; n++) {
@@ -96,14 +148,30 @@ int packet_read_line(int fd, char *buffer, unsigned size)
 			len += c - 'A' + 10;
 			continue;
 		}
+		if (gently)
+			return error("protocol error: bad line length character");
 		die("protocol error: bad line length character");
 	}
 	if (!len)
 		return 0;
 	len -= 4;
-	if (len >= size)
+	if (len >= size) {
+		if (gently)
+			return error("protocol error: bad line length %d", len);
 		die("protocol error: bad line length %d", len);
-	safe_read(fd, buffer, len);
+	}
+	if (safe_read(fd, buffer, len, gently))
+		return -1;
 	buffer[len] = 0;
 	return len;
 }
+
+int packet_read_line(int fd, char *buffer, unsigned size)
+{
+	return packet_read_internal(fd, buffer, size, 0);
+}
+
+int packet_read_gently(int fd, char *buffer, unsigned size)
+{
+	return packet_read_internal(fd, buffer, size, 1);
+}
@@ -10,6 +10,16 @@ void packet_flush(int fd);
 void packet_write(int fd, const char *fmt, ...) __attribute__((format (printf, 2, 3)));
 
 int packet_read_line(int fd, char *buffer, unsigned size);
+
+/*
+ * Binary-safe, non-dying variants; return negative on error
+ * after reporting it.  packet_write_data_gently() splits its
+ * buffer into as many packets as needed, without a trailing flush.
+ */
+int packet_flush_gently(int fd);
+int packet_write_gently(int fd, const char *buf, unsigned size);
+int packet_write_data_gently(int fd, const char *buf, unsigned long size);
+int packet_read_gently(int fd, char *buffer, unsigned size);
 ssize_t safe_write(int, const void *, ssize_t);
 
 #endif
@@ -0,0 +1,241 @@
+/*
+ * rename-cache.c
+ *
+ * Remember the similarity scores of inexact rename detection across
+ * commands, so that "log -M", "diff -M" and merges that compare the
+ * same pair of blobs again do not have to read and hash them again.
+ *
+ * $GIT_DIR/rename-cache is a header followed by entries sorted by
+ * (source blob, destination blob), looked up by bisection.  Only pairs
+ * whose sizes are close enough to be compared at all are recorded; the
+ * score does not depend on the minimum score the caller asked for.
+ * New scores are kept in memory and merged into the file at exit.
+ */
+#include "cache.h"
+#include "rename-cache.h"
+#ifdef USE_PTHREADS
+#include <pthread.h>
+#endif
+
+#define RENAME_CACHE_SIGNATURE 0x524e4d43	/* "RNMC" */
+#define RENAME_CACHE_VERSION 1
+
+struct rename_cache_header {
+	uint32_t signature;
+	uint32_t version;
+	uint32_t nr;
+};
+
+struct rename_cache_entry {
+	unsigned char sha1[40];		/* source and destination */
+	uint32_t score;
+};
+
+static const struct rename_cache_entry *cached;
+static uint32_t cached_nr;
+static void *cache_map;
+static size_t cache_map_size;
+static int cache_prepared;
+
+static struct rename_cache_entry *added;
+static int added_nr, added_alloc;
+
+static struct lock_file cache_lock;
+
+#ifdef USE_PTHREADS
+static pthread_mutex_t added_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define added_lock()		pthread_mutex_lock(&added_mutex)
+#define added_unlock()		pthread_mutex_unlock(&added_mutex)
+#else
+#define added_lock()		(void)0
+#define added_unlock()		(void)0
+#endif
+
+static void write_rename_cache(void);
+
+void prepare_rename_cache(void)
+{
+	const struct rename_cache_header *hdr;
+	struct stat st;
+	int fd;
+
+	if (cache_prepared)
+		return;
+	cache_prepared = 1;
+
+	fd = open(git_path("rename-cache"), O_RDONLY);
+	if (fd < 0)
+		return;
+	if (fstat(fd, &st) || st.st_size < sizeof(*hdr)) {
+		close(fd);
+		return;
+	}
+	cache_map_size = xsize_t(st.st_size);
+	cache_map = xmmap(NULL, cache_map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	hdr = cache_map;
+	if (ntohl(hdr->signature) != RENAME_CACHE_SIGNATURE ||
+	    ntohl(hdr->version) != RENAME_CACHE_VERSION ||
+	    cache_map_size != sizeof(*hdr) +
+	    (size_t)ntohl(hdr->nr) * sizeof(struct rename_cache_entry)) {
+		/* not ours, or from another version; start over */
+		munmap(cache_map, cache_map_size);
+		cache_map = NULL;
+		return;
+	}
+	cached = (const struct rename_cache_entry *)(hdr + 1);
+	cached_nr = ntohl(hdr->nr);
+}
+
+static const struct rename_cache_entry *find_entry(const unsigned char *key)
+{
+	uint32_t lo = 0, hi = cached_nr;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = memcmp(cached[mi].sha1, key, 40);
+		if (!cmp)
+			return &cached[mi];
+		if (cmp < 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return NULL;
+}
+
+/*
+ * Returns the score of the pair, or -1 if it is not known.  Only looks
+ * at what was read by prepare_rename_cache(), so it is safe to call
+ * from several threads.
+ */
+int rename_cache_lookup(const unsigned char *src, const unsigned char *dst)
+{
+	const struct rename_cache_entry *e;
+	unsigned char key[40];
+
+	if (!cached_nr)
+		return -1;
+	hashcpy(key, src);
+	hashcpy(key + 20, dst);
+	e = find_entry(key);
+	return e ? ntohl(e->score) : -1;
+}
+
+void rename_cache_record(const unsigned char *src, const unsigned char *dst,
+			 int score)
+{
+	struct rename_cache_entry *e;
+
+	added_lock();
+	if (!added_alloc)
+		atexit(write_rename_cache);
+	ALLOC_GROW(added, added_nr + 1, added_alloc);
+	e = &added[added_nr++];
+	hashcpy(e->sha1, src);
+	hashcpy(e->sha1 + 20, dst);
+	e->score = htonl(score);
+	added_unlock();
+}
+
+static int entry_cmp(const void *a_, const void *b_)
+{
+	const struct rename_cache_entry *a = a_, *b = b_;
+	return memcmp(a->sha1, b->sha1, 40);
+}
+
+/*
+ * Merge the entries of "a" and "b" (each sorted) into the locked file,
+ * skipping duplicates and those "keep" does not want, and commit it.
+ * An empty cache is simply removed.
+ */
+static int write_entries(const struct rename_cache_entry *a, uint32_t a_nr,
+			 const struct rename_cache_entry *b, uint32_t b_nr,
+			 int (*keep)(const unsigned char *))
+{
+	struct rename_cache_header hdr;
+	const char *path = git_path("rename-cache");
+	uint32_t i = 0, j = 0, nr = 0;
+	int fd;
+
+	fd = hold_lock_file_for_update(&cache_lock, path, 0);
+	if (fd < 0)
+		return -1;
+
+	memset(&hdr, 0, sizeof(hdr));
+	if (write_in_full(fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+		goto fail;
+	while (i < a_nr || j < b_nr) {
+		const struct rename_cache_entry *e;
+		int cmp;
+
+		if (i == a_nr)
+			cmp = 1;
+		else if (j == b_nr)
+			cmp = -1;
+		else
+			cmp = entry_cmp(&a[i], &b[j]);
+		e = cmp <= 0 ? &a[i++] : &b[j++];
+		if (!cmp)
+			j++;
+		if (keep && !(keep(e->sha1) && keep(e->sha1 + 20)))
+			continue;
+		if (write_in_full(fd, e, sizeof(*e)) != sizeof(*e))
+			goto fail;
+		nr++;
+	}
+
+	if (!nr) {
+		rollback_lock_file(&cache_lock);
+		unlink(path);
+		return 0;
+	}
+	hdr.signature = htonl(RENAME_CACHE_SIGNATURE);
+	hdr.version = htonl(RENAME_CACHE_VERSION);
+	hdr.nr = htonl(nr);
+	if (lseek(fd, 0, SEEK_SET) ||
+	    write_in_full(fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+		goto fail;
+	return commit_lock_file(&cache_lock);
+
+fail:
+	rollback_lock_file(&cache_lock);
+	return -1;
+}
+
+static void write_rename_cache(void)
+{
+	int i, nr;
+
+	if (!added_nr)
+		return;
+	qsort(added, added_nr, sizeof(*added), entry_cmp);
+	for (i = nr = 0; i < added_nr; i++)
+		if (!nr || entry_cmp(&added[nr - 1], &added[i]))
+			added[nr++] = added[i];
+	added_nr = 0;
+
+	/*
+	 * The cache is only an optimization; if somebody else is
+	 * updating it (or we cannot write), just drop what we learned.
+	 */
+	write_entries(cached, cached_nr, added, nr, NULL);
+}
+
+/*
+ * Drop the entries for which "keep" does not want to keep both blobs,
+ * e.g. because they are not reachable anymore.
+ */
+int prune_rename_cache(int (*keep)(const unsigned char *sha1))
+{
+	uint32_t i;
+
+	prepare_rename_cache();
+	for (i = 0; i < cached_nr; i++)
+		if (!keep(cached[i].sha1) || !keep(cached[i].sha1 + 20))
+			break;
+	if (i == cached_nr)
+		return 0;
+	return write_entries(cached, cached_nr, NULL, 0, keep);
+}
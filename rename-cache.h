@@ -0,0 +1,10 @@
+#ifndef RENAME_CACHE_H
+#define RENAME_CACHE_H
+
+extern void prepare_rename_cache(void);
+extern int rename_cache_lookup(const unsigned char *src, const unsigned char *dst);
+extern void rename_cache_record(const unsigned char *src, const unsigned char *dst,
+				int score);
+extern int prune_rename_cache(int (*keep)(const unsigned char *sha1));
+
+#endif
@@ -9,6 +9,7 @@
 #include "grep.h"
 #include "reflog-walk.h"
 #include "patch-ids.h"
+#include "bloom.h"
 
 volatile show_early_output_fn_t show_early_output;
 
@@ -328,10 +329,34 @@ static int rev_same_tree_as_empty(struct rev_info *revs, struct tree *t1)
 	return retval >= 0 && (tree_difference == REV_TREE_SAME);
 }
 
+/*
+ * The changed-path filter of the commit (see bloom.c) can tell us
+ * without a tree diff that none of the paths we are limited to
+ * changed since its first parent.
+ */
+static int bloom_filter_says_same(struct rev_info *revs, struct commit *commit)
+{
+	struct bloom_filter filter;
+	const char **path;
+
+	if (!revs->prune_data ||
+	    get_bloom_filter(commit->object.sha1, &filter) ||
+	    lookup_commit_graft(commit->object.sha1))
+		return 0;
+	for (path = revs->prune_data; *path; path++) {
+		int len = strlen(*path);
+		while (len && (*path)[len - 1] == '/')
+			len--;
+		if (!len || bloom_filter_may_contain(&filter, *path, len))
+			return 0;
+	}
+	return 1;
+}
+
 static void try_to_simplify_commit(struct rev_info *revs, struct commit *commit)
 {
 	struct commit_list **pp, *parent;
-	int tree_changed = 0, tree_same = 0;
+	int tree_changed = 0, tree_same = 0, compare;
 
 	/*
 	 * If we don't do pruning, everything is interesting
@@ -343,7 +368,8 @@ static void try_to_simplify_commit(struct rev_info *revs, struct commit *commit)
 		return;
 
 	if (!commit->parents) {
-		if (rev_same_tree_as_empty(revs, commit->tree))
+		if (bloom_filter_says_same(revs, commit) ||
+		    rev_same_tree_as_empty(revs, commit->tree))
 			commit->object.flags |= TREESAME;
 		return;
 	}
@@ -363,7 +389,12 @@ static void try_to_simplify_commit(struct rev_info *revs, struct commit *commit)
 			die("cannot simplify commit %s (because of %s)",
 			    sha1_to_hex(commit->object.sha1),
 			    sha1_to_hex(p->object.sha1));
-		switch (rev_compare_tree(revs, p->tree, commit->tree)) {
+		if (parent == commit->parents &&
+		    bloom_filter_says_same(revs, commit))
+			compare = REV_TREE_SAME;
+		else
+			compare = rev_compare_tree(revs, p->tree, commit->tree);
+		switch (compare) {
 		case REV_TREE_SAME:
 			tree_same = 1;
 			if (!revs->simplify_history || (p->object.flags & UNINTERESTING)) {
@@ -1,4 +1,120 @@
 #include "cache.h"
+#include "hash.h"
+
+/*
+ * Leading directories known to exist, so that an operation that
+ * writes or checks many paths (e.g. a checkout) stats and creates
+ * each directory only once.  The cache is only consulted between
+ * dir_cache_begin() and dir_cache_end(); whoever removes directories
+ * in between must call dir_cache_invalidate().
+ */
+struct dir_cache_entry {
+	struct dir_cache_entry *next;
+	unsigned generation;
+	unsigned flags;
+	int len;
+	char name[FLEX_ARRAY];
+};
+
+static struct hash_table dir_cache;
+static unsigned dir_cache_generation = 1;
+static int dir_cache_active;
+
+static unsigned int hash_dir(const char *name, int len)
+{
+	unsigned int hash = 0x123;
+
+	while (len--)
+		hash = hash * 101 + (unsigned char)*name++;
+	return hash;
+}
+
+static struct dir_cache_entry *find_dir(const char *name, int len,
+					unsigned int hash)
+{
+	struct dir_cache_entry *dir = lookup_hash(hash, &dir_cache);
+
+	for (; dir; dir = dir->next)
+		if (dir->len == len && !memcmp(dir->name, name, len))
+			return dir;
+	return NULL;
+}
+
+void dir_cache_begin(void)
+{
+	dir_cache_active++;
+}
+
+static int free_dir_chain(void *ptr)
+{
+	struct dir_cache_entry *dir = ptr;
+
+	while (dir) {
+		struct dir_cache_entry *next = dir->next;
+		free(dir);
+		dir = next;
+	}
+	return 0;
+}
+
+void dir_cache_end(void)
+{
+	if (--dir_cache_active)
+		return;
+	for_each_hash(&dir_cache, free_dir_chain);
+	free_hash(&dir_cache);
+	init_hash(&dir_cache);
+}
+
+void dir_cache_invalidate(void)
+{
+	dir_cache_generation++;
+}
+
+int dir_cache_has(const char *name, int len, unsigned flags)
+{
+	struct dir_cache_entry *dir;
+
+	if (!dir_cache_active)
+		return 0;
+	dir = find_dir(name, len, hash_dir(name, len));
+	return dir && dir->generation == dir_cache_generation &&
+		(dir->flags & flags) == flags;
+}
+
+void dir_cache_add(const char *name, int len, unsigned flags)
+{
+	unsigned int hash;
+	struct dir_cache_entry *dir;
+	void **pos;
+
+	if (!dir_cache_active)
+		return;
+	/* a real directory is reachable, too */
+	if (flags & DIR_CACHE_LSTAT)
+		flags |= DIR_CACHE_STAT;
+	hash = hash_dir(name, len);
+	dir = find_dir(name, len, hash);
+	if (dir) {
+		if (dir->generation != dir_cache_generation)
+			dir->flags = 0;
+		dir->generation = dir_cache_generation;
+		dir->flags |= flags;
+		return;
+	}
+	dir = xmalloc(sizeof(*dir) + len + 1);
+	dir->next = NULL;
+	dir->generation = dir_cache_generation;
+	dir->flags = flags;
+	dir->len = len;
+	memcpy(dir->name, name, len);
+	dir->name[len] = 0;
+	pos = insert_hash(hash, dir, &dir_cache);
+	if (pos) {
+		dir->next = *pos;
+		*pos = dir;
+	}
+}
 
 struct pathname {
 	int len;
@@ -44,6 +160,11 @@ int has_symlink_leading_path(int len, const char *name)
 
 	while ((sp = strchr(name + known_dir + 1, '/')) != NULL) {
 		int thislen = sp - name ;
+
+		if (dir_cache_has(name, thislen, DIR_CACHE_LSTAT)) {
+			known_dir = thislen;
+			continue;
+		}
 		memcpy(path, name, thislen);
 		path[thislen] = 0;
 
@@ -51,6 +172,7 @@ int has_symlink_leading_path(int len, const char *name)
 			return 0;
 		if (S_ISDIR(st.st_mode)) {
 			set_pathname(thislen, path, &nonlink);
+			dir_cache_add(path, thislen, DIR_CACHE_LSTAT);
 			known_dir = thislen;
 			continue;
 		}
@@ -436,4 +436,34 @@ test_expect_success 'invalid .gitattributes (must not crash)' '
 
 '
 
+test_expect_success 'CRLF conversion across block boundaries' '
+
+	for n in 0 1 14 15 16 17 31 32 33
+	do
+		printf "%${n}s\r\nx\r\n" "" >crlf.$n &&
+		printf "%${n}s\nx\n" "" >lf.$n &&
+		test-convert --to-git <crlf.$n >out &&
+		cmp lf.$n out &&
+		test-convert --to-worktree <lf.$n >out &&
+		cmp crlf.$n out || return 1
+	done
+'
+
+test_expect_success 'lone CR and binary contents are left alone' '
+
+	printf "0123456789abcdef\r0123456789\r\n" >lone-cr &&
+	test-convert --to-git <lone-cr >out &&
+	cmp lone-cr out &&
+	printf "0123456789abcde\0\n0123456789\n" >nul &&
+	test-convert --to-worktree <nul >out &&
+	cmp nul out &&
+	printf "0123456789\001\002\003\004\005\006\016\017\020\021\n" >ctrl &&
+	test-convert --to-worktree <ctrl >out &&
+	cmp ctrl out &&
+	printf "%300s\001\177\n" "" >mostly-text &&
+	printf "%300s\001\177\r\n" "" >expect &&
+	test-convert --to-worktree <mostly-text >out &&
+	cmp expect out
+'
+
 test_done
@@ -88,4 +88,94 @@ test_expect_success expanded_in_repo '
 	cmp expanded-keywords expected-output
 '
 
+cat <<\EOF >rot13-process.perl
+use strict;
+$| = 1;
+binmode STDIN; binmode STDOUT;
+
+open my $log, '>>', 'rot13-process.log' or die;
+
+sub rd {
+	my $len;
+	read(STDIN, $len, 4) == 4 or return undef;
+	$len = hex($len);
+	return "" if $len == 0;
+	my $buf;
+	read(STDIN, $buf, $len - 4) == $len - 4 or die "short read";
+	return $buf;
+}
+sub wr { my $d = shift; printf "%04x%s", length($d) + 4, $d; }
+sub fl { print "0000"; }
+
+rd() eq "git-filter-client\n" or die "bad welcome";
+rd() eq "version=2\n" or die "bad version";
+rd() eq "" or die "no flush";
+wr("git-filter-server\n"); wr("version=2\n"); fl();
+while ((my $l = rd()) ne "") { }
+wr("capability=clean\n"); wr("capability=smudge\n"); fl();
+
+while (defined(my $cmd = rd())) {
+	$cmd =~ s/^command=(.*)\n$/$1/ or die "bad command";
+	my $path = rd();
+	$path =~ s/^pathname=(.*)\n$/$1/ or die "bad pathname";
+	rd() eq "" or die "no flush";
+	my ($data, $buf) = ("", undef);
+	$data .= $buf while (($buf = rd()) ne "");
+	print $log "$$ $cmd $path\n";
+	if ($path =~ /fail/) {
+		wr("status=error\n"); fl();
+		next;
+	}
+	$data =~ tr/a-zA-Z/n-za-mN-ZA-M/;
+	wr("status=success\n"); fl();
+	wr($1) while ($data =~ /(.{1,65516})/sg);
+	fl(); fl();
+}
+EOF
+
+test_expect_success 'long-running filter process' '
+	git config filter.proc.process "perl \"$(pwd)/rot13-process.perl\"" &&
+	echo "*.r filter=proc" >>.gitattributes &&
+	rm -f rot13-process.log &&
+
+	cat test.o >one.r &&
+	cat test.o >two.r &&
+	git add one.r two.r &&
+
+	git cat-file blob :one.r >one.git &&
+	./rot13.sh <test.o >expect &&
+	cmp expect one.git &&
+
+	rm -f one.r two.r &&
+	git checkout -- one.r two.r &&
+	cmp test.o one.r &&
+	cmp test.o two.r &&
+
+	grep "clean one.r" rot13-process.log &&
+	grep "smudge two.r" rot13-process.log
+'
+
+test_expect_success 'one filter process serves the whole command' '
+	rm -f rot13-process.log one.r two.r &&
+	git checkout -- one.r two.r &&
+	test $(wc -l <rot13-process.log) = 2 &&
+	test $(cut -d" " -f1 rot13-process.log | sort -u | wc -l) = 1
+'
+
+test_expect_success 'filter process failure leaves contents alone' '
+	cat test.o >fail.r &&
+	git add fail.r &&
+	git cat-file blob :fail.r >fail.git &&
+	cmp test.o fail.git
+'
+
+test_expect_success 'fall back to smudge/clean when the process is unusable' '
+	git config filter.proc.process false &&
+	git config filter.proc.clean ./rot13.sh &&
+	cat test.o >three.r &&
+	git add three.r &&
+	git cat-file blob :three.r >three.git &&
+	cmp expect three.git
+'
+
 test_done
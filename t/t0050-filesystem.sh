@@ -90,4 +90,25 @@ $test_unicode 'merge (silent unicode normalization)' '
 
 '
 
+test_expect_success 'ignorecase: directories match the index case-insensitively' '
+
+	rm -fr dirtest && mkdir dirtest &&
+	(
+		cd dirtest &&
+		git init &&
+		mkdir -p dir a/b/c &&
+		>dir/tracked && >a/b/c/tracked &&
+		git add dir a &&
+		mkdir -p DIR/sub A/B &&
+		>DIR/sub/untracked && >A/B/untracked &&
+		git ls-files -o --directory >../actual &&
+		printf "A/\nDIR/\n" >../expect &&
+		diff -u ../expect ../actual &&
+		git config core.ignorecase true &&
+		git ls-files -o --directory >../actual &&
+		printf "A/B/untracked\nDIR/sub/\n" >../expect &&
+		diff -u ../expect ../actual
+	)
+'
+
 test_done
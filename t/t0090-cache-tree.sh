@@ -0,0 +1,99 @@
+#!/bin/sh
+
+test_description="Test whether cache-tree is properly updated
+
+Tests whether various commands properly update and/or rewrite the
+cache-tree extension.
+"
+. ./test-lib.sh
+
+test_cache_tree_valid () {
+	test-dump-cache-tree >dump &&
+	! grep "^invalid" dump
+}
+
+test_cache_tree_invalid () {
+	test-dump-cache-tree >dump &&
+	grep "^invalid" dump >/dev/null
+}
+
+test_expect_success setup '
+	mkdir dir sub sub/deep &&
+	for f in one dir/two sub/three sub/deep/four
+	do
+		echo $f >$f || exit
+	done &&
+	git add . &&
+	git commit -m initial &&
+	git tag initial &&
+	echo changed >sub/deep/four &&
+	git commit -a -m second &&
+	git tag second
+'
+
+test_expect_success 'commit -a leaves a valid cache-tree' '
+	test_cache_tree_valid
+'
+
+test_expect_success 'add invalidates only what it touches' '
+	echo more >>sub/three &&
+	git add sub/three &&
+	test_cache_tree_invalid &&
+	grep "^invalid *sub/ " dump &&
+	! grep "^invalid *dir/ " dump &&
+	! grep "^invalid *sub/deep/ " dump
+'
+
+test_expect_success 'as-is commit leaves a valid cache-tree' '
+	git commit -m third &&
+	test_cache_tree_valid
+'
+
+test_expect_success 'partial commit leaves a valid cache-tree' '
+	echo more >>dir/two &&
+	git commit -m fourth dir/two &&
+	test_cache_tree_valid
+'
+
+test_expect_success 'read-tree leaves a valid cache-tree' '
+	git read-tree initial &&
+	test_cache_tree_valid &&
+	git read-tree --reset HEAD &&
+	test_cache_tree_valid &&
+	git read-tree -m HEAD &&
+	test_cache_tree_valid
+'
+
+test_expect_success 'checkout leaves a valid cache-tree' '
+	git checkout -b side initial &&
+	test_cache_tree_valid &&
+	git checkout master &&
+	test_cache_tree_valid
+'
+
+test_expect_success 'checkout with local changes keeps the rest valid' '
+	echo local >one &&
+	git add one &&
+	git checkout side &&
+	test_cache_tree_invalid &&
+	grep "^invalid *(" dump &&
+	! grep "^invalid *sub/ " dump &&
+	git checkout -f master
+'
+
+test_expect_success 'reset --hard leaves a valid cache-tree' '
+	echo more >>sub/deep/four &&
+	git add sub/deep/four &&
+	git reset --hard &&
+	test_cache_tree_valid
+'
+
+test_expect_success 'merge leaves a valid cache-tree' '
+	git checkout side &&
+	echo side >>one &&
+	git commit -a -m side &&
+	git merge master &&
+	test_cache_tree_valid
+'
+
+test_done
@@ -0,0 +1,199 @@
+#!/bin/sh
+
+test_description='histogram diff algorithm'
+
+. ./test-lib.sh
+
+cat >file1 <<\EOF
+#include <stdio.h>
+
+// Frobs foo heartily
+int frobnitz(int foo)
+{
+    int i;
+    for(i = 0; i < 10; i++)
+    {
+        printf("Your answer is: ");
+        printf("%d\n", foo);
+    }
+}
+
+int fact(int n)
+{
+    if(n > 1)
+    {
+        return fact(n-1) * n;
+    }
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    frobnitz(fact(10));
+}
+EOF
+
+cat >file2 <<\EOF
+#include <stdio.h>
+
+int fib(int n)
+{
+    if(n > 2)
+    {
+        return fib(n-1) + fib(n-2);
+    }
+    return 1;
+}
+
+// Frobs foo heartily
+int frobnitz(int foo)
+{
+    int i;
+    for(i = 0; i < 10; i++)
+    {
+        printf("%d\n", foo);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    frobnitz(fib(10));
+}
+EOF
+
+cat >expect <<\EOF
+@@ -1,26 +1,25 @@
+ #include <stdio.h>
+ 
++int fib(int n)
++{
++    if(n > 2)
++    {
++        return fib(n-1) + fib(n-2);
++    }
++    return 1;
++}
++
+ // Frobs foo heartily
+ int frobnitz(int foo)
+ {
+     int i;
+     for(i = 0; i < 10; i++)
+     {
+-        printf("Your answer is: ");
+         printf("%d\n", foo);
+     }
+ }
+ 
+-int fact(int n)
+-{
+-    if(n > 1)
+-    {
+-        return fact(n-1) * n;
+-    }
+-    return 1;
+-}
+-
+ int main(int argc, char **argv)
+ {
+-    frobnitz(fact(10));
++    frobnitz(fib(10));
+ }
+EOF
+
+cat >expect-myers <<\EOF
+@@ -1,26 +1,25 @@
+ #include <stdio.h>
+ 
+-// Frobs foo heartily
+-int frobnitz(int foo)
++int fib(int n)
+ {
+-    int i;
+-    for(i = 0; i < 10; i++)
++    if(n > 2)
+     {
+-        printf("Your answer is: ");
+-        printf("%d\n", foo);
++        return fib(n-1) + fib(n-2);
+     }
++    return 1;
+ }
+ 
+-int fact(int n)
++// Frobs foo heartily
++int frobnitz(int foo)
+ {
+-    if(n > 1)
++    int i;
++    for(i = 0; i < 10; i++)
+     {
+-        return fact(n-1) * n;
++        printf("%d\n", foo);
+     }
+-    return 1;
+ }
+ 
+ int main(int argc, char **argv)
+ {
+-    frobnitz(fact(10));
++    frobnitz(fib(10));
+ }
+EOF
+
+test_expect_success setup '
+	cp file1 file &&
+	git add file &&
+	git commit -m initial &&
+	cp file2 file
+'
+
+test_expect_success 'histogram diff' '
+	git diff --histogram >out &&
+	sed -e "1,/^+++/d" out >actual &&
+	diff -u expect actual
+'
+
+test_expect_success 'default is still myers' '
+	git diff >out &&
+	sed -e "1,/^+++/d" out >actual &&
+	diff -u expect-myers actual
+'
+
+test_expect_success 'diff.algorithm selects histogram' '
+	git config diff.algorithm histogram &&
+	git diff >out &&
+	sed -e "1,/^+++/d" out >actual &&
+	diff -u expect actual
+'
+
+test_expect_success '--diff-algorithm overrides diff.algorithm' '
+	git diff --diff-algorithm=myers >out &&
+	sed -e "1,/^+++/d" out >actual &&
+	diff -u expect-myers actual &&
+	git config --unset diff.algorithm
+'
+
+test_expect_success 'unknown algorithm is rejected' '
+	! git diff --diff-algorithm=frotz
+'
+
+test_expect_success 'histogram diff of many repeated lines applies' '
+	for i in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20
+	do
+		for j in 1 2 3 4 5 6 7 8 9 10
+		do
+			echo "}" && echo && echo "line $j" || exit
+		done
+	done >repeated &&
+	git add repeated &&
+	sed -e "s/line 3/changed/" -e "/line 7/d" <repeated >repeated.new &&
+	mv repeated.new repeated &&
+	git diff --histogram repeated >patch &&
+	cp repeated expect-repeated &&
+	git checkout repeated &&
+	git apply patch &&
+	cmp expect-repeated repeated
+'
+
+test_done
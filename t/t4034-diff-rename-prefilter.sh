@@ -0,0 +1,51 @@
+#!/bin/sh
+
+test_description='rename detection beyond the rename limit with diff.renamePrefilter'
+. ./test-lib.sh
+
+make_text () {
+	i=1
+	while test $i -le 20
+	do
+		echo "$1: line $i"
+		i=$(($i + 1))
+	done
+}
+
+test_expect_success setup '
+	for i in 1 2 3 4 5 6 7 8
+	do
+		make_text file$i >file$i || exit
+	done &&
+	git add . &&
+	git commit -m initial &&
+	mkdir moved &&
+	for i in 1 2 3 4 5 6 7 8
+	do
+		git mv file$i moved/file$i &&
+		echo "edited $i" >>moved/file$i || exit
+	done &&
+	make_text unrelated >new &&
+	git add . &&
+	git commit -m moved &&
+	git diff -M --name-status HEAD^ HEAD >full &&
+	test $(grep -c "^R" full) = 8
+'
+
+test_expect_success 'no inexact renames beyond the limit' '
+	git diff -M -l2 --name-status HEAD^ HEAD >actual &&
+	! grep "^R" actual
+'
+
+test_expect_success 'prefilter finds the renames beyond the limit' '
+	git config diff.renamePrefilter true &&
+	git diff -M -l2 --name-status HEAD^ HEAD >actual &&
+	test_cmp full actual
+'
+
+test_expect_success 'prefilter is not used within the limit' '
+	git diff -M --name-status HEAD^ HEAD >actual &&
+	test_cmp full actual
+'
+
+test_done
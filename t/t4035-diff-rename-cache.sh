@@ -0,0 +1,146 @@
+#!/bin/sh
+
+test_description='remembering rename similarity scores with diff.renameCache'
+. ./test-lib.sh
+
+make_text () {
+	i=1
+	while test $i -le 20
+	do
+		echo "$1: line $i"
+		i=$(($i + 1))
+	done
+}
+
+# Write 50 files into directory $1, or append a line to each with $2.
+make_many () {
+	n=1
+	while test $n -le 50
+	do
+		if test -z "$2"
+		then
+			make_text many$n >$1/file$n
+		else
+			echo "$2 $n" >>$1/file$n
+		fi || return 1
+		n=$(($n + 1))
+	done
+}
+
+# Cut the last byte off the loose blobs of commit $1: their sizes can
+# still be read from the object header, but their contents cannot.
+break_blobs () {
+	mkdir -p saved &&
+	for blob in $(git ls-tree -r $1 | cut -d" " -f3 | cut -f1)
+	do
+		test -f saved/$blob && continue
+		obj=.git/objects/$(echo $blob | sed -e "s|^..|&/|") &&
+		size=$(wc -c <$obj) &&
+		mv $obj saved/$blob &&
+		head -c $(($size - 1)) saved/$blob >$obj || return 1
+	done
+}
+
+real_blobs () {
+	for blob in $(ls saved)
+	do
+		obj=.git/objects/$(echo $blob | sed -e "s|^..|&/|") &&
+		rm -f $obj &&
+		mv saved/$blob $obj || return 1
+	done
+}
+
+test_expect_success setup '
+	for i in 1 2 3 4
+	do
+		make_text file$i >file$i || exit
+	done &&
+	make_text crlf >crlf &&
+	git add . &&
+	git commit -m initial &&
+	mkdir moved &&
+	for i in 1 2 3 4
+	do
+		git mv file$i moved/file$i &&
+		echo "edited $i" >>moved/file$i || exit
+	done &&
+	git rm crlf &&
+	make_text crlf | sed -e "s/\$/Q/" | tr Q "\\015" >moved/crlf &&
+	git add moved/crlf &&
+	git commit -a -m moved &&
+	git diff -M --raw HEAD^ HEAD >expect &&
+	git diff -M90 --raw HEAD^ HEAD >expect-90 &&
+	echo "* -diff" >.gitattributes &&
+	git diff -M --raw HEAD^ HEAD >expect-binary &&
+	rm .gitattributes &&
+	! cmp expect expect-binary &&
+	! test -f .git/rename-cache
+'
+
+test_expect_success 'scores are remembered' '
+	git config diff.renameCache true &&
+	git diff -M --raw HEAD^ HEAD >actual &&
+	test_cmp expect actual &&
+	test -s .git/rename-cache
+'
+
+test_expect_success 'remembered scores give the same renames' '
+	git diff -M --raw HEAD^ HEAD >actual &&
+	test_cmp expect actual &&
+	git diff -M90 --raw HEAD^ HEAD >actual &&
+	test_cmp expect-90 actual
+'
+
+test_expect_success 'remembered scores need no blobs' '
+	break_blobs HEAD^ &&
+	break_blobs HEAD &&
+	git diff -M --raw HEAD^ HEAD >actual &&
+	real_blobs &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a corrupt cache is ignored' '
+	echo garbage >.git/rename-cache &&
+	git diff -M --raw HEAD^ HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'scores depending on the diff attribute are not remembered' '
+	git diff -M --raw HEAD^ HEAD >actual &&
+	test_cmp expect actual &&
+	echo "* -diff" >.gitattributes &&
+	git diff -M --raw HEAD^ HEAD >actual &&
+	rm .gitattributes &&
+	test_cmp expect-binary actual &&
+	git diff -M --raw HEAD^ HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'prune forgets unreachable blobs' '
+	git diff -M --raw HEAD^ HEAD >/dev/null &&
+	test -s .git/rename-cache &&
+	git prune &&
+	test -s .git/rename-cache &&
+	git reset --hard HEAD^ &&
+	rm -rf .git/logs &&
+	git prune &&
+	! test -f .git/rename-cache
+'
+
+test_expect_success 'remembered scores need no blobs with many renames' '
+	mkdir many &&
+	make_many many &&
+	git add many &&
+	git commit -m many &&
+	git mv many many-moved &&
+	make_many many-moved edited &&
+	git commit -a -m "many moved" &&
+	git diff -M --raw HEAD^ HEAD >expect-many &&
+	break_blobs HEAD^ &&
+	break_blobs HEAD &&
+	git diff -M --raw HEAD^ HEAD >actual &&
+	real_blobs &&
+	test_cmp expect-many actual
+'
+
+test_done
@@ -0,0 +1,42 @@
+#!/bin/sh
+
+test_description='pickaxe counts occurrences of the needle'
+. ./test-lib.sh
+
+test_expect_success setup '
+	echo "aa x" >file &&
+	echo other >other &&
+	git add file other &&
+	test_tick &&
+	git commit -m one &&
+	echo "x aa" >file &&
+	test_tick &&
+	git commit -a -m "still one" &&
+	echo "aaa aa" >file &&
+	echo more >>other &&
+	test_tick &&
+	git commit -a -m two &&
+	echo "aa x" >file &&
+	test_tick &&
+	git commit -a -m "back to one"
+'
+
+test_expect_success 'occurrences do not overlap' '
+	git log -Saa --pretty=format:%s >actual &&
+	printf "back to one\ntwo\none" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'same blob seen again' '
+	git log -Saaa --pretty=format:%s >actual &&
+	printf "back to one\ntwo" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'pickaxe-all shows the whole commit' '
+	git log -Saa --pickaxe-all --name-only --pretty=format:%s HEAD~1 >actual &&
+	printf "two\nfile\nother\n\none\nfile\nother\n" >expect &&
+	test_cmp expect actual
+'
+
+test_done
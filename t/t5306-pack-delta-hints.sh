@@ -0,0 +1,72 @@
+#!/bin/sh
+
+test_description='git-pack-objects --delta-hints'
+. ./test-lib.sh
+
+delta_pairs () {
+	git verify-pack -v "$1" |
+	grep -E "^[0-9a-f]{40} " |
+	awk 'NF > 6 { print $1, $7 }' |
+	sort
+}
+
+test_expect_success setup '
+	for i in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20
+	do
+		echo "line $i of a file that is long enough to make deltas"
+	done >file &&
+	cp file other &&
+	git add file other &&
+	git commit -m initial &&
+	for i in 1 2 3 4
+	do
+		echo "change $i" >>file &&
+		echo "other change $i" >>other &&
+		git commit -a -m "change $i" || break
+	done
+'
+
+test_expect_success 'pack-objects --delta-hints writes hints next to the pack' '
+	packname_1=$(git rev-list --objects --all |
+		git pack-objects --delta-hints test-1) &&
+	test -f test-1-$packname_1.hints &&
+	packname_2=$(git rev-list --objects --all |
+		git pack-objects test-2) &&
+	! test -f test-2-$packname_2.hints
+'
+
+test_expect_success 'repack keeps the hints with their pack' '
+	git config pack.deltaHints true &&
+	git repack -a -d &&
+	echo "change 5" >>file &&
+	git commit -a -m "change 5" &&
+	git repack -a -d &&
+	packs=$(ls .git/objects/pack/*.pack | sed -e "s/\.pack\$//") &&
+	hints=$(ls .git/objects/pack/*.hints | sed -e "s/\.hints\$//") &&
+	test "$packs" = "$hints" &&
+	test $(echo "$packs" | wc -l) = 1
+'
+
+test_expect_success 'hints give the same deltas without a window' '
+	delta_pairs .git/objects/pack/pack-*.idx >expect &&
+	test -s expect &&
+	packname_3=$(git rev-list --objects --all |
+		git pack-objects --window=0 --no-reuse-delta test-3) &&
+	delta_pairs test-3-$packname_3.idx >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'no deltas without a window and without hints' '
+	packname_4=$(git rev-list --objects --all |
+		git pack-objects --window=0 --no-reuse-delta --no-delta-hints test-4) &&
+	delta_pairs test-4-$packname_4.idx >actual &&
+	! test -s actual
+'
+
+test_expect_success 'hints against bases left out of the pack are ignored' '
+	packname_5=$(git rev-list --objects HEAD^^ |
+		git pack-objects --window=0 --no-reuse-delta test-5) &&
+	git verify-pack test-5-$packname_5.idx
+'
+
+test_done
@@ -0,0 +1,94 @@
+#!/bin/sh
+
+test_description='git pack-objects writes the same pack with threads'
+. ./test-lib.sh
+
+make_text () {
+	i=1
+	while test $i -le 50
+	do
+		echo "$1: line $i of $2"
+		i=$(($i + 1))
+	done
+}
+
+# Commit files $2 to $3 in revision $1.
+make_commit () {
+	n=$2
+	while test $n -le $3
+	do
+		make_text file$n $1 >file$n &&
+		git add file$n || return 1
+		n=$(($n + 1))
+	done &&
+	test_tick &&
+	git commit -q -m "$1"
+}
+
+# Pack what is given on the standard input with one thread and with
+# four, passing the options given; the threaded delta search is not
+# deterministic, so callers turn it off with --window=0.
+same_pack () {
+	cat >input &&
+	git pack-objects --stdout --threads=1 "$@" <input >one.pack &&
+	git pack-objects --stdout --threads=4 "$@" <input >four.pack &&
+	cmp one.pack four.pack
+}
+
+# Pack the loose objects, and name the new pack in "new-pack".
+pack_loose () {
+	ls .git/objects/pack >packs-before &&
+	git repack -d &&
+	ls .git/objects/pack >packs-after &&
+	comm -13 packs-before packs-after | grep "\.pack$" >new-pack
+}
+
+test_expect_success setup '
+	make_commit one 1 20 &&
+	make_commit two 5 25 &&
+	make_commit three 10 30 &&
+	git rev-list --objects --all >objs
+'
+
+test_expect_success 'loose objects are deflated the same with threads' '
+	same_pack --window=0 --no-reuse-object <objs
+'
+
+test_expect_success 'packed objects are copied the same with threads' '
+	git repack -a -d &&
+	make_commit four 15 35 &&
+	git rev-list --objects --all >objs &&
+	same_pack --window=0 <objs &&
+	same_pack --window=0 --no-reuse-object <objs
+'
+
+test_expect_success 'more packs' '
+	pack_loose &&
+	make_commit five 20 40 &&
+	pack_loose &&
+	cp new-pack five-pack &&
+	make_commit six 25 45 &&
+	pack_loose &&
+	make_commit seven 30 50 &&
+	test $(ls .git/objects/pack/*.pack | wc -l) = 4
+'
+
+test_expect_success 'objects from several packs are added the same with threads' '
+	same_pack --window=0 --all </dev/null
+'
+
+test_expect_success 'incremental packs are the same with threads' '
+	same_pack --window=0 --all --incremental </dev/null &&
+	git pack-objects --stdout --all </dev/null >all.pack &&
+	test $(wc -c <four.pack) -lt $(wc -c <all.pack)
+'
+
+test_expect_success 'rolling up a pack is the same with threads' '
+	same_pack --window=0 --all --incremental \
+		--unpacked=$(cat five-pack) </dev/null &&
+	cp four.pack rolled.pack &&
+	same_pack --window=0 --all --incremental </dev/null &&
+	test $(wc -c <four.pack) -lt $(wc -c <rolled.pack)
+'
+
+test_done
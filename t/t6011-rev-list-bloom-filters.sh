@@ -0,0 +1,96 @@
+#!/bin/sh
+
+test_description='path-limited history with changed-path Bloom filters'
+. ./test-lib.sh
+
+test_expect_success setup '
+	mkdir -p a/b c &&
+	echo 1 >a/b/file &&
+	echo 1 >a/other &&
+	echo 1 >c/file &&
+	git add . &&
+	test_tick && git commit -m initial &&
+	for i in 2 3 4 5 6
+	do
+		echo $i >a/b/file &&
+		git add a/b/file &&
+		test_tick && git commit -m "a/b $i" &&
+		echo $i >c/file &&
+		git add c/file &&
+		test_tick && git commit -m "c $i" || exit
+	done &&
+	git checkout -b side HEAD~4 &&
+	echo side >a/other &&
+	git add a/other &&
+	test_tick && git commit -m side &&
+	git checkout master &&
+	test_tick && git merge side &&
+	echo 7 >c/file &&
+	git commit -a -m "c 7"
+'
+
+paths="a a/ a/b a/b/file a/other c c/file d a/b/file/x"
+
+test_expect_success 'record the history without filters' '
+	for p in $paths
+	do
+		git rev-list --parents HEAD -- $p >expect.$(echo $p | tr / _) &&
+		git rev-list --parents --full-history HEAD -- $p \
+			>expect-full.$(echo $p | tr / _) || exit
+	done &&
+	git rev-list HEAD -- a/b c >expect.two
+'
+
+test_expect_success 'update-bloom-filters' '
+	git update-bloom-filters &&
+	test -s .git/objects/info/bloom-filters
+'
+
+test_expect_success 'the filters do not change the history' '
+	for p in $paths
+	do
+		git rev-list --parents HEAD -- $p >actual &&
+		test_cmp expect.$(echo $p | tr / _) actual &&
+		git rev-list --parents --full-history HEAD -- $p >actual &&
+		test_cmp expect-full.$(echo $p | tr / _) actual || exit
+	done &&
+	git rev-list HEAD -- a/b c >actual &&
+	test_cmp expect.two actual
+'
+
+test_expect_success 'the filters know what changed' '
+	test-bloom HEAD~3 a a/b a/b/file >actual &&
+	cat >expect <<-\EOF &&
+	a maybe
+	a/b maybe
+	a/b/file maybe
+	EOF
+	test_cmp expect actual &&
+	test-bloom HEAD~3 c c/file >actual &&
+	cat >expect <<-\EOF &&
+	c no
+	c/file no
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'new commits are added by gc' '
+	echo 8 >c/file &&
+	git commit -a -m "c 8" &&
+	git rev-list HEAD -- c >expect &&
+	git gc &&
+	git rev-list HEAD -- c >actual &&
+	test_cmp expect actual &&
+	test $(git rev-list HEAD -- c | wc -l) = 8
+'
+
+test_expect_success 'grafted commits are left alone' '
+	git rev-parse HEAD~3 >.git/info/grafts &&
+	git rev-list HEAD -- a/b >expect &&
+	git update-bloom-filters &&
+	git rev-list HEAD -- a/b >actual &&
+	test_cmp expect actual &&
+	rm .git/info/grafts
+'
+
+test_done
@@ -70,4 +70,9 @@ test_expect_success 'set merge.renamelimit to 5' '
 test_rename 5 ok
 test_rename 6 fail
 
+test_expect_success 'set diff.renamePrefilter' '
+	git config diff.renamePrefilter true
+'
+test_rename 6 ok
+
 test_done
@@ -107,6 +107,16 @@ do
 		diff expected actual
 	'
 
+	test_expect_success "grep -F with several strings and context $L" '
+		{
+			echo ${HC}file-3-foo_mmap bar mmap
+			echo ${HC}file:4:foo mmap bar_mmap
+			echo ${HC}file:5:foo_mmap bar mmap baz
+		} >expected &&
+		git grep -F -n -C1 -e bar_mmap -e baz $H -- file >actual &&
+		diff expected actual
+	'
+
 	test_expect_success "grep -c $L (no /dev/null)" '
 		! git grep -c test $H | grep -q /dev/null
         '
@@ -0,0 +1,111 @@
+#!/bin/sh
+
+test_description='git grep and log -S with a trigram index'
+. ./test-lib.sh
+
+test_expect_success setup '
+	echo "a needle in a haystack" >a &&
+	echo "nothing to see here" >b &&
+	printf "binary\\0needle\\n" >c &&
+	git add a b c &&
+	test_tick &&
+	git commit -m initial &&
+	echo "another needle" >>b &&
+	test_tick &&
+	git commit -a -m "needle in b" &&
+	echo "no more" >a &&
+	test_tick &&
+	git commit -a -m "no needle in a"
+'
+
+searches="-e:needle -F:-e:needle -e:ne.*dle -E:-e:(hay|need)le -i:-e:NEEDLE -c:-e:needle -v:-e:needle -L:-e:needle -l:-e:stack"
+
+test_expect_success 'record the results without an index' '
+	for s in $searches
+	do
+		for rev in HEAD HEAD~1 HEAD~2
+		do
+			git grep $(echo $s | tr : " ") $rev \
+				>expect.$rev.$(echo $s | tr -d ":*|()")
+		done
+	done
+	git log -Sneedle --pretty=format:%s >expect.log &&
+	git log -Sne.dle --pickaxe-regex --pretty=format:%s >expect.log-regex
+'
+
+test_expect_success 'build the index' '
+	git update-trigram-index &&
+	test -f .git/objects/info/trigram-index &&
+	test-trigram HEAD~2:b needle "see here" >actual &&
+	printf "needle no\\nsee here maybe\\n" >expect &&
+	test_cmp expect actual &&
+	test-trigram HEAD:c needle >actual &&
+	echo "needle maybe" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'same results with the index' '
+	for s in $searches
+	do
+		for rev in HEAD HEAD~1 HEAD~2
+		do
+			git grep $(echo $s | tr : " ") $rev >actual
+			test_cmp expect.$rev.$(echo $s | tr -d ":*|()") actual ||
+			echo $s $rev >>failed
+		done
+	done &&
+	! test -f failed &&
+	git log -Sneedle --pretty=format:%s >actual &&
+	test_cmp expect.log actual &&
+	git log -Sne.dle --pickaxe-regex --pretty=format:%s >actual &&
+	test_cmp expect.log-regex actual
+'
+
+test_expect_success 'blobs that cannot match are not read' '
+	blob=$(git rev-parse HEAD~2:b) &&
+	obj=.git/objects/$(echo $blob | sed -e "s|^..|&/|") &&
+	mv $obj saved &&
+	git grep -e needle HEAD~2 >actual &&
+	test_cmp expect.HEAD~2.-eneedle actual &&
+	git log -Sneedle --pretty=format:%s >actual &&
+	test_cmp expect.log actual &&
+	mv saved $obj
+'
+
+test_expect_success 'literals of regular expressions' '
+	test-trigram --literal "foo.*bar" "abcd*" "x\\(abc\\)yz" \
+		"[abc]defg" "a\\|bcdef" >actual &&
+	printf "foo\\nabc\\nnone\\ndefg\\nnone\\n" >expect &&
+	test_cmp expect actual &&
+	test-trigram --literal --extended "foo|barbaz" "(abc)?defg" \
+		"ab{2,3}cdef" "x\\.yz" >actual &&
+	printf "none\\ndefg\\ncdef\\nx.yz\\n" >expect &&
+	test_cmp expect actual &&
+	test-trigram --literal "\\<main\\>" "\\bword" "ab\\<cdef" >actual &&
+	printf "main\\nword\\ncdef\\n" >expect &&
+	test_cmp expect actual &&
+	test-trigram --literal --extended "\\<main\\>" "\\bword\\B" \
+		"ab\\wcdef" >actual &&
+	printf "main\\nword\\ncdef\\n" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'word boundaries are not text' '
+	rm -f failed &&
+	for s in "-E:\\<needle\\>" "-G:\\bneedle" "-E:\\bneedle\\b"
+	do
+		git grep -c "${s%%:*}" "${s#*:}" HEAD~1 >actual.with
+		mv .git/objects/info/trigram-index saved-index
+		git grep -c "${s%%:*}" "${s#*:}" HEAD~1 >actual.without
+		mv saved-index .git/objects/info/trigram-index
+		test -s actual.without &&
+		test_cmp actual.without actual.with ||
+		echo "$s" >>failed
+	done &&
+	! test -f failed &&
+	git log -S"\\<needle\\>" --pickaxe-regex --pretty=format:%s >actual &&
+	git log -Sneedle --pickaxe-regex --pretty=format:%s >expect &&
+	test_cmp expect actual
+'
+
+test_done
@@ -0,0 +1,84 @@
+#!/bin/sh
+
+test_description='git grep with threads gives the same output'
+. ./test-lib.sh
+
+if git grep --threads=2 -e foo 2>&1 | grep "no threads support" >/dev/null
+then
+	say "skipping test, git was built without threads"
+	test_done
+	exit
+fi
+
+# files of growing sizes, each with a needle at the end
+make_files () {
+	i=1 &&
+	while test $i -le 10
+	do
+		j=0 &&
+		while test $j -lt $(($i * 20))
+		do
+			echo "line $i $j" &&
+			j=$(($j + 1)) || return 1
+		done >file$i &&
+		echo "needle $i" >>file$i &&
+		i=$(($i + 1)) || return 1
+	done
+}
+
+# compare the output of "git grep $*" with threads and without
+same_output () {
+	git grep --cached --threads=1 "$@" >expect &&
+	git grep --threads=4 "$@" >actual &&
+	test_cmp expect actual &&
+	git grep --cached --threads=4 "$@" >actual &&
+	test_cmp expect actual &&
+	for rev in HEAD v1
+	do
+		git grep --threads=1 "$@" $rev >expect &&
+		git grep --threads=4 "$@" $rev >actual &&
+		test_cmp expect actual || return 1
+	done
+}
+
+test_expect_success setup '
+	make_files &&
+	mkdir sub &&
+	echo needle >sub/a &&
+	echo hay >sub/b &&
+	: >empty &&
+	: >sub/empty &&
+	git add . &&
+	test_tick &&
+	git commit -m initial &&
+	git tag -a -m tag v1
+'
+
+searches="-e:needle -n:-e:needle -l:-e:needle -L:-e:needle -c:-e:needle -v:-c:-e:line -h:-e:needle -C1:-e:needle -e:hay:--:sub"
+
+test_expect_success 'same output from the work tree, the index and trees' '
+	rm -f failed &&
+	for s in $searches
+	do
+		same_output $(echo $s | tr : " ") || echo "$s" >>failed
+	done &&
+	! test -f failed
+'
+
+test_expect_success 'empty files have no match' '
+	printf "empty\\nsub/b\\nsub/empty\\n" >expect &&
+	git grep --threads=4 -L needle >actual &&
+	test_cmp expect actual &&
+	git grep --threads=4 -L needle v1 | sed -e "s/^v1://" >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'blobs given before trees, from a pack' '
+	git repack -a -d &&
+	blob=$(git rev-parse HEAD:file10) &&
+	git grep --threads=1 -e needle $blob HEAD v1 >expect &&
+	git grep --threads=4 -e needle $blob HEAD v1 >actual &&
+	test_cmp expect actual
+'
+
+test_done
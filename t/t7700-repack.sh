@@ -0,0 +1,84 @@
+#!/bin/sh
+
+test_description='git repack, and its geometric mode'
+. ./test-lib.sh
+
+# commit "$1" new files, and pack them with their tree and commit
+nr=0
+make_pack () {
+	i=0 &&
+	while test $i -lt $1
+	do
+		nr=$(($nr + 1)) &&
+		echo "content $nr" >file-$nr &&
+		git add file-$nr &&
+		i=$(($i + 1)) || return 1
+	done &&
+	git commit -q -m "pack of $1" &&
+	git repack -d -q
+}
+
+# the packs that appeared since the last call
+new_packs () {
+	ls .git/objects/pack/*.pack >packs.new &&
+	comm -13 packs.old packs.new &&
+	mv packs.new packs.old
+}
+
+pack_sizes () {
+	for idx in .git/objects/pack/*.idx
+	do
+		git show-index <$idx | wc -l
+	done | sort -n | tr "\n" " "
+}
+
+test_expect_success 'geometric repack leaves a progression alone' '
+	: >packs.old &&
+	make_pack 2 &&
+	make_pack 10 &&
+	make_pack 58 &&
+	large=$(new_packs | while read pack
+		do
+			test $(git show-index <${pack%.pack}.idx | wc -l) = 60 &&
+			echo $pack
+		done; :) &&
+	test "$(pack_sizes)" = "4 12 60 " &&
+	git repack -d --geometric=2 >out &&
+	grep "Nothing new to pack" out &&
+	test "$(pack_sizes)" = "4 12 60 "
+'
+
+test_expect_success 'geometric repack rolls up the small packs' '
+	make_pack 1 &&
+	make_pack 1 &&
+	test "$(pack_sizes)" = "3 3 4 12 60 " &&
+	git repack -d -q --geometric=2 &&
+	test "$(pack_sizes)" = "22 60 " &&
+	test -n "$large" && test -f $large &&
+	git fsck --full
+'
+
+test_expect_success 'geometric repack leaves kept packs alone' '
+	new_packs >/dev/null &&
+	make_pack 1 &&
+	kept=$(new_packs) &&
+	touch ${kept%.pack}.keep &&
+	make_pack 1 &&
+	make_pack 1 &&
+	git repack -d -q --geometric=2 &&
+	test -f $kept &&
+	test "$(pack_sizes)" = "3 6 22 60 "
+'
+
+test_expect_success 'repack -a -d packs everything but kept packs' '
+	git repack -a -d -q &&
+	test $(ls .git/objects/pack/*.pack | wc -l) = 2 &&
+	test -f $kept &&
+	git fsck --full
+'
+
+test_expect_success '--geometric cannot be used with -a' '
+	! git repack -a --geometric=2
+'
+
+test_done
@@ -129,4 +129,28 @@ test_expect_success 'blame wholesale copy and more' '
 
 '
 
+test_expect_success 'blame copy with whitespace changes' '
+
+	{
+		echo "	ABC"
+		echo "DEF "
+	} >horse &&
+	git add horse &&
+	test_tick &&
+	GIT_AUTHOR_NAME=Sixth git commit -m Sixth &&
+	git blame -f -w -C -C1 HEAD -- horse | sed -e "$pick_fc" >current &&
+	{
+		echo mouse-Initial
+		echo mouse-Second
+	} >expected &&
+	test_cmp expected current &&
+	git blame -f -C -C1 HEAD -- horse | sed -e "$pick_fc" >current &&
+	{
+		echo horse-Sixth
+		echo horse-Sixth
+	} >expected &&
+	test_cmp expected current
+
+'
+
 test_done
@@ -0,0 +1,116 @@
+#!/bin/sh
+
+test_description='git blame with blame.cache'
+. ./test-lib.sh
+
+test_expect_success setup '
+	for i in 1 2 3 4 5 6 7 8 9 10; do echo line $i; done >file &&
+	git add file &&
+	test_tick &&
+	git commit -m initial &&
+	git checkout -b side &&
+	sed -e "s/line 2$/side 2/" <file >file.new &&
+	mv file.new file &&
+	test_tick &&
+	git commit -a -m side &&
+	git checkout master &&
+	sed -e "s/line 9$/master 9/" <file >file.new &&
+	mv file.new file &&
+	test_tick &&
+	git commit -a -m master &&
+	git merge side &&
+	echo line 11 >>file &&
+	test_tick &&
+	git commit -a -m eleven &&
+	sed -e "s/line 5$/five/" <file >file.new &&
+	mv file.new file &&
+	test_tick &&
+	git commit -a -m five &&
+	for rev in HEAD~2 HEAD~1 HEAD
+	do
+		git blame $rev -- file >expect.$rev &&
+		git blame -p $rev -- file >expect-p.$rev || return 1
+	done &&
+	git blame -L 2,5 HEAD -- file >expect.L
+'
+
+test_expect_success 'blame fills the cache' '
+	git config blame.cache true &&
+	git blame HEAD~2 -- file >actual &&
+	test_cmp expect.HEAD~2 actual &&
+	test $(ls .git/blame-cache | wc -l) = 1
+'
+
+test_expect_success 'blame of the same commit uses the cache' '
+	git blame --show-stats HEAD~2 -- file >actual &&
+	grep "^num commits: 0" actual &&
+	git blame HEAD~2 -- file >actual &&
+	test_cmp expect.HEAD~2 actual
+'
+
+test_expect_success 'blame of a descendant reuses the cache' '
+	git blame --show-stats HEAD~1 -- file >actual &&
+	grep "^num commits: 1" actual &&
+	git blame -p HEAD~1 -- file >actual &&
+	test_cmp expect-p.HEAD~1 actual &&
+	git blame -p HEAD -- file >actual &&
+	test_cmp expect-p.HEAD actual &&
+	test $(ls .git/blame-cache | wc -l) = 3
+'
+
+test_expect_success 'blame of a line range uses the cache' '
+	git blame --show-stats -L 2,5 HEAD -- file >actual &&
+	grep "^num commits: 0" actual &&
+	git blame -L 2,5 HEAD -- file >actual &&
+	test_cmp expect.L actual
+'
+
+test_expect_success 'blame of the working tree uses the cache' '
+	echo line 12 >>file &&
+	git blame --show-stats file >actual &&
+	grep "^num commits: 1" actual &&
+	git checkout file
+'
+
+test_expect_success 'the cache is not used with -M, -C or revision limits' '
+	git blame --show-stats -M HEAD -- file >actual &&
+	! grep "^num commits: 0" actual &&
+	git blame --show-stats HEAD~2.. -- file >actual &&
+	! grep "^num commits: 0" actual
+'
+
+test_expect_success 'an invalid cache entry is ignored' '
+	for f in .git/blame-cache/*; do echo garbage >$f; done &&
+	git blame HEAD -- file >actual &&
+	test_cmp expect.HEAD actual &&
+	git blame --show-stats HEAD -- file >actual &&
+	grep "^num commits: 0" actual
+'
+
+test_expect_success 'gc removes the cache entries that are not used' '
+	test $(ls .git/blame-cache | wc -l) = 3 &&
+	test-chmtime =-$((40 * 86400)) .git/blame-cache/* &&
+	git config gc.blameCacheExpire never &&
+	git gc &&
+	test $(ls .git/blame-cache | wc -l) = 3 &&
+	git config --unset gc.blameCacheExpire &&
+	git blame -L 2,5 HEAD -- file >actual &&
+	git gc &&
+	test $(ls .git/blame-cache | wc -l) = 1 &&
+	git blame --show-stats HEAD -- file >actual &&
+	grep "^num commits: 0" actual
+'
+
+test_expect_success 'the cache is not used with grafts' '
+	mkdir -p .git/info &&
+	git rev-parse HEAD~1 >.git/info/grafts &&
+	git config blame.cache false &&
+	git blame HEAD -- file >expect.graft &&
+	! test_cmp expect.HEAD expect.graft &&
+	git config blame.cache true &&
+	git blame HEAD -- file >actual &&
+	rm .git/info/grafts &&
+	test_cmp expect.graft actual
+'
+
+test_done
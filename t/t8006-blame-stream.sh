@@ -0,0 +1,76 @@
+#!/bin/sh
+
+test_description='git blame --stream'
+. ./test-lib.sh
+
+# turn the records back into --incremental output
+cat >decode.perl <<'EOD'
+binmode STDIN;
+my (%info, %shown, %path);
+while (read(STDIN, my $hdr, 5) == 5) {
+	my ($type, $len) = unpack("aN", $hdr);
+	read(STDIN, my $rec, $len) == $len or die "short record";
+	if ($type eq "c") {
+		my ($sha1, $at, $ct, $flags, $s) = unpack("a20NNNa*", $rec);
+		my @s = split(/\0/, $s, -1);
+		$info{unpack("H*", $sha1)} =
+			"author $s[0]\nauthor-mail $s[1]\n" .
+			"author-time $at\nauthor-tz $s[2]\n" .
+			"committer $s[3]\ncommitter-mail $s[4]\n" .
+			"committer-time $ct\ncommitter-tz $s[5]\n" .
+			"summary $s[6]\n" . ($flags & 1 ? "boundary\n" : "");
+	} elsif ($type eq "p") {
+		my ($id, $path) = unpack("Na*", $rec);
+		$path{$id} = $path;
+	} elsif ($type eq "l") {
+		my ($sha1, $id, $s_lno, $lno, $num) = unpack("a20NNNN", $rec);
+		$sha1 = unpack("H*", $sha1);
+		print "$sha1 $s_lno $lno $num\n";
+		print $info{$sha1} unless $shown{$sha1}++;
+		print "filename $path{$id}\n";
+	}
+}
+EOD
+
+test_expect_success setup '
+	for i in 1 2 3 4 5 6 7 8 9 10; do echo line $i; done >file &&
+	git add file &&
+	test_tick &&
+	git commit -m initial &&
+	sed -e "s/line 3$/three/" <file >file.new &&
+	mv file.new file &&
+	test_tick &&
+	git commit -a -m three &&
+	git mv file renamed &&
+	echo line 11 >>renamed &&
+	test_tick &&
+	git commit -a -m "rename and eleven" &&
+	sed -e "s/line 7$/seven/" <renamed >file.new &&
+	mv file.new renamed &&
+	test_tick &&
+	git commit -a -m seven
+'
+
+test_expect_success 'stream matches incremental output' '
+	git blame --incremental -M HEAD -- renamed >expect &&
+	git blame --stream -M HEAD -- renamed >stream &&
+	perl decode.perl <stream >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'stream shows boundary commits' '
+	git blame --incremental HEAD~2.. -- renamed >expect &&
+	git blame --stream HEAD~2.. -- renamed >stream &&
+	perl decode.perl <stream >actual &&
+	test_cmp expect actual &&
+	grep boundary actual
+'
+
+test_expect_success 'stream of a line range' '
+	git blame --incremental -L 2,8 -M -- renamed >expect &&
+	git blame --stream -L 2,8 -M -- renamed >stream &&
+	perl decode.perl <stream >actual &&
+	test_cmp expect actual
+'
+
+test_done
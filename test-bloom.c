@@ -0,0 +1,33 @@
+/*
+ * test-bloom.c: ask the changed-path filter of a commit about paths
+ *
+ *	test-bloom <commit> <path>...
+ *
+ * prints "maybe" or "no" for each path, or "none" if the commit has
+ * no filter.
+ */
+#include "cache.h"
+#include "bloom.h"
+
+int main(int argc, char **argv)
+{
+	struct bloom_filter filter;
+	unsigned char sha1[20];
+	int i;
+
+	if (argc < 2)
+		usage("test-bloom <commit> <path>...");
+	setup_git_directory();
+	if (get_sha1(argv[1], sha1))
+		die("not a commit: %s", argv[1]);
+	if (get_bloom_filter(sha1, &filter)) {
+		printf("none\n");
+		return 0;
+	}
+	for (i = 2; i < argc; i++)
+		printf("%s %s\n", argv[i],
+		       bloom_filter_may_contain(&filter, argv[i],
+						strlen(argv[i])) ?
+		       "maybe" : "no");
+	return 0;
+}
@@ -0,0 +1,69 @@
+/*
+ * test-convert.c: exercise and time the CRLF conversion in convert.c
+ *
+ *	test-convert (--to-git|--to-worktree) [<iterations>] <file
+ *
+ * converts the standard input as if core.autocrlf were true and the
+ * path had no attributes, writes the result of the first conversion
+ * to the standard output, and reports the throughput on the standard
+ * error when more than one iteration is asked for.
+ */
+#include "cache.h"
+
+static const char usage_str[] =
+	"test-convert (--to-git|--to-worktree) [<iterations>] <file";
+
+int main(int argc, char **argv)
+{
+	struct strbuf in, out;
+	struct timeval start, end;
+	int to_git, i, iterations = 1;
+	double elapsed;
+
+	if (argc < 2 || argc > 3)
+		usage(usage_str);
+	if (!strcmp(argv[1], "--to-git"))
+		to_git = 1;
+	else if (!strcmp(argv[1], "--to-worktree"))
+		to_git = 0;
+	else
+		usage(usage_str);
+	if (argc == 3)
+		iterations = atoi(argv[2]);
+	if (iterations < 1)
+		usage(usage_str);
+
+	auto_crlf = 1;
+	strbuf_init(&in, 0);
+	strbuf_init(&out, 0);
+	if (strbuf_read(&in, 0, 0) < 0)
+		die("unable to read stdin: %s", strerror(errno));
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		int converted;
+
+		strbuf_reset(&out);
+		if (to_git)
+			converted = convert_to_git("file", in.buf, in.len,
+						   &out, 0);
+		else
+			converted = convert_to_working_tree("file", in.buf,
+							    in.len, &out);
+		if (!converted)
+			strbuf_add(&out, in.buf, in.len);
+		if (!i)
+			write_or_die(1, out.buf, out.len);
+	}
+	gettimeofday(&end, NULL);
+
+	if (iterations > 1) {
+		elapsed = (end.tv_sec - start.tv_sec) +
+			(end.tv_usec - start.tv_usec) / 1e6;
+		fprintf(stderr, "%d x %lu bytes in %.3fs: %.1f MB/s\n",
+			iterations, (unsigned long)in.len, elapsed,
+			elapsed > 0 ?
+			(double)in.len * iterations / elapsed / (1 << 20) : 0);
+	}
+	return 0;
+}
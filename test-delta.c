@@ -13,47 +13,121 @@
 #include "cache.h"
 
 static const char usage_str[] =
-	"test-delta (-d|-p) <from_file> <data_file> <out_file>";
+	"test-delta (-d|-p) <from_file> <data_file> <out_file>\n"
+	"   or: test-delta -b <from_file> <data_file> [<rounds>]";
 
-int main(int argc, char *argv[])
+static void *map_file(const char *path, unsigned long *size)
 {
-	int fd;
 	struct stat st;
-	void *from_buf, *data_buf, *out_buf;
-	unsigned long from_size, data_size, out_size;
-
-	if (argc != 5 || (strcmp(argv[1], "-d") && strcmp(argv[1], "-p"))) {
-		fprintf(stderr, "Usage: %s\n", usage_str);
-		return 1;
-	}
+	void *buf;
+	int fd;
 
-	fd = open(argv[2], O_RDONLY);
+	fd = open(path, O_RDONLY);
 	if (fd < 0 || fstat(fd, &st)) {
-		perror(argv[2]);
-		return 1;
+		perror(path);
+		return NULL;
 	}
-	from_size = st.st_size;
-	from_buf = mmap(NULL, from_size, PROT_READ, MAP_PRIVATE, fd, 0);
-	if (from_buf == MAP_FAILED) {
-		perror(argv[2]);
+	*size = st.st_size;
+	buf = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (buf == MAP_FAILED) {
+		perror(path);
 		close(fd);
-		return 1;
+		return NULL;
 	}
 	close(fd);
+	return buf;
+}
 
-	fd = open(argv[3], O_RDONLY);
-	if (fd < 0 || fstat(fd, &st)) {
-		perror(argv[3]);
+static double elapsed(struct timeval *since)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - since->tv_sec) +
+		(now.tv_usec - since->tv_usec) / 1e6;
+}
+
+static void report(const char *what, unsigned long bytes, double seconds)
+{
+	printf("%s: %lu bytes in %.3f s (%.1f MB/s)\n", what, bytes, seconds,
+	       seconds > 0 ? bytes / seconds / (1024 * 1024) : 0.0);
+}
+
+/*
+ * Time building the index of <from_file> and the delta of <data_file>
+ * against it, and make sure the delta gives <data_file> back.
+ */
+static int benchmark(void *from_buf, unsigned long from_size,
+		     void *data_buf, unsigned long data_size, int rounds)
+{
+	struct delta_index *index = NULL;
+	void *out_buf = NULL, *check;
+	unsigned long out_size = 0, check_size;
+	double index_time = 0, delta_time = 0;
+	struct timeval start;
+	int i;
+
+	for (i = 0; i < rounds; i++) {
+		gettimeofday(&start, NULL);
+		index = create_delta_index(from_buf, from_size);
+		index_time += elapsed(&start);
+		if (!index) {
+			fprintf(stderr, "cannot index <from_file>\n");
+			return 1;
+		}
+
+		gettimeofday(&start, NULL);
+		out_buf = create_delta(index, data_buf, data_size, &out_size, 0);
+		delta_time += elapsed(&start);
+		if (!out_buf) {
+			fprintf(stderr, "delta operation failed (returned NULL)\n");
+			return 1;
+		}
+		free_delta_index(index);
+		if (i < rounds - 1)
+			free(out_buf);
+	}
+
+	check = patch_delta(from_buf, from_size, out_buf, out_size,
+			    &check_size);
+	if (!check || check_size != data_size ||
+	    memcmp(check, data_buf, data_size)) {
+		fprintf(stderr, "delta does not give <data_file> back\n");
 		return 1;
 	}
-	data_size = st.st_size;
-	data_buf = mmap(NULL, data_size, PROT_READ, MAP_PRIVATE, fd, 0);
-	if (data_buf == MAP_FAILED) {
-		perror(argv[3]);
-		close(fd);
+	report("index", from_size * rounds, index_time);
+	report("delta", data_size * rounds, delta_time);
+	printf("delta size: %lu\n", out_size);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int fd;
+	void *from_buf, *data_buf, *out_buf;
+	unsigned long from_size, data_size, out_size;
+
+	if (argc >= 4 && argc <= 5 && !strcmp(argv[1], "-b")) {
+		int rounds = argc == 5 ? atoi(argv[4]) : 10;
+		if (rounds < 1 ||
+		    !(from_buf = map_file(argv[2], &from_size)) ||
+		    !(data_buf = map_file(argv[3], &data_size)))
+			return 1;
+		return benchmark(from_buf, from_size,
+				 data_buf, data_size, rounds);
+	}
+
+	if (argc != 5 || (strcmp(argv[1], "-d") && strcmp(argv[1], "-p"))) {
+		fprintf(stderr, "Usage: %s\n", usage_str);
 		return 1;
 	}
-	close(fd);
+
+	from_buf = map_file(argv[2], &from_size);
+	if (!from_buf)
+		return 1;
+	data_buf = map_file(argv[3], &data_size);
+	if (!data_buf)
+		return 1;
 
 	if (argv[1][1] == 'd')
 		out_buf = diff_delta(from_buf, from_size,
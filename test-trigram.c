@@ -0,0 +1,40 @@
+/*
+ * test-trigram.c: ask the trigram index about strings
+ *
+ *	test-trigram <blob> <string>...
+ *
+ * prints "maybe" or "no" for each string, and
+ *
+ *	test-trigram --literal [--extended] <regex>...
+ *
+ * prints the string every match of each regex must contain, or
+ * "none".
+ */
+#include "cache.h"
+#include "trigram.h"
+
+int main(int argc, char **argv)
+{
+	unsigned char sha1[20];
+	int i;
+
+	if (argc < 2)
+		usage("test-trigram (<blob> | --literal [--extended]) <string>...");
+	if (!strcmp(argv[1], "--literal")) {
+		int extended = argc > 2 && !strcmp(argv[2], "--extended");
+		for (i = 2 + extended; i < argc; i++) {
+			char *literal = trigram_literal_of_regex(argv[i], extended);
+			printf("%s\n", literal ? literal : "none");
+			free(literal);
+		}
+		return 0;
+	}
+	setup_git_directory();
+	if (get_sha1(argv[1], sha1))
+		die("not a blob: %s", argv[1]);
+	for (i = 2; i < argc; i++)
+		printf("%s %s\n", argv[i],
+		       trigram_blob_may_contain(sha1, argv[i], strlen(argv[i])) ?
+		       "maybe" : "no");
+	return 0;
+}
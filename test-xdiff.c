@@ -0,0 +1,117 @@
+/*
+ * test-xdiff.c: run and time the diff algorithms of xdiff
+ *
+ *	test-xdiff [--histogram | --compare] [-n <iterations>] <old> <new>...
+ *
+ * diffs each pair of files and writes the unified diffs to the
+ * standard output.  With --compare, nothing is written; instead
+ * every algorithm is run on all the pairs (a corpus of changes,
+ * e.g. extracted from the history of a project) and the time it
+ * took and the size of the diffs it produced are reported.
+ */
+#include "cache.h"
+#include "xdiff-interface.h"
+
+static const char usage_str[] =
+	"test-xdiff [--histogram | --compare] [-n <iterations>] <old> <new>...";
+
+static const struct {
+	const char *name;
+	unsigned long flags;
+} algorithms[] = {
+	{ "myers", 0 },
+	{ "histogram", XDF_HISTOGRAM_DIFF },
+};
+
+struct diff_output {
+	int quiet;
+	unsigned long lines;
+};
+
+static int emit(void *priv, mmbuffer_t *mb, int nbuf)
+{
+	struct diff_output *out = priv;
+	int i;
+
+	for (i = 0; i < nbuf; i++) {
+		if (!out->quiet)
+			write_or_die(1, mb[i].ptr, mb[i].size);
+		if (mb[i].size && mb[i].ptr[mb[i].size - 1] == '\n')
+			out->lines++;
+	}
+	return 0;
+}
+
+static double run(mmfile_t *files, int nr, unsigned long flags,
+		  int iterations, struct diff_output *out)
+{
+	struct timeval start, end;
+	xpparam_t xpp;
+	xdemitconf_t xecfg;
+	xdemitcb_t ecb;
+	int i, j;
+
+	memset(&xecfg, 0, sizeof(xecfg));
+	xecfg.ctxlen = 3;
+	xpp.flags = XDF_NEED_MINIMAL | flags;
+	ecb.outf = emit;
+	ecb.priv = out;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		out->lines = 0;
+		for (j = 0; j < nr; j += 2)
+			if (xdi_diff(&files[j], &files[j + 1], &xpp, &xecfg, &ecb))
+				die("unable to generate diff");
+		out->quiet = 1;
+	}
+	gettimeofday(&end, NULL);
+	return (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+	struct diff_output out;
+	unsigned long flags = 0;
+	int i, nr, compare = 0, iterations = 1;
+	mmfile_t *files;
+	double elapsed;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (!strcmp(argv[i], "--histogram"))
+			flags = XDF_HISTOGRAM_DIFF;
+		else if (!strcmp(argv[i], "--compare"))
+			compare = 1;
+		else if (!strcmp(argv[i], "-n") && i + 1 < argc)
+			iterations = atoi(argv[++i]);
+		else
+			usage(usage_str);
+	}
+	nr = argc - i;
+	if (!nr || nr % 2 || iterations < 1)
+		usage(usage_str);
+
+	files = xcalloc(nr, sizeof(*files));
+	for (nr = 0; i < argc; i++, nr++)
+		if (read_mmfile(&files[nr], argv[i]))
+			return 1;
+
+	if (!compare) {
+		memset(&out, 0, sizeof(out));
+		elapsed = run(files, nr, flags, iterations, &out);
+		if (iterations > 1)
+			fprintf(stderr, "%d x %d diffs in %.3fs\n",
+				iterations, nr / 2, elapsed);
+		return 0;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(algorithms); i++) {
+		memset(&out, 0, sizeof(out));
+		out.quiet = 1;
+		elapsed = run(files, nr, algorithms[i].flags, iterations, &out);
+		fprintf(stderr, "%-10s %d x %d diffs in %.3fs, %lu lines of output\n",
+			algorithms[i].name, iterations, nr / 2, elapsed,
+			out.lines);
+	}
+	return 0;
+}
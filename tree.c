@@ -149,7 +149,7 @@ static int cmp_cache_name_compare(const void *a_, const void *b_)
 int read_tree(struct tree *tree, int stage, const char **match)
 {
 	read_tree_fn_t fn = NULL;
-	int i, err;
+	int i, err, nr = active_nr;
 
 	/*
 	 * Currently the only existing callers of this function all
@@ -179,9 +179,13 @@ int read_tree(struct tree *tree, int stage, const char **match)
 		return err;
 
 	/*
-	 * Sort the cache entry -- we need to nuke the cache tree, though.
+	 * The appended entries bypassed add_index_entry_with_check(),
+	 * so invalidate their paths in the cache tree ourselves, and
+	 * sort the cache entries.
 	 */
-	cache_tree_free(&active_cache_tree);
+	for (i = nr; i < active_nr; i++)
+		cache_tree_invalidate_path(active_cache_tree,
+					   active_cache[i]->name);
 	qsort(active_cache, active_nr, sizeof(active_cache[0]),
 	      cmp_cache_name_compare);
 	return 0;
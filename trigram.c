@@ -0,0 +1,386 @@
+/*
+ * trigram.c
+ *
+ * A content index of blobs, so that "git grep <tree>" and "log -S"
+ * can skip the blobs that cannot contain what they look for without
+ * reading them.
+ *
+ * $GIT_DIR/objects/info/trigram-index holds a header, a table of
+ * (blob, end of its filter) sorted by blob, and the filters.  Each
+ * filter is a Bloom filter of the distinct byte trigrams of the blob,
+ * with TRIGRAM_BITS_PER_ENTRY bits for each of them, and every
+ * trigram sets TRIGRAM_NUM_HASHES of them.  An empty filter (binary
+ * or very large blobs) means "anything may be in it".
+ */
+#include "cache.h"
+#include "object.h"
+#include "xdiff-interface.h"
+#include "trigram.h"
+
+#define TRIGRAM_SIGNATURE 0x5452474d	/* "TRGM" */
+#define TRIGRAM_VERSION 1
+
+#define TRIGRAM_BITS_PER_ENTRY 8
+#define TRIGRAM_NUM_HASHES 4
+#define TRIGRAM_MAX_BLOB_SIZE (4 * 1024 * 1024)
+
+struct trigram_header {
+	uint32_t signature;
+	uint32_t version;
+	uint32_t nr;
+};
+
+struct trigram_entry {
+	unsigned char sha1[20];
+	uint32_t end;
+};
+
+static const struct trigram_entry *trigram_table;
+static const unsigned char *trigram_data;
+static uint32_t trigram_nr;
+static int trigram_prepared;
+
+static void prepare_trigram_index(void)
+{
+	const struct trigram_header *hdr;
+	const char *path;
+	struct stat st;
+	size_t size, table_size;
+	void *map;
+	int fd;
+
+	if (trigram_prepared)
+		return;
+	trigram_prepared = 1;
+
+	path = mkpath("%s/info/trigram-index", get_object_directory());
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return;
+	if (fstat(fd, &st) || st.st_size < sizeof(*hdr)) {
+		close(fd);
+		return;
+	}
+	size = xsize_t(st.st_size);
+	map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	hdr = map;
+	table_size = sizeof(*hdr) + (size_t)ntohl(hdr->nr) * sizeof(struct trigram_entry);
+	if (ntohl(hdr->signature) != TRIGRAM_SIGNATURE ||
+	    ntohl(hdr->version) != TRIGRAM_VERSION ||
+	    size < table_size) {
+		warning("ignoring invalid %s", path);
+		munmap(map, size);
+		return;
+	}
+	trigram_table = (const struct trigram_entry *)(hdr + 1);
+	trigram_nr = ntohl(hdr->nr);
+	trigram_data = (const unsigned char *)map + table_size;
+	if (trigram_nr && size - table_size < ntohl(trigram_table[trigram_nr - 1].end)) {
+		warning("ignoring truncated %s", path);
+		trigram_nr = 0;
+	}
+}
+
+static int find_trigram_entry(const unsigned char *sha1)
+{
+	uint32_t lo = 0, hi = trigram_nr;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(trigram_table[mi].sha1, sha1);
+		if (!cmp)
+			return mi;
+		if (cmp < 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return -1;
+}
+
+static inline uint32_t trigram_at(const unsigned char *cp)
+{
+	return (cp[0] << 16) | (cp[1] << 8) | cp[2];
+}
+
+static void trigram_bits(uint32_t trigram, unsigned long nbits,
+			 unsigned long *bit)
+{
+	uint32_t h1 = trigram * 0x9e3779b1;
+	uint32_t h2 = (trigram ^ 0x5bd1e995) * 0x85ebca6b;
+	int i;
+
+	h1 ^= h1 >> 15;
+	h2 ^= h2 >> 13;
+	for (i = 0; i < TRIGRAM_NUM_HASHES; i++)
+		bit[i] = (h1 + (uint32_t)i * h2) % nbits;
+}
+
+int trigram_blob_may_contain(const unsigned char *blob_sha1,
+			     const char *str, unsigned long len)
+{
+	const unsigned char *cp = (const unsigned char *)str;
+	const unsigned char *data;
+	unsigned long nbits, i;
+	uint32_t begin;
+	int pos;
+
+	if (len < 3)
+		return 1;
+	prepare_trigram_index();
+	pos = find_trigram_entry(blob_sha1);
+	if (pos < 0)
+		return 1;
+	begin = pos ? ntohl(trigram_table[pos - 1].end) : 0;
+	nbits = (ntohl(trigram_table[pos].end) - begin) * 8;
+	if (!nbits)
+		return 1;
+	data = trigram_data + begin;
+	for (i = 0; i + 2 < len; i++) {
+		unsigned long bit[TRIGRAM_NUM_HASHES];
+		int j;
+
+		trigram_bits(trigram_at(cp + i), nbits, bit);
+		for (j = 0; j < TRIGRAM_NUM_HASHES; j++)
+			if (!(data[bit[j] / 8] & (1 << (bit[j] % 8))))
+				return 0;
+	}
+	return 1;
+}
+
+/*
+ * Skip a bracket expression; "cp" points after its '['.  Returns
+ * where it ends, or NULL if it does not.
+ */
+static const char *skip_bracket(const char *cp)
+{
+	if (*cp == '^')
+		cp++;
+	if (*cp == ']')
+		cp++;
+	while (*cp && *cp != ']') {
+		if (*cp == '[' && (cp[1] == ':' || cp[1] == '.' || cp[1] == '=')) {
+			char close = cp[1];
+			for (cp += 2; *cp && !(*cp == close && cp[1] == ']'); cp++)
+				;
+			if (!*cp)
+				return NULL;
+			cp++;
+		}
+		cp++;
+	}
+	return *cp ? cp + 1 : NULL;
+}
+
+/*
+ * Only runs outside of groups count, as a group may be optional or
+ * repeated, and any alternation makes us give up.  The character
+ * before a quantifier is dropped from the run it ends.  Only escapes
+ * of the special characters are literal; the others, like the word
+ * boundaries \< and \b, end the run.
+ */
+char *trigram_literal_of_regex(const char *regex, int extended)
+{
+	const char *cp = regex;
+	char *run = xmalloc(strlen(regex) + 1);
+	int run_len = 0, best_len = 0, depth = 0;
+	char *best = NULL;
+
+	for (;;) {
+		int c = (unsigned char)*cp, literal = -1, quant = 0;
+
+		if (c) {
+			cp++;
+			if (c == '\\') {
+				c = (unsigned char)*cp++;
+				if (!c || c == '|')
+					goto unknown;
+				if (!extended && c == '(')
+					depth++;
+				else if (!extended && c == ')')
+					depth--;
+				else if (!extended &&
+					 (c == '{' || c == '+' || c == '?'))
+					quant = c;
+				else if (strchr(extended ? ".[]*^$\\+?(){}" : ".[]*^$\\", c))
+					literal = c;
+				/*
+				 * Anything else, like \< or \b, matches
+				 * no text or a class of it: it ends the run.
+				 */
+			} else if (c == '[') {
+				cp = skip_bracket(cp);
+				if (!cp)
+					goto unknown;
+			} else if (c == '*')
+				quant = c;
+			else if (c == '.' || c == '^' || c == '$')
+				;
+			else if (!extended)
+				literal = c;
+			else if (c == '|')
+				goto unknown;
+			else if (c == '(')
+				depth++;
+			else if (c == ')')
+				depth--;
+			else if (c == '+' || c == '?' || c == '{')
+				quant = c;
+			else
+				literal = c;
+		}
+
+		if (literal >= 0 && !depth) {
+			run[run_len++] = literal;
+			continue;
+		}
+		if (quant && run_len)
+			run_len--;
+		if (quant == '{') {
+			/* skip the bounds */
+			while (*cp && *cp != '}')
+				cp++;
+			if (!*cp)
+				goto unknown;
+			cp++;
+		}
+		if (run_len > best_len) {
+			free(best);
+			best = xmemdupz(run, run_len);
+			best_len = run_len;
+		}
+		run_len = 0;
+		if (!c)
+			break;
+	}
+	free(run);
+	if (best_len < 3) {
+		free(best);
+		return NULL;
+	}
+	return best;
+
+unknown:
+	free(run);
+	free(best);
+	return NULL;
+}
+
+static int uint32_cmp(const void *a_, const void *b_)
+{
+	uint32_t a = *(uint32_t *)a_, b = *(uint32_t *)b_;
+	return a < b ? -1 : a > b;
+}
+
+/*
+ * Compute the filter of the blob at the end of "out".
+ */
+static void compute_trigram_filter(const unsigned char *sha1, struct strbuf *out)
+{
+	enum object_type type;
+	unsigned long size, nr, i, j, len;
+	unsigned char *buf, *data;
+	uint32_t *trigram;
+
+	buf = read_sha1_file(sha1, &type, &size);
+	if (!buf)
+		die("unable to read %s", sha1_to_hex(sha1));
+	if (size > TRIGRAM_MAX_BLOB_SIZE ||
+	    buffer_is_binary((char *)buf, size)) {
+		free(buf);
+		return;
+	}
+
+	nr = size < 3 ? 0 : size - 2;
+	trigram = xmalloc(nr * sizeof(*trigram) + 1);
+	for (i = 0; i < nr; i++)
+		trigram[i] = trigram_at(buf + i);
+	free(buf);
+	qsort(trigram, nr, sizeof(*trigram), uint32_cmp);
+	for (i = j = 0; i < nr; i++)
+		if (!j || trigram[j - 1] != trigram[i])
+			trigram[j++] = trigram[i];
+	nr = j;
+
+	/* a blob without trigrams does not contain any string we ask about */
+	len = (nr * TRIGRAM_BITS_PER_ENTRY + 7) / 8;
+	if (!len)
+		len = 1;
+	strbuf_grow(out, len);
+	data = (unsigned char *)out->buf + out->len;
+	memset(data, 0, len);
+	for (i = 0; i < nr; i++) {
+		unsigned long bit[TRIGRAM_NUM_HASHES];
+		int k;
+
+		trigram_bits(trigram[i], len * 8, bit);
+		for (k = 0; k < TRIGRAM_NUM_HASHES; k++)
+			data[bit[k] / 8] |= 1 << (bit[k] % 8);
+	}
+	strbuf_setlen(out, out->len + len);
+	free(trigram);
+}
+
+static int object_sha1_cmp(const void *a_, const void *b_)
+{
+	struct object *a = *(struct object **)a_, *b = *(struct object **)b_;
+	return hashcmp(a->sha1, b->sha1);
+}
+
+/*
+ * Write the filters of the given blobs, reusing those we have already.
+ */
+int write_trigram_index(struct object **blobs, int nr)
+{
+	static struct lock_file lock;
+	struct trigram_header hdr;
+	struct trigram_entry *table;
+	struct strbuf data;
+	char *path;
+	int i, j, fd;
+
+	prepare_trigram_index();
+	qsort(blobs, nr, sizeof(*blobs), object_sha1_cmp);
+	table = xmalloc(nr * sizeof(*table));
+	strbuf_init(&data, 0);
+	for (i = j = 0; i < nr; i++) {
+		struct object *blob = blobs[i];
+		int pos;
+
+		if (i && blobs[i - 1] == blob)
+			continue;
+		pos = find_trigram_entry(blob->sha1);
+		if (pos >= 0) {
+			uint32_t begin = pos ? ntohl(trigram_table[pos - 1].end) : 0;
+			strbuf_add(&data, trigram_data + begin,
+				   ntohl(trigram_table[pos].end) - begin);
+		} else
+			compute_trigram_filter(blob->sha1, &data);
+		if (data.len != (uint32_t)data.len)
+			die("trigram index too large");
+		hashcpy(table[j].sha1, blob->sha1);
+		table[j].end = htonl(data.len);
+		j++;
+	}
+
+	path = mkpath("%s/info/trigram-index", get_object_directory());
+	if (safe_create_leading_directories(path))
+		return error("unable to create directory for %s", path);
+	fd = hold_lock_file_for_update(&lock, path, 1);
+	hdr.signature = htonl(TRIGRAM_SIGNATURE);
+	hdr.version = htonl(TRIGRAM_VERSION);
+	hdr.nr = htonl(j);
+	if (write_in_full(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+	    write_in_full(fd, table, j * sizeof(*table)) != j * sizeof(*table) ||
+	    write_in_full(fd, data.buf, data.len) != data.len) {
+		rollback_lock_file(&lock);
+		return error("unable to write %s", path);
+	}
+	free(table);
+	strbuf_release(&data);
+	if (commit_lock_file(&lock) < 0)
+		return error("unable to write %s", path);
+	return 0;
+}
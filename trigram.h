@@ -0,0 +1,23 @@
+#ifndef TRIGRAM_H
+#define TRIGRAM_H
+
+struct object;
+
+/*
+ * Returns 0 if the blob definitely does not contain the "len" bytes
+ * at "str", i.e. the trigram index knows the blob and one of the
+ * trigrams of the string is not in it.  Strings shorter than three
+ * bytes may be anywhere.
+ */
+extern int trigram_blob_may_contain(const unsigned char *blob_sha1,
+				    const char *str, unsigned long len);
+
+/*
+ * Returns the longest run of literal characters any match of the
+ * regular expression must contain, or NULL if we cannot tell.
+ */
+extern char *trigram_literal_of_regex(const char *regex, int extended);
+
+extern int write_trigram_index(struct object **blobs, int nr);
+
+#endif
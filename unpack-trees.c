@@ -50,6 +50,7 @@ static void unlink_entry(struct cache_entry *ce)
 			*cp = '/';
 			break;
 		}
+		dir_cache_invalidate();
 		prev = cp;
 	}
 }
@@ -319,6 +320,7 @@ static int unpack_callback(int n, unsigned long mask, unsigned long dirmask, str
 
 static int unpack_failed(struct unpack_trees_options *o, const char *message)
 {
+	dir_cache_end();
 	discard_index(&o->result);
 	if (!o->gently) {
 		if (message)
@@ -331,6 +333,9 @@ static int unpack_failed(struct unpack_trees_options *o, const char *message)
 int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options *o)
 {
 	static struct cache_entry *dfc;
+	struct index_state *src_index = o->src_index;
+	unsigned char tree_sha1[20];
+	int ret, fill_cache_tree = 0;
 
 	if (len > MAX_UNPACK_TREES)
 		die("unpack_trees takes at most %d trees", MAX_UNPACK_TREES);
@@ -340,6 +345,12 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 	state.quiet = 1;
 	state.refresh_cache = 1;
 
+	/*
+	 * verify_absent() and check_updates() look at the same
+	 * leading directories over and over.
+	 */
+	dir_cache_begin();
+
 	memset(&o->result, 0, sizeof(o->result));
 	if (o->src_index)
 		o->result.timestamp = o->src_index->timestamp;
@@ -349,6 +360,15 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 		dfc = xcalloc(1, sizeof(struct cache_entry) + 1);
 	o->df_conflict_entry = dfc;
 
+	/*
+	 * The result of a one- or two-tree merge mostly matches the last
+	 * tree; remember it so that we can take the cache tree from it.
+	 */
+	if (o->dst_index && !o->prefix && (len == 1 || len == 2)) {
+		hash_sha1_file(t[len-1].buffer, t[len-1].size, tree_type, tree_sha1);
+		fill_cache_tree = 1;
+	}
+
 	if (len) {
 		const char *prefix = o->prefix ? o->prefix : "";
 		struct traverse_info info;
@@ -374,10 +394,17 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 		return unpack_failed(o, "Merge requires file-level merging");
 
 	o->src_index = NULL;
-	if (check_updates(o))
+	ret = check_updates(o);
+	dir_cache_end();
+	if (ret)
 		return -1;
-	if (o->dst_index)
+	if (o->dst_index) {
+		if (src_index)
+			cache_tree_move(&o->result, src_index);
+		if (fill_cache_tree)
+			cache_tree_fill_from_tree(&o->result, tree_sha1);
 		*o->dst_index = o->result;
+	}
 	return 0;
 }
 
@@ -322,32 +322,29 @@ int xdl_recs_cmp(diffdata_t *dd1, long off1, long lim1,
 }
 
 
-int xdl_do_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
-		xdfenv_t *xe) {
+/*
+ * Allocate the K vectors and run the divide and conquer on the two
+ * sets of records.
+ */
+static int xdl_run_recs_cmp(diffdata_t *dd1, diffdata_t *dd2, int need_min) {
 	long ndiags;
 	long *kvd, *kvdf, *kvdb;
 	xdalgoenv_t xenv;
-	diffdata_t dd1, dd2;
-
-	if (xdl_prepare_env(mf1, mf2, xpp, xe) < 0) {
-
-		return -1;
-	}
+	int ret;
 
 	/*
 	 * Allocate and setup K vectors to be used by the differential algorithm.
 	 * One is to store the forward path and one to store the backward path.
 	 */
-	ndiags = xe->xdf1.nreff + xe->xdf2.nreff + 3;
+	ndiags = dd1->nrec + dd2->nrec + 3;
 	if (!(kvd = (long *) xdl_malloc((2 * ndiags + 2) * sizeof(long)))) {
 
-		xdl_free_env(xe);
 		return -1;
 	}
 	kvdf = kvd;
 	kvdb = kvdf + ndiags;
-	kvdf += xe->xdf2.nreff + 1;
-	kvdb += xe->xdf2.nreff + 1;
+	kvdf += dd2->nrec + 1;
+	kvdb += dd2->nrec + 1;
 
 	xenv.mxcost = xdl_bogosqrt(ndiags);
 	if (xenv.mxcost < XDL_MAX_COST_MIN)
@@ -355,6 +352,78 @@ int xdl_do_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
 	xenv.snake_cnt = XDL_SNAKE_CNT;
 	xenv.heur_min = XDL_HEUR_MIN_COST;
 
+	ret = xdl_recs_cmp(dd1, 0, dd1->nrec, dd2, 0, dd2->nrec,
+			   kvdf, kvdb, need_min, &xenv);
+
+	xdl_free(kvd);
+
+	return ret;
+}
+
+
+/*
+ * Run the classic algorithm on the records [off1, off1 + cnt1) and
+ * [off2, off2 + cnt2) of an environment that is already prepared,
+ * marking the changed ones; it is what the other algorithms fall
+ * back to.  The records are compared by their class, so there is no
+ * need to classify them again.
+ */
+int xdl_recs_cmp_range(xdfenv_t *xe, long off1, long cnt1,
+		       long off2, long cnt2, int need_min) {
+	long i;
+	unsigned long *ha;
+	long *rindex;
+	diffdata_t dd1, dd2;
+	int ret;
+
+	if (!(ha = (unsigned long *) xdl_malloc((cnt1 + cnt2 + 1) * sizeof(unsigned long)))) {
+
+		return -1;
+	}
+	if (!(rindex = (long *) xdl_malloc((cnt1 + cnt2 + 1) * sizeof(long)))) {
+
+		xdl_free(ha);
+		return -1;
+	}
+	for (i = 0; i < cnt1; i++) {
+		ha[i] = xe->xdf1.recs[off1 + i]->ha;
+		rindex[i] = off1 + i;
+	}
+	for (i = 0; i < cnt2; i++) {
+		ha[cnt1 + i] = xe->xdf2.recs[off2 + i]->ha;
+		rindex[cnt1 + i] = off2 + i;
+	}
+
+	dd1.nrec = cnt1;
+	dd1.ha = ha;
+	dd1.rchg = xe->xdf1.rchg;
+	dd1.rindex = rindex;
+	dd2.nrec = cnt2;
+	dd2.ha = ha + cnt1;
+	dd2.rchg = xe->xdf2.rchg;
+	dd2.rindex = rindex + cnt1;
+
+	ret = xdl_run_recs_cmp(&dd1, &dd2, need_min);
+
+	xdl_free(rindex);
+	xdl_free(ha);
+
+	return ret;
+}
+
+
+int xdl_do_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
+		xdfenv_t *xe) {
+	diffdata_t dd1, dd2;
+
+	if (xpp->flags & XDF_HISTOGRAM_DIFF)
+		return xdl_do_histogram_diff(mf1, mf2, xpp, xe);
+
+	if (xdl_prepare_env(mf1, mf2, xpp, xe) < 0) {
+
+		return -1;
+	}
+
 	dd1.nrec = xe->xdf1.nreff;
 	dd1.ha = xe->xdf1.ha;
 	dd1.rchg = xe->xdf1.rchg;
@@ -364,16 +433,12 @@ int xdl_do_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
 	dd2.rchg = xe->xdf2.rchg;
 	dd2.rindex = xe->xdf2.rindex;
 
-	if (xdl_recs_cmp(&dd1, 0, dd1.nrec, &dd2, 0, dd2.nrec,
-			 kvdf, kvdb, (xpp->flags & XDF_NEED_MINIMAL) != 0, &xenv) < 0) {
+	if (xdl_run_recs_cmp(&dd1, &dd2, (xpp->flags & XDF_NEED_MINIMAL) != 0) < 0) {
 
-		xdl_free(kvd);
 		xdl_free_env(xe);
 		return -1;
 	}
 
-	xdl_free(kvd);
-
 	return 0;
 }
 
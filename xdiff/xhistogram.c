@@ -0,0 +1,320 @@
+/*
+ *  Histogram diff
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/*
+ * The histogram algorithm counts how often every line of the first
+ * file occurs in the range being compared, and picks as anchor the
+ * longest common region that contains the rarest lines, so that
+ * unique lines (function headers, not braces and blank lines) decide
+ * how the two files are lined up.  The ranges before and after the
+ * anchor are then compared the same way.  When every common line is
+ * too frequent to be a good anchor, the classic algorithm takes over
+ * for that range.
+ *
+ * Records are compared by their class (rec->ha after preparation),
+ * which is the same for two lines if and only if they match.
+ */
+
+#include "xinclude.h"
+
+
+
+#define XDL_HIST_MAX_CHAIN 64
+
+typedef struct s_xdhrec {
+	struct s_xdhrec *next;
+	long ptr, cnt;
+} xdhrec_t;
+
+typedef struct s_xdhindex {
+	xdfenv_t *env;
+	unsigned int hbits;
+	xdhrec_t **rhash;
+	xdhrec_t **line_map;
+	long *next_ptrs;
+	chastore_t rcha;
+	long off1;
+	long cnt;
+	int has_common;
+} xdhindex_t;
+
+typedef struct s_xdhregion {
+	long begin1, end1;
+	long begin2, end2;
+	int found;
+} xdhregion_t;
+
+#define XDL_HREC(env, s, l) ((env)->xdf##s.recs[l])
+#define XDL_HSAME(env, l1, l2) (XDL_HREC(env, 1, l1)->ha == XDL_HREC(env, 2, l2)->ha)
+#define XDL_HNEXT(idx, l) ((idx)->next_ptrs[(l) - (idx)->off1])
+#define XDL_HCNT(idx, l) ((idx)->line_map[(l) - (idx)->off1]->cnt)
+
+
+
+static void xdl_hist_free_index(xdhindex_t *idx);
+static int xdl_hist_scan_a(xdhindex_t *idx, long off1, long lim1);
+static long xdl_hist_try_lcs(xdhindex_t *idx, xdhregion_t *lcs, long bptr,
+			     long off1, long lim1, long off2, long lim2);
+static int xdl_hist_find_lcs(xdfenv_t *xe, xdhregion_t *lcs,
+			     long off1, long lim1, long off2, long lim2);
+static void xdl_hist_mark(xdfile_t *xdf, long off, long lim);
+static int xdl_hist_diff(xdfenv_t *xe, xpparam_t const *xpp,
+			 long off1, long lim1, long off2, long lim2);
+
+
+
+static void xdl_hist_free_index(xdhindex_t *idx) {
+
+	xdl_free(idx->rhash);
+	xdl_free(idx->line_map);
+	xdl_free(idx->next_ptrs);
+	xdl_cha_free(&idx->rcha);
+}
+
+
+/*
+ * Index the lines of the first file, last to first, so that the
+ * occurrences of each line are chained in increasing order.
+ */
+static int xdl_hist_scan_a(xdhindex_t *idx, long off1, long lim1) {
+	long ptr, chain_len;
+	unsigned long hi;
+	xdhrec_t *rec;
+
+	for (ptr = lim1 - 1; ptr >= off1; ptr--) {
+		hi = XDL_HASHLONG(XDL_HREC(idx->env, 1, ptr)->ha, idx->hbits);
+		chain_len = 0;
+		for (rec = idx->rhash[hi]; rec; rec = rec->next, chain_len++)
+			if (XDL_HREC(idx->env, 1, rec->ptr)->ha ==
+			    XDL_HREC(idx->env, 1, ptr)->ha)
+				break;
+
+		if (rec) {
+			XDL_HNEXT(idx, ptr) = rec->ptr;
+			rec->ptr = ptr;
+			rec->cnt++;
+		} else {
+			/*
+			 * Too many distinct lines in one bucket means the
+			 * index is not going to help; let the caller fall
+			 * back to the classic algorithm.
+			 */
+			if (chain_len >= XDL_HIST_MAX_CHAIN)
+				return 1;
+			if (!(rec = (xdhrec_t *) xdl_cha_alloc(&idx->rcha))) {
+
+				return -1;
+			}
+			rec->ptr = ptr;
+			rec->cnt = 1;
+			rec->next = idx->rhash[hi];
+			idx->rhash[hi] = rec;
+			XDL_HNEXT(idx, ptr) = -1;
+		}
+		idx->line_map[ptr - off1] = rec;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Look for the common regions that go through line "bptr" of the
+ * second file and remember the best one so far in "lcs".  Returns
+ * the next line of the second file worth looking at.
+ */
+static long xdl_hist_try_lcs(xdhindex_t *idx, xdhregion_t *lcs, long bptr,
+			     long off1, long lim1, long off2, long lim2) {
+	long bnext = bptr + 1;
+	long as, ae, bs, be, np, rc;
+	unsigned long hi;
+	xdhrec_t *rec;
+
+	hi = XDL_HASHLONG(XDL_HREC(idx->env, 2, bptr)->ha, idx->hbits);
+	for (rec = idx->rhash[hi]; rec; rec = rec->next) {
+		if (!XDL_HSAME(idx->env, rec->ptr, bptr))
+			continue;
+		idx->has_common = 1;
+		if (rec->cnt > idx->cnt)
+			continue;
+
+		for (as = rec->ptr;;) {
+			np = XDL_HNEXT(idx, as);
+			bs = bptr;
+			ae = as;
+			be = bs;
+			rc = rec->cnt;
+
+			while (off1 < as && off2 < bs &&
+			       XDL_HSAME(idx->env, as - 1, bs - 1)) {
+				as--;
+				bs--;
+				if (1 < rc)
+					rc = XDL_MIN(rc, XDL_HCNT(idx, as));
+			}
+			while (ae < lim1 - 1 && be < lim2 - 1 &&
+			       XDL_HSAME(idx->env, ae + 1, be + 1)) {
+				ae++;
+				be++;
+				if (1 < rc)
+					rc = XDL_MIN(rc, XDL_HCNT(idx, ae));
+			}
+
+			if (bnext <= be)
+				bnext = be + 1;
+			if (!lcs->found || lcs->end1 - lcs->begin1 < ae - as ||
+			    rc < idx->cnt) {
+				lcs->begin1 = as;
+				lcs->begin2 = bs;
+				lcs->end1 = ae;
+				lcs->end2 = be;
+				lcs->found = 1;
+				idx->cnt = rc;
+			}
+
+			/*
+			 * Skip the occurrences inside the region we just
+			 * went through.
+			 */
+			while (np >= 0 && np <= ae)
+				np = XDL_HNEXT(idx, np);
+			if (np < 0)
+				break;
+			as = np;
+		}
+	}
+
+	return bnext;
+}
+
+
+/*
+ * Returns 0 with the anchor in "lcs" (not found if there is no common
+ * line at all), 1 if the classic algorithm should be used instead,
+ * and -1 on error.
+ */
+static int xdl_hist_find_lcs(xdfenv_t *xe, xdhregion_t *lcs,
+			     long off1, long lim1, long off2, long lim2) {
+	long i, bptr, cnt1 = lim1 - off1;
+	int ret = -1;
+	xdhindex_t idx;
+
+	memset(&idx, 0, sizeof(idx));
+	idx.env = xe;
+	idx.off1 = off1;
+	idx.hbits = xdl_hashbits((unsigned int) cnt1);
+
+	if (xdl_cha_init(&idx.rcha, sizeof(xdhrec_t), cnt1 / 4 + 1) < 0) {
+
+		return -1;
+	}
+	if (!(idx.rhash = (xdhrec_t **) xdl_malloc((1 << idx.hbits) * sizeof(xdhrec_t *))) ||
+	    !(idx.line_map = (xdhrec_t **) xdl_malloc(cnt1 * sizeof(xdhrec_t *))) ||
+	    !(idx.next_ptrs = (long *) xdl_malloc(cnt1 * sizeof(long)))) {
+
+		xdl_hist_free_index(&idx);
+		return -1;
+	}
+	for (i = 0; i < (1 << idx.hbits); i++)
+		idx.rhash[i] = NULL;
+
+	if ((ret = xdl_hist_scan_a(&idx, off1, lim1)) != 0) {
+
+		xdl_hist_free_index(&idx);
+		return ret;
+	}
+
+	idx.cnt = XDL_HIST_MAX_CHAIN + 1;
+	for (bptr = off2; bptr < lim2;)
+		bptr = xdl_hist_try_lcs(&idx, lcs, bptr, off1, lim1, off2, lim2);
+
+	/*
+	 * There are common lines, but all of them are too frequent to
+	 * be trusted as anchors.
+	 */
+	ret = idx.has_common && idx.cnt > XDL_HIST_MAX_CHAIN;
+
+	xdl_hist_free_index(&idx);
+
+	return ret;
+}
+
+
+static void xdl_hist_mark(xdfile_t *xdf, long off, long lim) {
+
+	for (; off < lim; off++)
+		xdf->rchg[off] = 1;
+}
+
+
+static int xdl_hist_diff(xdfenv_t *xe, xpparam_t const *xpp,
+			 long off1, long lim1, long off2, long lim2) {
+	xdhregion_t lcs;
+	int ret;
+
+	for (;;) {
+		if (off1 == lim1 || off2 == lim2) {
+			xdl_hist_mark(&xe->xdf1, off1, lim1);
+			xdl_hist_mark(&xe->xdf2, off2, lim2);
+			return 0;
+		}
+
+		memset(&lcs, 0, sizeof(lcs));
+		if ((ret = xdl_hist_find_lcs(xe, &lcs, off1, lim1, off2, lim2)) < 0)
+			return -1;
+		if (ret)
+			return xdl_recs_cmp_range(xe, off1, lim1 - off1,
+						  off2, lim2 - off2,
+						  (xpp->flags & XDF_NEED_MINIMAL) != 0);
+		if (!lcs.found) {
+			xdl_hist_mark(&xe->xdf1, off1, lim1);
+			xdl_hist_mark(&xe->xdf2, off2, lim2);
+			return 0;
+		}
+
+		if (xdl_hist_diff(xe, xpp, off1, lcs.begin1, off2, lcs.begin2) < 0)
+			return -1;
+
+		/*
+		 * And the same for what follows the anchor, without
+		 * recursing.
+		 */
+		off1 = lcs.end1 + 1;
+		off2 = lcs.end2 + 1;
+	}
+}
+
+
+int xdl_do_histogram_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
+			  xdfenv_t *xe) {
+
+	if (xdl_prepare_env(mf1, mf2, xpp, xe) < 0) {
+
+		return -1;
+	}
+
+	if (xdl_hist_diff(xe, xpp, xe->xdf1.dstart, xe->xdf1.dend + 1,
+			  xe->xdf2.dstart, xe->xdf2.dend + 1) < 0) {
+
+		xdl_free_env(xe);
+		return -1;
+	}
+
+	return 0;
+}
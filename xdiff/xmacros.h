@@ -33,6 +33,11 @@
 #define XDL_ADDBITS(v,b)	((v) + ((v) >> (b)))
 #define XDL_MASKBITS(b)		((1UL << (b)) - 1)
 #define XDL_HASHLONG(v,b)	(XDL_ADDBITS((unsigned long)(v), b) & XDL_MASKBITS(b))
+#if defined(__GNUC__)
+#define XDL_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define XDL_PREFETCH(p) do { } while (0)
+#endif
 #define XDL_PTRFREE(p) do { if (p) { xdl_free(p); (p) = NULL; } } while (0)
 #define XDL_LE32_PUT(p, v) \
 do { \
@@ -26,6 +26,7 @@
 
 #define XDL_KPDIS_RUN 4
 #define XDL_MAX_EQLIMIT 1024
+#define XDL_CLASSIFY_AHEAD 8
 
 
 
@@ -41,7 +42,7 @@ typedef struct s_xdlclassifier {
 	unsigned int hbits;
 	long hsize;
 	xdlclass_t **rchash;
-	chastore_t ncha;
+	xdlclass_t *carena;
 	long count;
 	long flags;
 } xdlclassifier_t;
@@ -72,13 +73,17 @@ static int xdl_init_classifier(xdlclassifier_t *cf, long size, long flags) {
 	cf->hbits = xdl_hashbits((unsigned int) size);
 	cf->hsize = 1 << cf->hbits;
 
-	if (xdl_cha_init(&cf->ncha, sizeof(xdlclass_t), size / 4 + 1) < 0) {
+	/*
+	 * There cannot be more classes than records, and "size" is
+	 * exact, so the classes come out of one array.
+	 */
+	if (!(cf->carena = (xdlclass_t *) xdl_malloc(size * sizeof(xdlclass_t)))) {
 
 		return -1;
 	}
 	if (!(cf->rchash = (xdlclass_t **) xdl_malloc(cf->hsize * sizeof(xdlclass_t *)))) {
 
-		xdl_cha_free(&cf->ncha);
+		xdl_free(cf->carena);
 		return -1;
 	}
 	for (i = 0; i < cf->hsize; i++)
@@ -93,7 +98,7 @@ static int xdl_init_classifier(xdlclassifier_t *cf, long size, long flags) {
 static void xdl_free_classifier(xdlclassifier_t *cf) {
 
 	xdl_free(cf->rchash);
-	xdl_cha_free(&cf->ncha);
+	xdl_free(cf->carena);
 }
 
 
@@ -112,10 +117,7 @@ static int xdl_classify_record(xdlclassifier_t *cf, xrecord_t **rhash, unsigned
 			break;
 
 	if (!rcrec) {
-		if (!(rcrec = xdl_cha_alloc(&cf->ncha))) {
-
-			return -1;
-		}
+		rcrec = cf->carena + cf->count;
 		rcrec->idx = cf->count++;
 		rcrec->line = line;
 		rcrec->size = rec->size;
@@ -134,26 +136,30 @@ static int xdl_classify_record(xdlclassifier_t *cf, xrecord_t **rhash, unsigned
 }
 
 
+/*
+ * "narec" is the exact number of records (see xdl_count_lines()), so
+ * all the records are allocated at once and nothing is ever resized.
+ */
 static int xdl_prepare_ctx(mmfile_t *mf, long narec, xpparam_t const *xpp,
 			   xdlclassifier_t *cf, xdfile_t *xdf) {
 	unsigned int hbits;
 	long i, nrec, hsize, bsize;
 	unsigned long hav;
 	char const *blk, *cur, *top, *prev;
-	xrecord_t *crec;
-	xrecord_t **recs, **rrecs;
+	xrecord_t *crec, *rarena;
+	xrecord_t **recs;
 	xrecord_t **rhash;
 	unsigned long *ha;
 	char *rchg;
 	long *rindex;
 
-	if (xdl_cha_init(&xdf->rcha, sizeof(xrecord_t), narec / 4 + 1) < 0) {
+	if (!(rarena = (xrecord_t *) xdl_malloc((narec + 1) * sizeof(xrecord_t)))) {
 
 		return -1;
 	}
-	if (!(recs = (xrecord_t **) xdl_malloc(narec * sizeof(xrecord_t *)))) {
+	if (!(recs = (xrecord_t **) xdl_malloc((narec + 1) * sizeof(xrecord_t *)))) {
 
-		xdl_cha_free(&xdf->rcha);
+		xdl_free(rarena);
 		return -1;
 	}
 
@@ -162,7 +168,7 @@ static int xdl_prepare_ctx(mmfile_t *mf, long narec, xpparam_t const *xpp,
 	if (!(rhash = (xrecord_t **) xdl_malloc(hsize * sizeof(xrecord_t *)))) {
 
 		xdl_free(recs);
-		xdl_cha_free(&xdf->rcha);
+		xdl_free(rarena);
 		return -1;
 	}
 	for (i = 0; i < hsize; i++)
@@ -176,38 +182,37 @@ static int xdl_prepare_ctx(mmfile_t *mf, long narec, xpparam_t const *xpp,
 					break;
 				top = blk + bsize;
 			}
-			prev = cur;
-			hav = xdl_hash_record(&cur, top, xpp->flags);
 			if (nrec >= narec) {
-				narec *= 2;
-				if (!(rrecs = (xrecord_t **) xdl_realloc(recs, narec * sizeof(xrecord_t *)))) {
-
-					xdl_free(rhash);
-					xdl_free(recs);
-					xdl_cha_free(&xdf->rcha);
-					return -1;
-				}
-				recs = rrecs;
-			}
-			if (!(crec = xdl_cha_alloc(&xdf->rcha))) {
 
 				xdl_free(rhash);
 				xdl_free(recs);
-				xdl_cha_free(&xdf->rcha);
+				xdl_free(rarena);
 				return -1;
 			}
+			prev = cur;
+			hav = xdl_hash_record(&cur, top, xpp->flags);
+			crec = rarena + nrec;
 			crec->ptr = prev;
 			crec->size = (long) (cur - prev);
 			crec->ha = hav;
 			recs[nrec++] = crec;
+		}
+	}
 
-			if (xdl_classify_record(cf, rhash, hbits, crec) < 0) {
-
-				xdl_free(rhash);
-				xdl_free(recs);
-				xdl_cha_free(&xdf->rcha);
-				return -1;
-			}
+	/*
+	 * Classifying is a walk of a large hash table; with all the
+	 * hashes known, fetch the buckets a few records ahead.
+	 */
+	for (i = 0; i < nrec; i++) {
+		if (i + XDL_CLASSIFY_AHEAD < nrec)
+			XDL_PREFETCH(&cf->rchash[XDL_HASHLONG(recs[i + XDL_CLASSIFY_AHEAD]->ha,
+							      cf->hbits)]);
+		if (xdl_classify_record(cf, rhash, hbits, recs[i]) < 0) {
+
+			xdl_free(rhash);
+			xdl_free(recs);
+			xdl_free(rarena);
+			return -1;
 		}
 	}
 
@@ -215,7 +220,7 @@ static int xdl_prepare_ctx(mmfile_t *mf, long narec, xpparam_t const *xpp,
 
 		xdl_free(rhash);
 		xdl_free(recs);
-		xdl_cha_free(&xdf->rcha);
+		xdl_free(rarena);
 		return -1;
 	}
 	memset(rchg, 0, (nrec + 2) * sizeof(char));
@@ -225,7 +230,7 @@ static int xdl_prepare_ctx(mmfile_t *mf, long narec, xpparam_t const *xpp,
 		xdl_free(rchg);
 		xdl_free(rhash);
 		xdl_free(recs);
-		xdl_cha_free(&xdf->rcha);
+		xdl_free(rarena);
 		return -1;
 	}
 	if (!(ha = (unsigned long *) xdl_malloc((nrec + 1) * sizeof(unsigned long)))) {
@@ -234,11 +239,12 @@ static int xdl_prepare_ctx(mmfile_t *mf, long narec, xpparam_t const *xpp,
 		xdl_free(rchg);
 		xdl_free(rhash);
 		xdl_free(recs);
-		xdl_cha_free(&xdf->rcha);
+		xdl_free(rarena);
 		return -1;
 	}
 
 	xdf->nrec = nrec;
+	xdf->rarena = rarena;
 	xdf->recs = recs;
 	xdf->hbits = hbits;
 	xdf->rhash = rhash;
@@ -260,7 +266,7 @@ static void xdl_free_ctx(xdfile_t *xdf) {
 	xdl_free(xdf->rchg - 1);
 	xdl_free(xdf->ha);
 	xdl_free(xdf->recs);
-	xdl_cha_free(&xdf->rcha);
+	xdl_free(xdf->rarena);
 }
 
 
@@ -269,8 +275,8 @@ int xdl_prepare_env(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
 	long enl1, enl2;
 	xdlclassifier_t cf;
 
-	enl1 = xdl_guess_lines(mf1) + 1;
-	enl2 = xdl_guess_lines(mf2) + 1;
+	enl1 = xdl_count_lines(mf1);
+	enl2 = xdl_count_lines(mf2);
 
 	if (xdl_init_classifier(&cf, enl1 + enl2 + 1, xpp->flags) < 0) {
 
@@ -291,7 +297,13 @@ int xdl_prepare_env(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
 
 	xdl_free_classifier(&cf);
 
-	if (xdl_optimize_ctxs(&xe->xdf1, &xe->xdf2) < 0) {
+	/*
+	 * The histogram algorithm works on all the records, so it only
+	 * wants the common head and tail trimmed.
+	 */
+	if (xpp->flags & XDF_HISTOGRAM_DIFF)
+		xdl_trim_ends(&xe->xdf1, &xe->xdf2);
+	else if (xdl_optimize_ctxs(&xe->xdf1, &xe->xdf2) < 0) {
 
 		xdl_free_ctx(&xe->xdf2);
 		xdl_free_ctx(&xe->xdf1);
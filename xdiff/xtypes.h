@@ -46,7 +46,7 @@ typedef struct s_xrecord {
 } xrecord_t;
 
 typedef struct s_xdfile {
-	chastore_t rcha;
+	xrecord_t *rarena;
 	long nrec;
 	unsigned int hbits;
 	xrecord_t **rhash;
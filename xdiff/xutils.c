@@ -24,7 +24,10 @@
 
 
 
-#define XDL_GUESS_NLINES 256
+/*
+ * A 64-bit golden ratio multiplier (truncated where longs are 32 bits).
+ */
+#define XDL_HASH_MUL (((unsigned long) 0x9e3779b9UL << 16 << 16) | 0x7f4a7c15UL)
 
 
 
@@ -159,31 +162,27 @@ void *xdl_cha_next(chastore_t *cha) {
 }
 
 
-long xdl_guess_lines(mmfile_t *mf) {
-	long nl = 0, size, tsize = 0;
+/*
+ * Count the records exactly, the same way xdl_hash_record() splits
+ * them, so that the record arrays and the hash tables can be sized
+ * once.  The scanning is left to memchr(), which C libraries vectorize.
+ */
+long xdl_count_lines(mmfile_t *mf) {
+	long nl = 0, size;
 	char const *data, *cur, *top;
 
-	if ((cur = data = xdl_mmfile_first(mf, &size)) != NULL) {
-		for (top = data + size; nl < XDL_GUESS_NLINES;) {
-			if (cur >= top) {
-				tsize += (long) (cur - data);
-				if (!(cur = data = xdl_mmfile_next(mf, &size)))
-					break;
-				top = data + size;
-			}
+	for (data = xdl_mmfile_first(mf, &size); data;
+	     data = xdl_mmfile_next(mf, &size)) {
+		if (!size)
+			continue;
+		top = data + size;
+		for (cur = data; (cur = memchr(cur, '\n', top - cur)) != NULL; cur++)
+			nl++;
+		if (top[-1] != '\n')
 			nl++;
-			if (!(cur = memchr(cur, '\n', top - cur)))
-				cur = top;
-			else
-				cur++;
-		}
-		tsize += (long) (cur - data);
 	}
 
-	if (nl && tsize)
-		nl = xdl_mmfile_size(mf) / (tsize / nl);
-
-	return nl + 1;
+	return nl;
 }
 
 int xdl_recmatch(const char *l1, long s1, const char *l2, long s2, long flags)
@@ -269,20 +268,38 @@ static unsigned long xdl_hash_record_with_whitespace(char const **data,
 }
 
 
+/*
+ * Hash a whole word at a time; the value only has to be the same for
+ * identical lines, as records are compared by class after preparation.
+ */
+static unsigned long xdl_hash_bytes(char const *ptr, long size) {
+	unsigned long ha = 5381 ^ (unsigned long) size, w;
+
+	for (; size >= (long) sizeof(w); ptr += sizeof(w), size -= sizeof(w)) {
+		memcpy(&w, ptr, sizeof(w));
+		ha = (ha ^ w) * XDL_HASH_MUL;
+	}
+	if (size) {
+		w = 0;
+		memcpy(&w, ptr, size);
+		ha = (ha ^ w) * XDL_HASH_MUL;
+	}
+
+	return ha ^ (ha >> (4 * sizeof(ha)));
+}
+
+
 unsigned long xdl_hash_record(char const **data, char const *top, long flags) {
-	unsigned long ha = 5381;
-	char const *ptr = *data;
+	char const *ptr = *data, *eol;
 
 	if (flags & XDF_WHITESPACE_FLAGS)
 		return xdl_hash_record_with_whitespace(data, top, flags);
 
-	for (; ptr < top && *ptr != '\n'; ptr++) {
-		ha += (ha << 5);
-		ha ^= (unsigned long) *ptr;
-	}
-	*data = ptr < top ? ptr + 1: ptr;
+	if (!(eol = memchr(ptr, '\n', top - ptr)))
+		eol = top;
+	*data = eol < top ? eol + 1: eol;
 
-	return ha;
+	return xdl_hash_bytes(ptr, (long) (eol - ptr));
 }
 
 